@@ -8,7 +8,7 @@ package MsuiteUtil;
 use strict;
 use warnings;
 use Exporter 'import';
-our @EXPORT = qw/$version $ver $url usage makefile_perchr makefile_methcall mk_samheader detect_cycle check_dependency check_index printRed printGrn printYlw makefile_perchr_v2/;
+our @EXPORT = qw/$version $ver $url usage makefile_perchr makefile_methcall mk_samheader detect_cycle check_dependency check_index printRed printGrn printYlw makefile_perchr_v2 plan_shards/;
 
 # long version
 our $version = 'v2.3.0 (Nov 2024)';
@@ -106,22 +106,23 @@ sub makefile_methcall {
 	my $makefile  = shift;
 	my $target    = shift || 'CpG';
 	my $outdir    = shift || '..';
+	my $binary    = shift || 0;	## binary fragment records instead of SAM, see src/fragment.h
 
 	my $job = "";
 	my $mkf = "";
+	my $ext = $binary ? 'frag' : 'sam';
 
-	open IN, "$chrinfo" or die( "$!" );
-	while( <IN> ) {
-		chomp;
-		my ($C, $size) = split /\t/;	## chr size
+	foreach my $unit ( chr_units($chrinfo) ) {
+		my ($C, $size) = @$unit;	## chr size
 		my $chr = "chr$C";
+		my ($wfa, $cfa) = ( "$fastaDIR/w$C.fa", "$fastaDIR/c$C.fa" );
+		($wfa, $cfa) = ( "$fastaDIR/", "$fastaDIR/" ) if $size == 0;	## a shard, see plan_shards
 		$job .= " $chr.meth.log";
-		$mkf .= "$chr.meth.log: chr$C.rmdup.sam rhr$C.rmdup.sam\n";
-		$mkf .= "\t\@$MsuiteBin/meth.caller.$target $seqMode $fastaDIR/w$C.fa chr$C.rmdup.sam $cycle chr$C\n";
-		$mkf .= "\t\@$MsuiteBin/meth.caller.$target $seqMode $fastaDIR/c$C.fa rhr$C.rmdup.sam $cycle rhr$C\n";
-		$mkf .= "\t\@$MsuiteBin/pair.$target chr$C $fastaDIR/w$C.fa $protocol chr$C.$target.call rhr$C.$target.call >chr$C.$target.meth.log\n\n";
+		$mkf .= "$chr.meth.log: chr$C.rmdup.$ext rhr$C.rmdup.$ext\n";
+		$mkf .= "\t\@$MsuiteBin/meth.caller.$target $seqMode $wfa chr$C.rmdup.$ext $cycle chr$C\n";
+		$mkf .= "\t\@$MsuiteBin/meth.caller.$target $seqMode $cfa rhr$C.rmdup.$ext $cycle rhr$C\n";
+		$mkf .= "\t\@$MsuiteBin/pair.$target chr$C $wfa $protocol chr$C.$target.call rhr$C.$target.call >chr$C.$target.meth.log\n\n";
 	}
-	close IN;
 
 	open MK, ">$makefile" or die( "$!" );
 
@@ -232,6 +233,26 @@ Optional parameters:
                    visualization around TSS; default: not set)
   --skip-bam       Skip bam file generation (default: not set)
   --keep-dup       Keep duplications in alignment (default: not set)
+  --stream         Pipe the preprocessed reads to the aligner via named pipes, i.e., do not
+                   write the converted fastq files to disk; the preprocessor then takes 1/4 of
+                   the threads (at least 2) and the aligner the rest (default: not set)
+  --max-mem MB     Memory budget in MB for buffering reads in preprocessing (default: 0, no limit)
+  --qual-side      Send FASTA reads to the aligner and keep the qualities in a side file, which
+                   are put back into the alignments afterwards (default: not set; ignored in --stream)
+  --compact-names  Replace the read names by short keys in the intermediate files, and restore
+                   them for the reads kept in the final BAM (default: not set)
+  --keep-keys      Use with --compact-names to keep the short keys as read names in the final BAM,
+                   the names could be looked up in Msuite2.names (default: not set)
+  --collapse-dup   Send only one copy of the identical reads to the aligner, the other copies are
+                   counted as duplicates in rmdup; it takes about 48 bytes per distinct read (up to
+                   3 times this while the table grows) out of --max-mem, and the new reads are no
+                   longer collapsed once the budget is used up
+                   (default: not set; ignored with --keep-dup or --stream)
+  --shard-size BP  Pack the contigs shorter than BP into shards of about BP in total, each processed
+                   as one file in the per-chr steps; useful for genomes with many small scaffolds
+                   (default: 0, i.e., one file per contig)
+  --binary-frag    Pass binary fragment records instead of SAM files between the per-chr steps,
+                   the SAM text is only written for the BAM file (default: not set)
 
   --CpH            Set this flag to call methylation status of CpH sites (default: not set)
 
@@ -384,35 +405,42 @@ sub makefile_perchr_v2 {
 	my $keepdup   = shift || 0;
 	my $skipBam   = shift || 0;
 	my $outdir    = shift || '..';
+	my $namedict  = shift || '';	## prefix of the name dictionary to restore the read names
+	my $collapsed = shift || 0;		## the read names carry the numbers of copies of the collapsed duplicates
+	my $binary    = shift || 0;		## binary fragment records instead of SAM, see src/fragment.h
 
 	my $job = "";
+	my $ext = $binary ? 'frag' : 'sam';
+	$namedict = " $namedict" if $namedict;
+	my $rmdupside = $namedict;
+	$rmdupside = ( $namedict || ' -' ) . ' 1' if $collapsed;
 	my $mkf = "";
 
-	open IN, "$chrinfo" or die( "$!" );
-	while( <IN> ) {
-		chomp;
-		my ($C, $size) = split /\t/;	## chr size
+	foreach my $unit ( chr_units($chrinfo) ) {
+		my ($C, $size) = @$unit;	## chr size, 0 for a shard
 		my $chr = "chr$C";
 		$chr = "Lambda" if $C eq 'L';
 		$chr = "pUC19"  if $C eq 'P';
 
 		$job .= " $chr.srt.bam";
-		$mkf .= "$chr.srt.bam: chr$C.sam rhr$C.sam\n";
+		$mkf .= "$chr.srt.bam: chr$C.$ext rhr$C.$ext\n";
 		if( $keepdup == 1 ) {
-			$mkf .= "\t\@$MsuiteBin/tag.w.$seqMode $maxins chr$C.sam chr$C >chr$C.rmdup.log\n";
-			$mkf .= "\t\@$MsuiteBin/tag.c.$seqMode $size $maxins rhr$C.sam rhr$C >rhr$C.rmdup.log\n";
+			$mkf .= "\t\@$MsuiteBin/tag.w.$seqMode $maxins chr$C.$ext chr$C$namedict >chr$C.rmdup.log\n";
+			$mkf .= "\t\@$MsuiteBin/tag.c.$seqMode $size $maxins rhr$C.$ext rhr$C$namedict >rhr$C.rmdup.log\n";
 		} else {
-			$mkf .= "\t\@$MsuiteBin/rmdup.w.$seqMode $maxins chr$C.sam chr$C >chr$C.rmdup.log\n";
-			$mkf .= "\t\@$MsuiteBin/rmdup.c.$seqMode $size $maxins rhr$C.sam rhr$C >rhr$C.rmdup.log\n";
+			$mkf .= "\t\@$MsuiteBin/rmdup.w.$seqMode $maxins chr$C.$ext chr$C$rmdupside >chr$C.rmdup.log\n";
+			$mkf .= "\t\@$MsuiteBin/rmdup.c.$seqMode $size $maxins rhr$C.$ext rhr$C$rmdupside >rhr$C.rmdup.log\n";
 		}
 		if( $skipBam ) {
 			$mkf .= "\t\@touch $chr.srt.bam\n\n";
+		} elsif( $binary ) {	## the SAM text is only written here
+			$mkf .= "\t\@$MsuiteBin/frag2sam chr$C.rmdup.frag | cat $samheader - rhr$C.c2w.sam | " .
+					"samtools view --no-PG -bS - | samtools sort --no-PG -o $chr.srt.bam -\n\n";
 		} else {
 			$mkf .= "\t\@cat $samheader chr$C.rmdup.sam rhr$C.c2w.sam | " .
 					"samtools view --no-PG -bS - | samtools sort --no-PG -o $chr.srt.bam -\n\n";
 		}
 	}
-	close IN;
 
 	open MK, ">$makefile" or die( "$!" );
 	if( $skipBam ) {
@@ -435,5 +463,75 @@ $mkf";
 	close MK;
 }
 
+## the units of the per-chr steps: the chrs, and the shards in the 3rd column of chr.info (see
+## plan_shards) which are given with size 0
+sub chr_units {
+	my $chrinfo = shift;
+
+	my (@unit, %seen);
+	open IN, "$chrinfo" or die( "$!" );
+	while( <IN> ) {
+		chomp;
+		my ($C, $size, $shard) = split /\t/;	## chr size [shard]
+		if( defined $shard && $shard ne $C ) {
+			next if $seen{$shard};
+			$seen{$shard} = 1;
+			push @unit, [ $shard, 0 ];
+		} else {
+			push @unit, [ $C, $size ];
+		}
+	}
+	close IN;
+
+	return @unit;
+}
+
+## pack the contigs shorter than $shardsize into shards of about $shardsize in total, balanced by
+## the total length (the longest contig goes to the lightest shard first); Lambda and pUC19 are kept
+## alone for the spike-in report. The shard of each contig is written in the 3rd column of $outfile.
+sub plan_shards {
+	my $chrinfo   = shift;
+	my $shardsize = shift;
+	my $outfile   = shift;
+
+	my (@chr, %size, @small, %name);
+	my $total = 0;
+	open IN, "$chrinfo" or die( "$!" );
+	while( <IN> ) {
+		chomp;
+		my ($C, $size) = split /\t/;	## chr size
+		push @chr, $C;
+		$size{$C} = $size;
+		$name{$C} = 1;
+		next if $C eq 'L' || $C eq 'P' || $size >= $shardsize;
+		push @small, $C;
+		$total += $size;
+	}
+	close IN;
+
+	my %shard;
+	if( $#small > 0 ) {	## nothing to pack for 1 contig
+		my $num = int( ($total+$shardsize-1) / $shardsize );
+		my @load = (0) x $num;
+		foreach my $C ( sort { $size{$b} <=> $size{$a} || $a cmp $b } @small ) {
+			my $k = 0;
+			foreach my $i ( 1..$num-1 ) {
+				$k = $i if $load[$i] < $load[$k];
+			}
+			$load[$k] += $size{$C};
+			$shard{$C} = 'shard' . ($k+1);
+			die( "Error: shard name $shard{$C} is used by a contig!" ) if exists $name{$shard{$C}};
+		}
+	}
+
+	open OUT, ">$outfile" or die( "$!" );
+	foreach my $C ( @chr ) {
+		print OUT "$C\t$size{$C}\t", $shard{$C} || $C, "\n";
+	}
+	close OUT;
+
+	return scalar keys %shard;
+}
+
 1;
 
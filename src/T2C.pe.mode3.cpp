@@ -9,9 +9,15 @@
 #include <omp.h>
 #include <vector>
 #include <unistd.h>
-#include <unordered_map>
 #include "common.h"
 #include "util.h"
+#include "convlog.h"
+#include "qualside.h"
+#include "dupset.h"
+#include "samreader.h"
+#include "samtoken.h"
+#include "chrwriter.h"
+#include "chrrouter.h"
 
 using namespace std;
 
@@ -31,6 +37,7 @@ using namespace std;
  *   read 2:
  *       @xx;xx#    => for reads without frontG
  *       @#         => for reads without frontG and conversions
+ *   xx;xx could also be a bitmask of the positions (=bbbb), see convlog.h
  *
  * Note that in mode3, there is NO endC and frontG issue!!!
  * so this program is speed up the analysis for mode 3 as it is the most common working mode.
@@ -39,7 +46,7 @@ using namespace std;
 
 int main( int argc, char *argv[] ) {
 	if( argc < 4 ) {
-		cerr << "\nUsage: " << argv[0] << " <chr.info> <Msuite2.PE.sam> <output.directory> [thread=1]\n"
+		cerr << "\nUsage: " << argv[0] << " <chr.info> <Msuite2.PE.sam> <output.directory> [thread=1] [qual.prefix|-] [dup.prefix|-] [binary=0]\n"
 			 << "\nThis program is part of Msuite2, designed to change T back to C in the alignment file (mode 3 ONLY)."
 			 << "\nMulti-thread is supported, 4-8 threads are recommanded.\n\n";
 		//cerr << "Rescue mode is ON.\n\n";
@@ -55,6 +62,27 @@ int main( int argc, char *argv[] ) {
 		}
 	}
 
+	// the qualities are put back from prefix.qual if the reads were aligned as FASTA
+	bool qual_side = false;
+	qualside qs;
+	if( argc > 5 && strcmp(argv[5], "-") != 0 ) {
+		if( ! qualside_open(qs, argv[5]) )
+			exit(12);
+		qual_side = true;
+	}
+
+	// the numbers of copies of the collapsed duplicates are put into the read names for rmdup
+	bool collapsed = false;
+	duptable dt;
+	if( argc > 6 && strcmp(argv[6], "-") != 0 ) {
+		if( ! duptable_load(dt, argv[6]) )
+			exit(12);
+		collapsed = true;
+	}
+
+	// binary fragment records (see fragment.h) instead of SAM lines, for rmdup/tag and meth.caller
+	bool binary = ( argc > 7 && atoi(argv[7]) != 0 );
+
 	// prepare files
 	ifstream finfo( argv[1] );
 	if( finfo.fail() ) {
@@ -63,9 +91,14 @@ int main( int argc, char *argv[] ) {
 	}
 
 	stringstream ss;
-	string line, chr, mchr;
+	string line, chr, mchr, shard;
+	unsigned int chrsize;
 	char outfile[128];
-	unordered_map<string, FILE *> updatedSAM;
+	chrrouter updatedSAM;	// chr -> its id in the chrwriter
+	chrrouter_init( updatedSAM );
+	chrwriter cw;
+	chrwriter_init( cw, thread );
+	cw.binary = binary;	// every file is then indexed
 	while( true ) {
 		getline( finfo, line );
 		if( finfo.eof() )break;
@@ -73,58 +106,40 @@ int main( int argc, char *argv[] ) {
 		if( line[0] == '#' )continue;
 		ss.str( line );
 		ss.clear();
-		ss >> chr;
+		ss >> chr >> chrsize;
+		if( ! (ss >> shard) )	// the optional 3rd column puts the contig into a shard, see shard.h
+			shard = chr;
 		mchr = "chr";
 		mchr += chr;
-		sprintf( outfile, "%s/%s.sam", argv[3], mchr.c_str() );
-		FILE * fp = fopen( outfile, "w" );
-		if( fp == NULL ) {
-			cerr << "FATAL: Could not open file " << outfile << " for write.\n";
-			exit(3);
-		}
-		updatedSAM.emplace( pair<string, FILE *>(mchr, fp) );
+		sprintf( outfile, "%s/chr%s.%s", argv[3], shard.c_str(), binary ? "frag" : "sam" );
+		chrrouter_add( updatedSAM, mchr, chrwriter_add(cw, outfile, mchr, chrsize) );
 
 		mchr = "rhr";
 		mchr += chr;
-		sprintf( outfile, "%s/%s.sam", argv[3], mchr.c_str() );
-		fp = fopen( outfile, "w" );
-		if( fp == NULL ) {
-			cerr << "FATAL: Could not open file " << outfile << " for write.\n";
-			exit(3);
-		}
-		updatedSAM.emplace( pair<string, FILE *>(mchr, fp) );
+		sprintf( outfile, "%s/rhr%s.%s", argv[3], shard.c_str(), binary ? "frag" : "sam" );
+		chrrouter_add( updatedSAM, mchr, chrwriter_add(cw, outfile, mchr, chrsize) );
 	}
 	finfo.close();
 
 	// input sam file
-	FILE *insam = fopen( argv[2], "r" );
-	if( insam == NULL ) {
-		cerr << "Error: cannot open file " << argv[1] << "!\n";
+	samstream insam;
+	if( ! sam_open(insam, argv[2]) ) {
+		cerr << "Error: cannot open file " << argv[2] << "!\n";
 		exit(11);
 	}
 
-	// main job
-	char **R1, **R2;
-	R1 = new char * [ READS_PER_BATCH ];
-	R2 = new char * [ READS_PER_BATCH ];
-	for(unsigned int i=0; i!=READS_PER_BATCH; ++i ) {
-		R1[i] = new char[ MAX_SAMLINE_SIZE ];
-		R2[i] = new char[ MAX_SAMLINE_SIZE ];
-	}
+	// main job: R1 and R2 of the index-th pair are lines 2*index and 2*index+1 of the block
+	sambuffer sb;
+	sam_buffer_init( sb, insam, 2, thread );	// the blocks end at pair boundaries
 
 	// working loop
 	register unsigned int cnt = 0;
 	while( true ) {
 		// load files
-		unsigned int loaded = 0;
-		while( true ) {
-			if( fgets( R1[ loaded ], MAX_SAMLINE_SIZE, insam ) == NULL ) break;
-			fgets( R2[ loaded ], MAX_SAMLINE_SIZE, insam );
-			// note that fgets KEEPs the tail '\n'
-
-			++ loaded;
-			if( loaded == READS_PER_BATCH )break;
-		}
+		samblock & blk = sam_buffer_next( sb );	// the next block is loaded meanwhile
+		unsigned int loaded = blk.num >> 1;
+		if( blk.num & 1 )
+			cerr << "\nWarning: the last line of the sam file has no mate, discarded.\n";
 		if( loaded == 0 ) break;
 		cnt += loaded;
 		cerr << "\rProgress: " << cnt << " lines loaded.";
@@ -136,111 +151,89 @@ int main( int argc, char *argv[] ) {
 			unsigned int start = loaded * tn / thread;
 			unsigned int end   = loaded * (tn+1) / thread;
 
-			samRecord read1sam, read2sam;
+			samtoken read1sam, read2sam;
+			uint64_t key;
 			register char *psam;
-			string curr_chr;
 
 			///////////////////////////////////////////// T->C based on conversion log
 			for( unsigned int index=start; index!=end; ++index ) {
 //				cerr << index << "\n";
 				// deal read 1: it always has a smaller genomic coordinate in Msuite2
-				psam = R1[index];
+				psam = sam_line( blk, index<<1 );
 				// split the sam record
-				parseSAM( psam, read1sam );
+				sam_tokenize( read1sam, psam, sam_line_length(blk, index<<1) );
 
 				// check whether it is a primary alignment, discard it if not;
-				int flag = 0;
-				for(register int j=read1sam.flag; psam[j]!='\t'; ++j) {
-					flag *= 10;
-					flag += psam[j] - '0';
-				}
-				if( flag & 256 ) {      // this is a secondary alignment
+				if( sam_flag(read1sam) & 256 ) {      // this is a secondary alignment
 					continue;
 				}
 
 				// get chr
-				curr_chr = psam[ read1sam.chr ];
-				unsigned int i = read1sam.chr + 1;
-				while( psam[i] != '\t' ) {
-					curr_chr += psam[i];
-					++ i;
+				int chrid = chrrouter_find( updatedSAM, psam+sam_offset(read1sam, SAM_RNAME) );
+				if( chrid < 0 ) {
+					cerr << "ERROR: no such chr for " << psam << "\n" ;
+					continue;
 				}
 
 				// process the conversion log
-				i = 0;
-				register char * r1seq = psam + read1sam.seq;
-				if( psam[i] != CONVERSION_LOG_END ) {	// there are changes in this read
-					register unsigned int j = 0;
-					for( ; psam[i] != CONVERSION_LOG_END; ++i ) {
-						if ( psam[i] == CONVERSION_LOG_SEPARATOR ) {	// one change met
-							r1seq[j] = 'C';	//convert back to 'C; read 1 is on WATSON
-							j = 0;
-						} else {
-							j <<= 4;
-							if( psam[i] <= '9' ) {	//0-9, seqName > '0' is always true
-								j += psam[i] - '0';
-							} else {	//a-f
-								j += psam[i] - 87;	// 'a'-10
-							}
-						}
-					}
-					r1seq[j] = 'C';	//convert back to C
+				unsigned int i = 0;
+				register char * r1seq = psam + sam_offset(read1sam, SAM_SEQ);
+				i = convlog_restore<false>( psam+i, r1seq, 0 ) - psam;
+				if( qual_side || collapsed )	// the KEY of the read in the side file or the duplicate table
+					i = qualside_key( psam+i+1, key ) - psam;
+				if( qual_side && ! qualside_restore(qs, key, 0, psam+sam_offset(read1sam, SAM_QUAL), sam_length(read1sam, SAM_SEQ), false) ) {
+					cerr << "Error: read " << key << " is not in the quality side file!\n";
+					exit(12);
 				}
+				if( collapsed )	// "COPIES#" in place of the KEY
+					i = dup_label( psam, i, duptable_copies(dt, key) ) - 1;
 				char *R1offset = psam + i + 1;	// position in seqName for the read ID
 //				cerr << "    " << psam+read1sam.seqName << "\n";
 
 				/////////////////////////////////////////////////////////////////////////////////////////////////////
 				// deal read 2: should be on the reverse chain
-				psam = R2[index];
+				psam = sam_line( blk, index<<1|1 );
 				// split the sam record
-				parseSAM( psam, read2sam );
+				sam_tokenize( read2sam, psam, sam_line_length(blk, index<<1|1) );
 
 				i = 0;
-				register unsigned int len = read2sam.qual - read2sam.seq - 1 - 1;
+				register unsigned int len = sam_length(read2sam, SAM_SEQ) - 1;
 				// length of SEQ - 1; R2 is rev-comp in SAM
 
 				// process the conversion log
-				register char * r2seq = psam + read2sam.seq;
-				if( psam[i] != CONVERSION_LOG_END ) {	// there are G>A conversions
-					register unsigned int j = 0;
-					for( ; psam[i] != CONVERSION_LOG_END; ++i ) {
-						if ( psam[i] == CONVERSION_LOG_SEPARATOR ) {	// one change meet
-							r2seq[len-j] = 'C';	// convert back to C; Read 2 is on CRICK strand
-							j = 0;
-						} else {
-							j <<= 4;
-							if( psam[i] <= '9' ) {	// 0-9
-								j += psam[i] - '0';
-							} else {	// a-f
-								j += psam[i] - 87;	// 'a'-10
-							}
-						}
-					}
-					r2seq[len-j] = 'C';	//convert back to G
+				register char * r2seq = psam + sam_offset(read2sam, SAM_SEQ);
+				i = convlog_restore<true>( psam+i, r2seq, len ) - psam;	// read 2 is on CRICK strand
+				if( qual_side || collapsed )	// the KEY of the read in the side file or the duplicate table
+					i = qualside_key( psam+i+1, key ) - psam;
+				if( qual_side && ! qualside_restore(qs, key, 1, psam+sam_offset(read2sam, SAM_QUAL), sam_length(read2sam, SAM_SEQ), true) ) {
+					cerr << "Error: read " << key << " is not in the quality side file!\n";
+					exit(12);
 				}
+				if( collapsed )
+					i = dup_label( psam, i, duptable_copies(dt, key) ) - 1;
 				char *R2offset = psam + i + 1;
 
 				// write updated sam
-				fprintf( updatedSAM.find(curr_chr)->second, "%s%s", R1offset, R2offset);
+				outbuf & ob = chrwriter_buf( cw, chrid, tn );
+				if( binary ) {
+					outbuf_put_frag( ob, R1offset );
+					outbuf_put_frag( ob, R2offset );
+				} else {
+					outbuf_printf( ob, "%s\n%s\n", R1offset, R2offset);
+				}
 			}// end for loop
 		}// end multi-thread loop
-		if( feof(insam) )break;
+		chrwriter_flush( cw );	// in the order of the threads, i.e., of the input
 	} // end file loop
 
 	cerr << "\rDone. Totally " << cnt << " lines loaded.\n";
-	fclose( insam );
+	sam_close( insam );
+	if( qual_side )
+		qualside_close( qs );
 
-	unordered_map<string, FILE *> :: iterator it;
-	for( it=updatedSAM.begin(); it!=updatedSAM.end(); ++it ) {
-		fclose( it->second );
-	}
+	chrwriter_close( cw );
 
-	for(unsigned int i=0; i!=READS_PER_BATCH; ++i) {
-		delete [] R1[i];
-		delete [] R2[i];
-	}
-	delete [] R1;
-	delete [] R2;
+	sam_buffer_free( sb );
 
 	return 0;
 }
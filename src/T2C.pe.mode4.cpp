@@ -7,9 +7,15 @@
 #include <sstream>
 #include <omp.h>
 #include <unistd.h>
-#include <unordered_map>
 #include "common.h"
 #include "util.h"
+#include "convlog.h"
+#include "qualside.h"
+#include "dupset.h"
+#include "samreader.h"
+#include "samtoken.h"
+#include "chrwriter.h"
+#include "chrrouter.h"
 
 using namespace std;
 
@@ -31,13 +37,14 @@ using namespace std;
  *       @S|xx;xx$  => for reads with frontG and G>A changes, 'S' is its quality score
  *       @xx;xx$    => for reads without frontG
  *       @$         => for reads without frontG and conversions
+ *   xx;xx could also be a bitmask of the positions (=bbbb), see convlog.h
  *
  * This could fasten the de-convert procedure since the whole seqName is untouched
 **/
 
 int main( int argc, char *argv[] ) {
 	if( argc < 4 ) {
-		cerr << "\nUsage: " << argv[0] << " <chr.info> <Msuite2.PE.sam> <output.directory> [thread=1]\n"
+		cerr << "\nUsage: " << argv[0] << " <chr.info> <Msuite2.PE.sam> <output.directory> [thread=1] [qual.prefix|-] [dup.prefix|-] [binary=0]\n"
 			 << "\nThis program is part of Msuite2, designed to change T back to C in the alignment file."
 			 << "\nMulti-thread is supported, 4-8 threads are recommanded.\n\n";
 		//cerr << "Rescue mode is ON.\n\n";
@@ -52,6 +59,28 @@ int main( int argc, char *argv[] ) {
 			thread = omp_get_max_threads();
 		}
 	}
+
+	// the qualities are put back from prefix.qual if the reads were aligned as FASTA
+	bool qual_side = false;
+	qualside qs;
+	if( argc > 5 && strcmp(argv[5], "-") != 0 ) {
+		if( ! qualside_open(qs, argv[5]) )
+			exit(12);
+		qual_side = true;
+	}
+
+	// the numbers of copies of the collapsed duplicates are put into the read names for rmdup
+	bool collapsed = false;
+	duptable dt;
+	if( argc > 6 && strcmp(argv[6], "-") != 0 ) {
+		if( ! duptable_load(dt, argv[6]) )
+			exit(12);
+		collapsed = true;
+	}
+
+	// binary fragment records (see fragment.h) instead of SAM lines, for rmdup/tag and meth.caller
+	bool binary = ( argc > 7 && atoi(argv[7]) != 0 );
+
 	// prepare files
 	ifstream finfo( argv[1] );
 	if( finfo.fail() ) {
@@ -60,10 +89,14 @@ int main( int argc, char *argv[] ) {
 	}
 
 	stringstream ss;
-	string line, chr, mchr;
+	string line, chr, mchr, shard;
+	unsigned int chrsize;
 	char outfile[128];
-	unordered_map<string, FILE *> updatedSAM;
-	unordered_map<string, FILE *> :: iterator it;
+	chrrouter updatedSAM;	// chr -> its id in the chrwriter
+	chrrouter_init( updatedSAM );
+	chrwriter cw;
+	chrwriter_init( cw, thread );
+	cw.binary = binary;	// every file is then indexed
 	while( true ) {
 		getline( finfo, line );
 		if( finfo.eof() )break;
@@ -71,59 +104,41 @@ int main( int argc, char *argv[] ) {
 		if( line[0] == '#' )continue;
 		ss.str( line );
 		ss.clear();
-		ss >> chr;
+		ss >> chr >> chrsize;
+		if( ! (ss >> shard) )	// the optional 3rd column puts the contig into a shard, see shard.h
+			shard = chr;
 
 		mchr = "chr";
 		mchr += chr;
-		sprintf( outfile, "%s/%s.sam", argv[3], mchr.c_str() );
-		FILE * fp = fopen( outfile, "w" );
-		if( fp == NULL ) {
-			cerr << "FATAL: Could not open file " << outfile << " for write.\n";
-			exit(3);
-		}
-		updatedSAM.emplace( pair<string, FILE *>(mchr, fp) );
+		sprintf( outfile, "%s/chr%s.%s", argv[3], shard.c_str(), binary ? "frag" : "sam" );
+		chrrouter_add( updatedSAM, mchr, chrwriter_add(cw, outfile, mchr, chrsize) );
 
 		mchr = "rhr";
 		mchr += chr;
-		sprintf( outfile, "%s/%s.sam", argv[3], mchr.c_str() );
-		fp = fopen( outfile, "w" );
-		if( fp == NULL ) {
-			cerr << "FATAL: Could not open file " << outfile << " for write.\n";
-			exit(3);
-		}
-		updatedSAM.emplace( pair<string, FILE *>(mchr, fp) );
+		sprintf( outfile, "%s/rhr%s.%s", argv[3], shard.c_str(), binary ? "frag" : "sam" );
+		chrrouter_add( updatedSAM, mchr, chrwriter_add(cw, outfile, mchr, chrsize) );
 	}
 	finfo.close();
 
 	// input sam file
-	FILE *insam = fopen( argv[2], "r" );
-	if( insam == NULL ) {
-		cerr << "Error: cannot open file " << argv[1] << "!\n";
+	samstream insam;
+	if( ! sam_open(insam, argv[2]) ) {
+		cerr << "Error: cannot open file " << argv[2] << "!\n";
 		exit(11);
 	}
 
-	// main job
-	char **R1, **R2;
-	R1 = new char * [ READS_PER_BATCH ];
-	R2 = new char * [ READS_PER_BATCH ];
-	for(unsigned int i=0; i!=READS_PER_BATCH; ++i ) {
-		R1[i] = new char[ MAX_SAMLINE_SIZE ];
-		R2[i] = new char[ MAX_SAMLINE_SIZE ];
-	}
+	// main job: R1 and R2 of the index-th pair are lines 2*index and 2*index+1 of the block
+	sambuffer sb;
+	sam_buffer_init( sb, insam, 2, thread );	// the blocks end at pair boundaries
 
 	unsigned int total = 0;
 	// working loop
 	while( true ) {
 		// load files
-		unsigned int loaded = 0;
-		while( true ) {
-			if( fgets( R1[ loaded ], MAX_SAMLINE_SIZE, insam ) == NULL ) break;
-			fgets( R2[ loaded ], MAX_SAMLINE_SIZE, insam );
-			// note that fgets KEEPs the tail '\n'
-
-			++ loaded;
-			if( loaded == READS_PER_BATCH )break;
-		}
+		samblock & blk = sam_buffer_next( sb );	// the next block is loaded meanwhile
+		unsigned int loaded = blk.num >> 1;
+		if( blk.num & 1 )
+			cerr << "\nWarning: the last line of the sam file has no mate, discarded.\n";
 		if( loaded == 0 ) break;
 		total += loaded;
 //		cerr << "\rProgress: " << total << " lines loaded.";
@@ -135,7 +150,10 @@ int main( int argc, char *argv[] ) {
 			unsigned int start = loaded * tn / thread;
 			unsigned int end   = loaded * (tn+1) / thread;
 
-			samRecord read1sam, read2sam;
+			samtoken read1sam, read2sam;
+			unsigned int name1, name2;	// position in the line for the read ID
+			outbuf text = { NULL, 0, 0 };
+			uint64_t key;
 			char newCGAR1[ MAX_CIGAR_SIZE ], newCGAR2[ MAX_CIGAR_SIZE ];
 			register char *r1cigar, *r2cigar;
 			char tail_cigar1[8];
@@ -146,23 +164,18 @@ int main( int argc, char *argv[] ) {
 			register bool endC, frontG;		// indicators: "C" at the end, "G" at the front, and WATSON strand
 			register char QendC, QfrontG;	// quality score for the "C"
 
-			string curr_chr;
 			///////////////////////////////////////////// T->C based on conversion log
 			for( int index=start; index!=end; ++index ) {
 //				cerr << "working " << index << "\n";
 				// deal read 1: it always has a smaller genomic coordinate in Msuite2
-				psam = R1[index];
+				psam = sam_line( blk, index<<1 );
 				// split the sam record
 //				cerr << " Split R1\n";
-				parseSAM( psam, read1sam );	// NOTE HERER!!!
+				sam_tokenize( read1sam, psam, sam_line_length(blk, index<<1) );
+				sam_offset( read1sam, SAM_TAGS );	// locate all the fields before the record is modified
 
 				// check whether it is a primary alignment, discard it if not;
-				int flag = 0;
-				for(register int j=read1sam.flag; psam[j]!='\t'; ++j) {
-					flag *= 10;
-					flag += psam[j] - '0';
-				}
-				if( flag & 256 ) {      // this is a secondary alignment
+				if( sam_flag(read1sam) & 256 ) {      // this is a secondary alignment
 					continue;
 				}
 
@@ -184,37 +197,29 @@ int main( int argc, char *argv[] ) {
 
 				// process the conversion log
 //				cerr << " T -> C\n";
-				register char * r1seq = psam + read1sam.seq;
-				if( psam[i] != CONVERSION_LOG_END ) {	// there are changes in this read
-					register unsigned int j = 0;
-					for( ; psam[i] != CONVERSION_LOG_END; ++i ) {
-						if ( psam[i] == CONVERSION_LOG_SEPARATOR ) {	// one change met
-							r1seq[j] = 'C';	//convert back to 'C; read 1 is on WATSON
-							j = 0;
-						} else {
-							j <<= 4;
-							if( psam[i]<='9' ) {	//0-9, seqName > '0' is always true
-								j += psam[i] - '0';
-							} else {	//a-f
-								j += psam[i] - 87;	// 'a'-10
-							}
-						}
-					}
-					r1seq[j] = 'C';	//convert back to C
+				register char * r1seq = psam + sam_offset(read1sam, SAM_SEQ);
+				i = convlog_restore<false>( psam+i, r1seq, 0 ) - psam;
+				if( qual_side || collapsed )	// the KEY of the read in the side file or the duplicate table
+					i = qualside_key( psam+i+1, key ) - psam;
+				if( qual_side && ! qualside_restore(qs, key, 0, psam+sam_offset(read1sam, SAM_QUAL), sam_length(read1sam, SAM_SEQ), false) ) {
+					cerr << "Error: read " << key << " is not in the quality side file!\n";
+					exit(12);
 				}
-				read1sam.seqName = i + 1;	// position in seqName for the read ID
+				if( collapsed )	// "COPIES#" in place of the KEY
+					i = dup_label( psam, i, duptable_copies(dt, key) ) - 1;
+				name1 = i + 1;	// position in seqName for the read ID
 //				cerr << "    " << psam+read1sam.seqName << "\n";
 
 				// deal with pos and CIGAR;
 //				cerr << " CIGAR\n";
-				r1cigar = psam + read1sam.cigar;
+				r1cigar = psam + sam_offset(read1sam, SAM_CIGAR);
 				if( endC ) {
 					// add 1M to the end of CIGAR
 					// CIGAR: xM[yID]zM[tS]
 ////				psam[ read1sam.cigar    - 1 ] = '\0';
 					//psam[ read1sam.mateflag - 1 ] = '\0';
-					unsigned int len = read1sam.mateflag - read1sam.cigar - 1;
-					add_1M_to_cigar_end(r1cigar, read1sam.mateflag - read1sam.cigar - 1, tail_cigar1);
+					unsigned int len = sam_length(read1sam, SAM_CIGAR);
+					add_1M_to_cigar_end(r1cigar, sam_length(read1sam, SAM_CIGAR), tail_cigar1);
 //					cerr << "endC: " << r1cigar << ", " << tail_cigar1 << "\n";
 //				} else {	// do not need to update CIGAR
 				}
@@ -222,9 +227,10 @@ int main( int argc, char *argv[] ) {
 				/////////////////////////////////////////////////////////////////////////////////////////////////////
 				// deal read 2: should be on the reverse chain
 //				cerr << " R2\n";
-				psam = R2[index];
+				psam = sam_line( blk, index<<1|1 );
 				// split the sam record
-				parseSAM( psam, read2sam );	// NOTE HERER!!!
+				sam_tokenize( read2sam, psam, sam_line_length(blk, index<<1|1) );
+				sam_offset( read2sam, SAM_TAGS );	// locate all the fields before the record is modified
 
 				// look for the conversion log start
 				// look for frontG marker
@@ -237,47 +243,39 @@ int main( int argc, char *argv[] ) {
 					}
 					frontG  = true;
 					i = 2;
-					len = read2sam.qual - read2sam.seq - 1;	// length of SEQ
+					len = sam_length(read2sam, SAM_SEQ);	// length of SEQ
 //					cerr << "    has frontG, qual=" << QfrontG << "\n";
 				} else {
 					frontG = false;
 					i = 0;
-					len = read2sam.qual - read2sam.seq - 1 - 1;	// length of SEQ - 1
+					len = sam_length(read2sam, SAM_SEQ) - 1;	// length of SEQ - 1
 				}
 
 				// process the conversion log
 //				cerr << " T -> C\n";
-				register char * r2seq = psam + read2sam.seq;
-				if( psam[i] != CONVERSION_LOG_END ) {	// there are G>A conversions
-					register unsigned int j = 0;
-					for( ; psam[i] != CONVERSION_LOG_END; ++i ) {
-						if ( psam[i] == CONVERSION_LOG_SEPARATOR ) {	// one change meet
-							r2seq[len-j] = 'C';	// convert back to C; Read 2 is on CRICK strand
-							j = 0;
-						} else {
-							j <<= 4;
-							if( psam[i] <= '9' ) {	// 0-9
-								j += psam[i] - '0';
-							} else {	// a-f
-								j += psam[i] - 87;	// 'a'-10
-							}
-						}
-					}
-					r2seq[len-j] = 'C';	//convert back to G
+				register char * r2seq = psam + sam_offset(read2sam, SAM_SEQ);
+				i = convlog_restore<true>( psam+i, r2seq, len ) - psam;	// read 2 is on CRICK strand
+				if( qual_side || collapsed )	// the KEY of the read in the side file or the duplicate table
+					i = qualside_key( psam+i+1, key ) - psam;
+				if( qual_side && ! qualside_restore(qs, key, 1, psam+sam_offset(read2sam, SAM_QUAL), sam_length(read2sam, SAM_SEQ), true) ) {
+					cerr << "Error: read " << key << " is not in the quality side file!\n";
+					exit(12);
 				}
-				read2sam.seqName = i + 1;
+				if( collapsed )
+					i = dup_label( psam, i, duptable_copies(dt, key) ) - 1;
+				name2 = i + 1;
 
 				// deal with pos and CIGAR
 //				cerr << " CIGAR\n";
-				r2cigar = psam + read2sam.cigar;
+				r2cigar = psam + sam_offset(read2sam, SAM_CIGAR);
 				if( frontG ) {
 					// Read2 has been reverse-complimented in SAM record
 					// add a 'C' to the _end_ of sequence, add 1M at the _end_ of CIGAR
 					// CIGAR: xM[yID]zM
 ////				psam[ read2sam.cigar    - 1 ] = '\0';
-					psam[ read2sam.matedist - 1 ] = '\0';
+					psam[ sam_offset(read2sam, SAM_TLEN) - 1 ] = '\0';
 
-					add_1M_to_cigar_end(r2cigar, read2sam.mateflag - read2sam.cigar - 1, tail_cigar2);
+					add_1M_to_cigar_end(r2cigar, sam_length(read2sam, SAM_CIGAR), tail_cigar2);
 //					cerr << "frontG: " << r2cigar << ", " << tail_cigar2 << "\n";
 //				} else {	// do not need to update CIGAR
 				}
@@ -285,91 +283,83 @@ int main( int argc, char *argv[] ) {
 
 				// write output according to chrosomes, after each batch
 //				cerr << " Output\n";
-				curr_chr = psam[ read2sam.chr ];
-				i = read2sam.chr + 1;
-				while( psam[i] != '\t' ) {
-					curr_chr += psam[i];
-					++ i;
-				}
-
-				it = updatedSAM.find( curr_chr );
-				if( it == updatedSAM.end() ) {
-					cerr << "ERROR: no such chr for " << psam+read1sam.seqName << "\n" ;
+				int chrid = chrrouter_find( updatedSAM, psam+sam_offset(read2sam, SAM_RNAME) );
+				if( chrid < 0 ) {
+					cerr << "ERROR: no such chr for " << psam+name1 << "\n" ;
 					continue;
 				}
-				FILE *fp = updatedSAM.find( curr_chr )->second;
-				// Because this program will be run in multi-thread mode, R1 and R2 MUST be written in 1 fprintf call
+				// the SAM lines are composed in text first and then converted if binary
+				outbuf & ob = binary ? text : chrwriter_buf( cw, chrid, tn );
+				// R1 and R2 are written to the buffer of this thread, so they are always kept together
 //				cerr << "  Update sam, chr=" << chr;
 //				ss.str( "" );
 //				ss.clear();
 
 				if( frontG ) {
 					//read2: CIGAR, fragSize, seq, qual has changed
-					register char *p2 = R2[index];
-					p2[ read2sam.qual     - 1 ] = '\0';
-					p2[ read2sam.remaining- 1 ] = '\0';
+					register char *p2 = sam_line( blk, index<<1|1 );
+					p2[ sam_offset(read2sam, SAM_QUAL)     - 1 ] = '\0';
+					p2[ sam_offset(read2sam, SAM_TAGS)- 1 ] = '\0';
 
 					// update fragment size
-					psam = R1[index];
-					register int fragsize = atoi( psam + read1sam.matedist );
+					psam = sam_line( blk, index<<1 );
+					register int fragsize = sam_tlen( read1sam );
 					++ fragsize;
 
 					// read 1
 					if( endC ) {	// with endC, CIGAR & fragSize changed
 //						cerr << ", endC+frontG\n";
-						psam[ read1sam.matedist - 1 ] = '\0';
-						psam[ read1sam.qual     - 1 ] = '\0';
-						psam[ read1sam.remaining- 1 ] = '\0';
-
-						fprintf(fp, "%s%s\t%s\t%d\t%sC\t%s%c\t%s%s%s\t%s\t-%d\t%sC\t%s%c\t%s",
-								psam+read1sam.seqName, tail_cigar1, psam+read1sam.mateflag, fragsize,
-								psam+read1sam.seq, psam+read1sam.qual, QendC, psam+read1sam.remaining,
-								p2+read2sam.seqName, tail_cigar2, p2+read2sam.mateflag, fragsize,
-								p2+read2sam.seq, p2+read2sam.qual, QfrontG, p2+read2sam.remaining);
+						psam[ sam_offset(read1sam, SAM_TLEN) - 1 ] = '\0';
+						psam[ sam_offset(read1sam, SAM_QUAL)     - 1 ] = '\0';
+						psam[ sam_offset(read1sam, SAM_TAGS)- 1 ] = '\0';
+
+						outbuf_printf(ob, "%s%s\t%s\t%d\t%sC\t%s%c\t%s\n%s%s\t%s\t-%d\t%sC\t%s%c\t%s\n",
+								psam+name1, tail_cigar1, psam+sam_offset(read1sam, SAM_RNEXT), fragsize,
+								psam+sam_offset(read1sam, SAM_SEQ), psam+sam_offset(read1sam, SAM_QUAL), QendC, psam+sam_offset(read1sam, SAM_TAGS),
+								p2+name2, tail_cigar2, p2+sam_offset(read2sam, SAM_RNEXT), fragsize,
+								p2+sam_offset(read2sam, SAM_SEQ), p2+sam_offset(read2sam, SAM_QUAL), QfrontG, p2+sam_offset(read2sam, SAM_TAGS));
 					} else {	// no endC, only fragSize changed
 //						cerr << ", frontG only\n";
 						// NO endC, then CIGAR1, seq/qual/remaining is not affected
-						psam[ read1sam.matedist - 1 ] = '\0';
-						fprintf(fp, "%s\t%d\t%s%s%s\t%s\t-%d\t%sC\t%s%c\t%s",
-								psam+read1sam.seqName, fragsize, psam+read1sam.seq,
-								p2+read2sam.seqName, tail_cigar2, p2+read2sam.mateflag, fragsize,
-								p2+read2sam.seq, p2+read2sam.qual, QfrontG, p2+read2sam.remaining);
+						psam[ sam_offset(read1sam, SAM_TLEN) - 1 ] = '\0';
+						outbuf_printf(ob, "%s\t%d\t%s\n%s%s\t%s\t-%d\t%sC\t%s%c\t%s\n",
+								psam+name1, fragsize, psam+sam_offset(read1sam, SAM_SEQ),
+								p2+name2, tail_cigar2, p2+sam_offset(read2sam, SAM_RNEXT), fragsize,
+								p2+sam_offset(read2sam, SAM_SEQ), p2+sam_offset(read2sam, SAM_QUAL), QfrontG, p2+sam_offset(read2sam, SAM_TAGS));
 					}
 				} else {	// no frontG, then fragSize is NOT affected
 					// read1
-					psam = R1[index];
+					psam = sam_line( blk, index<<1 );
 					if( endC ) { // endC, seq, qual changed
 //						cerr << ", endC\n";
-						psam[ read1sam.qual     - 1 ] = '\0';
-						psam[ read1sam.remaining- 1 ] = '\0';
+						psam[ sam_offset(read1sam, SAM_QUAL)     - 1 ] = '\0';
+						psam[ sam_offset(read1sam, SAM_TAGS)- 1 ] = '\0';
 
-						fprintf(fp, "%s%s\t%sC\t%s%c\t%s%s",
-								psam+read1sam.seqName, tail_cigar1, psam+read1sam.mateflag,
-								psam+read1sam.qual, QendC, psam+read1sam.remaining,
-								R2[index]+read2sam.seqName);
+						outbuf_printf(ob, "%s%s\t%sC\t%s%c\t%s\n%s\n",
+								psam+name1, tail_cigar1, psam+sam_offset(read1sam, SAM_RNEXT),
+								psam+sam_offset(read1sam, SAM_QUAL), QendC, psam+sam_offset(read1sam, SAM_TAGS),
+								sam_line(blk, index<<1|1)+name2);
 					} else {	// no endC and frontG, ALMOST all elements are not changed
 //						cerr << ", null\n";
-						fprintf(fp, "%s%s", psam+read1sam.seqName, R2[index]+read2sam.seqName);
+						outbuf_printf(ob, "%s\n%s\n", psam+name1, sam_line(blk, index<<1|1)+name2);
 					}
 				}
+				if( binary )
+					outbuf_put_frags( chrwriter_buf(cw, chrid, tn), text );
 			}// end for loop
+			free( text.data );
 		} // end multi-thread loop
+		chrwriter_flush( cw );	// in the order of the threads, i.e., of the input
 
-		if( feof(insam) )break;
 	}	// end file loop
 	cerr << "\rDone. Totally " << total << " lines loaded.\n";
-	fclose( insam );
+	sam_close( insam );
+	if( qual_side )
+		qualside_close( qs );
 
-	for( it=updatedSAM.begin(); it!=updatedSAM.end(); ++it ) {
-		fclose( it->second );
-	}
+	chrwriter_close( cw );
 
-	for(unsigned int i=0; i!=READS_PER_BATCH; ++i ) {
-		delete [] R1[i];
-		delete [] R2[i];
-	}
-	delete [] R1;
-	delete [] R2;
+	sam_buffer_free( sb );
 
 	return 0;
 }
@@ -7,9 +7,15 @@
 #include <sstream>
 #include <omp.h>
 #include <unistd.h>
-#include <unordered_map>
 #include "common.h"
 #include "util.h"
+#include "convlog.h"
+#include "qualside.h"
+#include "dupset.h"
+#include "samreader.h"
+#include "samtoken.h"
+#include "chrwriter.h"
+#include "chrrouter.h"
 
 using namespace std;
 
@@ -31,13 +37,14 @@ using namespace std;
  *       @S|xx;xx$  => for reads with frontG and G>A changes, 'S' is its quality score
  *       @xx;xx$    => for reads without frontG
  *       @$         => for reads without frontG and conversions
+ *   xx;xx could also be a bitmask of the positions (=bbbb), see convlog.h
  *
  * This could fasten the de-convert procedure since the whole seqName is untouched
 **/
 
 int main( int argc, char *argv[] ) {
 	if( argc < 4 ) {
-		cerr << "\nUsage: " << argv[0] << " <chr.info> <Msuite2.sam> <output.directory> [thread=1]\n"
+		cerr << "\nUsage: " << argv[0] << " <chr.info> <Msuite2.sam> <output.directory> [thread=1] [qual.prefix|-] [dup.prefix|-] [binary=0]\n"
 			 << "\nThis program is part of Msuite2, designed to change T back to C in the alignment file."
 			 << "\nMulti-thread is supported, 4-8 threads are recommanded.\n\n";
 		//cerr << "Rescue mode is ON.\n\n";
@@ -52,6 +59,28 @@ int main( int argc, char *argv[] ) {
 			thread = omp_get_max_threads();
 		}
 	}
+
+	// the qualities are put back from prefix.qual if the reads were aligned as FASTA
+	bool qual_side = false;
+	qualside qs;
+	if( argc > 5 && strcmp(argv[5], "-") != 0 ) {
+		if( ! qualside_open(qs, argv[5]) )
+			exit(12);
+		qual_side = true;
+	}
+
+	// the numbers of copies of the collapsed duplicates are put into the read names for rmdup
+	bool collapsed = false;
+	duptable dt;
+	if( argc > 6 && strcmp(argv[6], "-") != 0 ) {
+		if( ! duptable_load(dt, argv[6]) )
+			exit(12);
+		collapsed = true;
+	}
+
+	// binary fragment records (see fragment.h) instead of SAM lines, for rmdup/tag and meth.caller
+	bool binary = ( argc > 7 && atoi(argv[7]) != 0 );
+
 	// prepare files
 	ifstream finfo( argv[1] );
 	if( finfo.fail() ) {
@@ -60,10 +89,14 @@ int main( int argc, char *argv[] ) {
 	}
 
 	stringstream ss;
-	string line, chr, mchr;
+	string line, chr, mchr, shard;
+	unsigned int chrsize;
 	char outfile[128];
-	unordered_map<string, FILE *> updatedSAM;
-	unordered_map<string, FILE *> :: iterator it;
+	chrrouter updatedSAM;	// chr -> its id in the chrwriter
+	chrrouter_init( updatedSAM );
+	chrwriter cw;
+	chrwriter_init( cw, thread );
+	cw.binary = binary;	// every file is then indexed
 	while( true ) {
 		getline( finfo, line );
 		if( finfo.eof() )break;
@@ -71,55 +104,39 @@ int main( int argc, char *argv[] ) {
 		if( line[0] == '#' )continue;
 		ss.str( line );
 		ss.clear();
-		ss >> chr;
+		ss >> chr >> chrsize;
+		if( ! (ss >> shard) )	// the optional 3rd column puts the contig into a shard, see shard.h
+			shard = chr;
 
 		mchr = "chr";
 		mchr += chr;
-		sprintf( outfile, "%s/%s.sam", argv[3], mchr.c_str() );
-		FILE * fp = fopen( outfile, "w" );
-		if( fp == NULL ) {
-			cerr << "FATAL: Could not open file " << outfile << " for write.\n";
-			exit(3);
-		}
-		updatedSAM.emplace( pair<string, FILE *>(mchr, fp) );
+		sprintf( outfile, "%s/chr%s.%s", argv[3], shard.c_str(), binary ? "frag" : "sam" );
+		chrrouter_add( updatedSAM, mchr, chrwriter_add(cw, outfile, mchr, chrsize) );
 
 		mchr = "rhr";
 		mchr += chr;
-		sprintf( outfile, "%s/%s.sam", argv[3], mchr.c_str() );
-		fp = fopen( outfile, "w" );
-		if( fp == NULL ) {
-			cerr << "FATAL: Could not open file " << outfile << " for write.\n";
-			exit(3);
-		}
-		updatedSAM.emplace( pair<string, FILE *>(mchr, fp) );
+		sprintf( outfile, "%s/rhr%s.%s", argv[3], shard.c_str(), binary ? "frag" : "sam" );
+		chrrouter_add( updatedSAM, mchr, chrwriter_add(cw, outfile, mchr, chrsize) );
 	}
 	finfo.close();
 
 	// input sam file
-	FILE *insam = fopen( argv[2], "r" );
-	if( insam == NULL ) {
-		cerr << "Error: cannot open file " << argv[1] << "!\n";
+	samstream insam;
+	if( ! sam_open(insam, argv[2]) ) {
+		cerr << "Error: cannot open file " << argv[2] << "!\n";
 		exit(11);
 	}
 
 	// main job
-	char **Reads = new char * [ READS_PER_BATCH ];
-	for(unsigned int i=0; i!=READS_PER_BATCH; ++i ) {
-		Reads[i] = new char[ MAX_SAMLINE_SIZE ];
-	}
+	sambuffer sb;
+	sam_buffer_init( sb, insam, 1, thread );
 
 	unsigned int total = 0;
 	// working loop
 	while( true ) {
 		// load files
-		unsigned int loaded = 0;
-		while( true ) {
-			if( fgets( Reads[ loaded ], MAX_SAMLINE_SIZE, insam ) == NULL ) break;
-			// note that fgets KEEPs the tail '\n'
-
-			++ loaded;
-			if( loaded == READS_PER_BATCH )break;
-		}
+		samblock & blk = sam_buffer_next( sb );	// the next block is loaded meanwhile
+		unsigned int loaded = blk.num;
 		if( loaded == 0 ) break;
 		total += loaded;
 //		cerr << "\rProgress: " << total << " lines loaded.";
@@ -132,45 +149,37 @@ int main( int argc, char *argv[] ) {
 			unsigned int end   = loaded * (tn+1) / thread;
 //			cerr << "Thread " << tn << '\n';
 
-			samRecord readsam;
+			samtoken readsam;
+			unsigned int name;	// position in the line for the read ID
+			outbuf text = { NULL, 0, 0 };
+			uint64_t key;
 			register char *psam;
 			register bool endC;		// indicators: "C" at the end, "G" at the front, and WATSON strand
 			register char QendC;	// quality score for the "C"
 			char tail_added[8];		// store the modified cigar tail
 
-			string curr_chr;
 			///////////////////////////////////////////// T->C based on conversion log
 			for( int index=start; index!=end; ++index ) {
 //				cerr << "working " << index << "\n";
-				psam = Reads[ index ];
+				psam = sam_line( blk, index );
 				// split the sam record
-				parseSAM( psam, readsam );	// NOTE HERER!!!
+				sam_tokenize( readsam, psam, sam_line_length(blk, index) );
+				sam_offset( readsam, SAM_TAGS );	// locate all the fields before the record is modified
 
 				// check whether it is a primary alignment, discard it if not
-				int flag = 0;
-				for(register int j=readsam.flag; psam[j]!='\t'; ++j) {
-					flag *= 10;
-					flag += psam[j] - '0';
-				}
-				if( flag & 256 ) {      // this is a secondary alignment
+				if( sam_flag(readsam) & 256 ) {      // this is a secondary alignment
 					continue;
 				}
 
 				// get chr
-				curr_chr = psam[ readsam.chr ];
-				register int i = readsam.chr + 1;
-				while( psam[i] != '\t' ) {
-					curr_chr += psam[i];
-					++ i;
-				}
-//				cerr << " " << curr_chr << '\n';
-
-				it = updatedSAM.find( curr_chr );
-				if( it == updatedSAM.end() ) {
-					cerr << "ERROR: no such chr for " << psam+readsam.seqName << "\n" ;
+				int chrid = chrrouter_find( updatedSAM, psam+sam_offset(readsam, SAM_RNAME) );
+				register int i;
+				if( chrid < 0 ) {
+					cerr << "ERROR: no such chr for " << psam << "\n" ;
 					continue;
 				}
-				FILE *fp = updatedSAM.find( curr_chr )->second;
+				// the SAM lines are composed in text first and then converted if binary
+				outbuf & ob = binary ? text : chrwriter_buf( cw, chrid, tn );
 
 				//// deal seqName
 				// check endC marker
@@ -190,25 +199,17 @@ int main( int argc, char *argv[] ) {
 
 				// process the conversion log
 //				cerr << " T -> C\n";
-				register char * rseq = psam + readsam.seq;
-				if( psam[i] != CONVERSION_LOG_END ) {	// there are changes in this read
-					register unsigned int j = 0;
-					for( ; psam[i] != CONVERSION_LOG_END; ++i ) {
-						if ( psam[i] == CONVERSION_LOG_SEPARATOR ) {	// one change met
-							rseq[j] = 'C';	//convert back to 'C; read 1 is on WATSON
-							j = 0;
-						} else {
-							j <<= 4;
-							if( psam[i]<='9' ) {	//0-9, seqName > '0' is always true
-								j += psam[i] - '0';
-							} else {	//a-f
-								j += psam[i] - 87;	// 'a'-10
-							}
-						}
-					}
-					rseq[j] = 'C';	//convert back to C
+				register char * rseq = psam + sam_offset(readsam, SAM_SEQ);
+				i = convlog_restore<false>( psam+i, rseq, 0 ) - psam;
+				if( qual_side || collapsed )	// the KEY of the read in the side file or the duplicate table
+					i = qualside_key( psam+i+1, key ) - psam;
+				if( qual_side && ! qualside_restore(qs, key, 0, psam+sam_offset(readsam, SAM_QUAL), sam_length(readsam, SAM_SEQ), false) ) {
+					cerr << "Error: read " << key << " is not in the quality side file!\n";
+					exit(12);
 				}
-				readsam.seqName = i + 1;	// position in seqName for the read ID
+				if( collapsed )	// "COPIES#" in place of the KEY
+					i = dup_label( psam, i, duptable_copies(dt, key) ) - 1;
+				name = i + 1;	// position in seqName for the read ID
 //				cerr << "    " << psam+read1sam.seqName << "\n";
 
 				// deal with pos and CIGAR;
@@ -217,34 +218,33 @@ int main( int argc, char *argv[] ) {
 					// add 1M to the end of CIGAR, 'C' to seq and QendC to qual
 					// CIGAR: xM[yID]zM
 //					psam[ read1sam.cigar   - 1 ] = '\0';
-					psam[ readsam.qual      -1 ] = '\0';
-					psam[ readsam.remaining -1 ] = '\0';
+					psam[ sam_offset(readsam, SAM_QUAL)      -1 ] = '\0';
+					psam[ sam_offset(readsam, SAM_TAGS) -1 ] = '\0';
 
 					//psam[ read1sam.mateflag - 1 ] = '\0';
-					add_1M_to_cigar_end(psam + readsam.cigar, readsam.mateflag - readsam.cigar - 1, tail_added);
+					add_1M_to_cigar_end(psam + sam_offset(readsam, SAM_CIGAR), sam_length(readsam, SAM_CIGAR), tail_added);
 
-					fprintf(fp, "%s%s\t%sC\t%s%c\t%s",
-							psam+readsam.seqName, tail_added, psam+readsam.mateflag,
-							psam+readsam.qual, QendC, psam+readsam.remaining);
+					outbuf_printf(ob, "%s%s\t%sC\t%s%c\t%s\n",
+							psam+name, tail_added, psam+sam_offset(readsam, SAM_RNEXT),
+							psam+sam_offset(readsam, SAM_QUAL), QendC, psam+sam_offset(readsam, SAM_TAGS));
 				} else {	// do not need to update CIGAR
-					fprintf(fp, "%s", psam+readsam.seqName);
+					outbuf_printf(ob, "%s\n", psam+name);
 				}
+				if( binary )
+					outbuf_put_frags( chrwriter_buf(cw, chrid, tn), text );
 			}// end for loop
+			free( text.data );
 		} // end multi-thread loop
-
-		if( feof(insam) )break;
+		chrwriter_flush( cw );	// in the order of the threads, i.e., of the input
 	}	// end file loop
 	cerr << "\rDone. Totally " << total << " lines loaded.\n";
-	fclose( insam );
+	sam_close( insam );
+	if( qual_side )
+		qualside_close( qs );
 
-	for( it=updatedSAM.begin(); it!=updatedSAM.end(); ++it ) {
-		fclose( it->second );
-	}
+	chrwriter_close( cw );
 
-	for(unsigned int i=0; i!=READS_PER_BATCH; ++i ) {
-		delete [] Reads[i];
-	}
-	delete [] Reads;
+	sam_buffer_free( sb );
 
 	return 0;
 }
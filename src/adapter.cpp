@@ -0,0 +1,257 @@
+#include <string.h>
+#include "adapter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MSUITE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+// the adapters are copied into zero-padded buffers so that a full vector could always be loaded
+static char adapter_r1[ MAX_SIMD_ADAPTER_LEN ] __attribute__((aligned(32)));
+static char adapter_r2[ MAX_SIMD_ADAPTER_LEN ] __attribute__((aligned(32)));
+static const adapter_info *adapter;
+
+static int (*find_pe_kernel)( const char *, const char *, unsigned int );
+static int (*find_se_kernel)( const char *, unsigned int );
+static const char *kernel_name;
+
+/*
+ * use dynamic max_mismatch as the covered size can range from 3 to a large number such as 50:
+ * at most roof(len/8) mismatches in each read, and for PE at most (len+1)/4 in total
+*/
+static inline bool accept_pe( unsigned int mis1, unsigned int mis2, unsigned int len ) {
+	register unsigned int max_mismatch_dynamic = (len+7) >> 3;
+	return mis1 <= max_mismatch_dynamic && mis2 <= max_mismatch_dynamic && mis1+mis2 <= ((len+1)>>2);
+}
+
+static inline bool accept_se( unsigned int mis, unsigned int len ) {
+	return mis <= ((len+7) >> 3);
+}
+
+// number of positions covered by the adapter if it starts at pos
+static inline unsigned int cover_len( unsigned int seqlen, unsigned int pos ) {
+	unsigned int len = seqlen - pos;
+	return ( len > adapter->adapter_len ) ? adapter->adapter_len : len;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// scalar kernels
+static inline bool is_seed( const char *s ) {
+	return s[0]==adapter->adapter_index[0] && s[1]==adapter->adapter_index[1] && s[2]==adapter->adapter_index[2];
+}
+
+static inline unsigned int mismatch_scalar( const char *s, const char *a, unsigned int len ) {
+	register unsigned int mis = 0;
+	for( register unsigned int i=0; i!=len; ++i )
+		mis += ( s[i] != a[i] );
+	return mis;
+}
+
+static int find_adapter_pe_scalar( const char *s1, const char *s2, unsigned int len ) {
+	if( len < adapter_index_len )
+		return -1;
+
+	for( register unsigned int pos=0; pos+adapter_index_len<=len; ++pos ) {
+		if( is_seed(s1+pos) || is_seed(s2+pos) ) {
+			register unsigned int n = cover_len( len, pos );
+			if( accept_pe(mismatch_scalar(s1+pos, adapter->adapter_r1, n),
+							mismatch_scalar(s2+pos, adapter->adapter_r2, n), n) )
+				return pos;
+		}
+	}
+	return -1;
+}
+
+static int find_adapter_se_scalar( const char *s, unsigned int len ) {
+	if( len < adapter_index_len )
+		return -1;
+
+	for( register unsigned int pos=0; pos+adapter_index_len<=len; ++pos ) {
+		if( is_seed(s+pos) ) {
+			register unsigned int n = cover_len( len, pos );
+			if( accept_se(mismatch_scalar(s+pos, adapter->adapter_r1, n), n) )
+				return pos;
+		}
+	}
+	return -1;
+}
+
+#ifdef MSUITE_X86_SIMD
+/////////////////////////////////////////////////////////////////////////////////////////////
+// AVX2 kernels: 32 seed positions per step
+#define AVX2_TARGET __attribute__((target("avx2,popcnt,bmi")))
+
+// bit i is set if the seed starts at s+i
+AVX2_TARGET static inline unsigned int seed_mask_avx2( const char *s, __m256i i0, __m256i i1, __m256i i2 ) {
+	__m256i m = _mm256_cmpeq_epi8( _mm256_loadu_si256((const __m256i *)s), i0 );
+	m = _mm256_and_si256( m, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s+1)), i1) );
+	m = _mm256_and_si256( m, _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(s+2)), i2) );
+	return (unsigned int) _mm256_movemask_epi8( m );
+}
+
+AVX2_TARGET static inline unsigned int mismatch_avx2( const char *s, const char *a, unsigned int len ) {
+	__m256i eq = _mm256_cmpeq_epi8( _mm256_loadu_si256((const __m256i *)s), _mm256_load_si256((const __m256i *)a) );
+	unsigned int mask = ( len == 32 ) ? 0xffffffffU : ( (1U<<len) - 1 );
+	return _mm_popcnt_u32( ~(unsigned int)_mm256_movemask_epi8(eq) & mask );
+}
+
+AVX2_TARGET static int find_adapter_pe_avx2( const char *s1, const char *s2, unsigned int len ) {
+	if( len < adapter_index_len )
+		return -1;
+
+	const __m256i i0 = _mm256_set1_epi8( adapter->adapter_index[0] );
+	const __m256i i1 = _mm256_set1_epi8( adapter->adapter_index[1] );
+	const __m256i i2 = _mm256_set1_epi8( adapter->adapter_index[2] );
+	register unsigned int last = len - adapter_index_len;	// the last possible seed position
+	for( register unsigned int b=0; b<=last; b+=32 ) {
+		register unsigned int m = seed_mask_avx2( s1+b, i0, i1, i2 ) | seed_mask_avx2( s2+b, i0, i1, i2 );
+		if( last - b < 31 )
+			m &= ( 2U << (last-b) ) - 1;
+		while( m ) {	// check the seeds in increasing order
+			register unsigned int pos = b + _tzcnt_u32( m );
+			register unsigned int n = cover_len( len, pos );
+			if( accept_pe(mismatch_avx2(s1+pos, adapter_r1, n), mismatch_avx2(s2+pos, adapter_r2, n), n) )
+				return pos;
+			m &= m - 1;
+		}
+	}
+	return -1;
+}
+
+AVX2_TARGET static int find_adapter_se_avx2( const char *s, unsigned int len ) {
+	if( len < adapter_index_len )
+		return -1;
+
+	const __m256i i0 = _mm256_set1_epi8( adapter->adapter_index[0] );
+	const __m256i i1 = _mm256_set1_epi8( adapter->adapter_index[1] );
+	const __m256i i2 = _mm256_set1_epi8( adapter->adapter_index[2] );
+	register unsigned int last = len - adapter_index_len;
+	for( register unsigned int b=0; b<=last; b+=32 ) {
+		register unsigned int m = seed_mask_avx2( s+b, i0, i1, i2 );
+		if( last - b < 31 )
+			m &= ( 2U << (last-b) ) - 1;
+		while( m ) {
+			register unsigned int pos = b + _tzcnt_u32( m );
+			register unsigned int n = cover_len( len, pos );
+			if( accept_se(mismatch_avx2(s+pos, adapter_r1, n), n) )
+				return pos;
+			m &= m - 1;
+		}
+	}
+	return -1;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// SSE4.2 kernels: 16 seed positions per step
+#define SSE42_TARGET __attribute__((target("sse4.2,popcnt")))
+
+SSE42_TARGET static inline unsigned int seed_mask_sse42( const char *s, __m128i i0, __m128i i1, __m128i i2 ) {
+	__m128i m = _mm_cmpeq_epi8( _mm_loadu_si128((const __m128i *)s), i0 );
+	m = _mm_and_si128( m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s+1)), i1) );
+	m = _mm_and_si128( m, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s+2)), i2) );
+	return (unsigned int) _mm_movemask_epi8( m );
+}
+
+SSE42_TARGET static inline unsigned int mismatch_sse42( const char *s, const char *a, unsigned int len ) {
+	unsigned int lo = _mm_movemask_epi8( _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)s),
+															_mm_load_si128((const __m128i *)a)) );
+	unsigned int hi = _mm_movemask_epi8( _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s+16)),
+															_mm_load_si128((const __m128i *)(a+16))) );
+	unsigned int mask = ( len == 32 ) ? 0xffffffffU : ( (1U<<len) - 1 );
+	return _mm_popcnt_u32( ~(lo | (hi<<16)) & mask );
+}
+
+SSE42_TARGET static int find_adapter_pe_sse42( const char *s1, const char *s2, unsigned int len ) {
+	if( len < adapter_index_len )
+		return -1;
+
+	const __m128i i0 = _mm_set1_epi8( adapter->adapter_index[0] );
+	const __m128i i1 = _mm_set1_epi8( adapter->adapter_index[1] );
+	const __m128i i2 = _mm_set1_epi8( adapter->adapter_index[2] );
+	register unsigned int last = len - adapter_index_len;
+	for( register unsigned int b=0; b<=last; b+=16 ) {
+		register unsigned int m = seed_mask_sse42( s1+b, i0, i1, i2 ) | seed_mask_sse42( s2+b, i0, i1, i2 );
+		if( last - b < 15 )
+			m &= ( 2U << (last-b) ) - 1;
+		while( m ) {
+			register unsigned int pos = b + __builtin_ctz( m );
+			register unsigned int n = cover_len( len, pos );
+			if( accept_pe(mismatch_sse42(s1+pos, adapter_r1, n), mismatch_sse42(s2+pos, adapter_r2, n), n) )
+				return pos;
+			m &= m - 1;
+		}
+	}
+	return -1;
+}
+
+SSE42_TARGET static int find_adapter_se_sse42( const char *s, unsigned int len ) {
+	if( len < adapter_index_len )
+		return -1;
+
+	const __m128i i0 = _mm_set1_epi8( adapter->adapter_index[0] );
+	const __m128i i1 = _mm_set1_epi8( adapter->adapter_index[1] );
+	const __m128i i2 = _mm_set1_epi8( adapter->adapter_index[2] );
+	register unsigned int last = len - adapter_index_len;
+	for( register unsigned int b=0; b<=last; b+=16 ) {
+		register unsigned int m = seed_mask_sse42( s+b, i0, i1, i2 );
+		if( last - b < 15 )
+			m &= ( 2U << (last-b) ) - 1;
+		while( m ) {
+			register unsigned int pos = b + __builtin_ctz( m );
+			register unsigned int n = cover_len( len, pos );
+			if( accept_se(mismatch_sse42(s+pos, adapter_r1, n), n) )
+				return pos;
+			m &= m - 1;
+		}
+	}
+	return -1;
+}
+#endif
+
+void adapter_init( const adapter_info *ai ) {
+	adapter = ai;
+	memset( adapter_r1, 0, MAX_SIMD_ADAPTER_LEN );
+	memset( adapter_r2, 0, MAX_SIMD_ADAPTER_LEN );
+
+	find_pe_kernel = find_adapter_pe_scalar;
+	find_se_kernel = find_adapter_se_scalar;
+	kernel_name = "scalar";
+	if( ai->adapter_len > MAX_SIMD_ADAPTER_LEN )
+		return;
+
+	memcpy( adapter_r1, ai->adapter_r1, ai->adapter_len );
+	memcpy( adapter_r2, ai->adapter_r2, ai->adapter_len );
+#ifdef MSUITE_X86_SIMD
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt") && __builtin_cpu_supports("bmi") ) {
+		find_pe_kernel = find_adapter_pe_avx2;
+		find_se_kernel = find_adapter_se_avx2;
+		kernel_name = "AVX2";
+	} else if( __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt") ) {
+		find_pe_kernel = find_adapter_pe_sse42;
+		find_se_kernel = find_adapter_se_sse42;
+		kernel_name = "SSE4.2";
+	}
+#endif
+}
+
+const char * adapter_kernel() {
+	return kernel_name;
+}
+
+int find_adapter_pe( const char *s1, const char *s2, unsigned int len ) {
+	return find_pe_kernel( s1, s2, len );
+}
+
+int find_adapter_se( const char *s, unsigned int len ) {
+	return find_se_kernel( s, len );
+}
+
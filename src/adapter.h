@@ -0,0 +1,35 @@
+#include "common.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Adapter locator for the preprocessors.
+ * All the positions of the 3-mer adapter index in a read are found in one pass by comparing a whole
+ * vector of positions at once, and the candidates are checked in increasing order by counting the
+ * mismatches against the adapter with masked popcounts. The AVX2 or SSE4.2 kernel is chosen at run
+ * time according to the CPU, with a scalar fallback for other CPUs.
+ *
+ * The kernels may read up to 64 bytes after the end of a read, which is guaranteed by the padding
+ * of the fastq arena (FQ_BLOCK_PADDING in fqreader.h); these bytes never affect the results.
+*/
+
+#ifndef _MSUITE_ADAPTER_
+#define _MSUITE_ADAPTER_
+
+const unsigned int MAX_SIMD_ADAPTER_LEN = 32;	// longer adapters use the scalar kernel
+
+// prepare the adapters and choose the kernel for this CPU; MUST be called before any search
+void adapter_init( const adapter_info *ai );
+const char * adapter_kernel();
+
+// the first position in [0, len) where an adapter starts, or -1 if there is no adapter
+// for PE, s1 and s2 are trimmed to the same length, and a seed in either read is checked on both reads
+int find_adapter_pe( const char *s1, const char *s2, unsigned int len );
+int find_adapter_se( const char *s, unsigned int len );
+
+#endif
+
@@ -0,0 +1,43 @@
+#include "chrrouter.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+void chrrouter_init( chrrouter & cr ) {
+	cr.name.clear();
+	cr.id.clear();
+	cr.mask = ( 1 << CHRROUTER_INIT_BITS ) - 1;
+	cr.slot.assign( cr.mask+1, -1 );
+}
+
+static void chrrouter_insert( chrrouter & cr, int index ) {
+	const string & s = cr.name[ index ];
+	register uint32_t i = chr_hash( s.data(), s.size() ) & cr.mask;
+	while( cr.slot[i] >= 0 )
+		i = ( i + 1 ) & cr.mask;
+	cr.slot[i] = index;
+}
+
+void chrrouter_add( chrrouter & cr, const string & name, unsigned int id ) {
+	for( register uint32_t i=chr_hash(name.data(), name.size())&cr.mask; cr.slot[i]>=0; i=(i+1)&cr.mask ) {
+		if( cr.name[ cr.slot[i] ] == name )
+			return;
+	}
+	cr.name.push_back( name );
+	cr.id.push_back( id );
+
+	if( cr.name.size() << 1 > cr.mask + 1 ) {	// keep the load factor under 0.5
+		cr.mask = ( cr.mask << 1 ) | 1;
+		cr.slot.assign( cr.mask+1, -1 );
+		for( unsigned int i=0; i!=cr.name.size(); ++i )
+			chrrouter_insert( cr, i );
+	} else {
+		chrrouter_insert( cr, cr.name.size()-1 );
+	}
+}
+
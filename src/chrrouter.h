@@ -0,0 +1,56 @@
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Routing of the alignments to the per-chr outputs in T2C.
+ * The chrs in chr.info are put into an open-addressing hash table at startup, and the RNAME of a
+ * record is looked up directly from the SAM line (up to the next '\t'), so no string is built per read.
+*/
+
+#ifndef _MSUITE_CHRROUTER_
+#define _MSUITE_CHRROUTER_
+
+const unsigned int CHRROUTER_INIT_BITS = 6;
+
+typedef struct {
+	vector<string> name;
+	vector<unsigned int> id;	// the id of each chr given by the caller
+	vector<int> slot;			// index of the chr in each slot (-1 for empty)
+	uint32_t mask;
+} chrrouter;
+
+void chrrouter_init( chrrouter & cr );
+
+// add a chr with the given id; the first one is kept if a name is added twice
+void chrrouter_add( chrrouter & cr, const string & name, unsigned int id );
+
+inline uint32_t chr_hash( const char *p, unsigned int len ) {
+	register uint32_t h = 2166136261u;	// FNV-1a
+	for( register unsigned int i=0; i!=len; ++i )
+		h = ( h ^ (unsigned char)p[i] ) * 16777619u;
+	return h;
+}
+
+// id of the chr whose name starts at p and ends at the next '\t'; -1 if it is not in chr.info
+inline int chrrouter_find( const chrrouter & cr, const char *p ) {
+	register unsigned int len = 0;
+	while( p[len] != '\t' )
+		++ len;
+	for( register uint32_t i=chr_hash(p, len)&cr.mask; cr.slot[i]>=0; i=(i+1)&cr.mask ) {
+		const string & s = cr.name[ cr.slot[i] ];
+		if( s.size()==len && memcmp(s.data(), p, len)==0 )
+			return cr.id[ cr.slot[i] ];
+	}
+	return -1;
+}
+
+#endif
+
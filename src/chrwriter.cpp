@@ -0,0 +1,155 @@
+#include <iostream>
+#include <stdarg.h>
+#include <unistd.h>
+#include "chrwriter.h"
+#include "fragment.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+void chrwriter_init( chrwriter & cw, unsigned int thread ) {
+	cw.fp.clear();
+	cw.idx.clear();
+	cw.written.clear();
+	cw.member.clear();
+	cw.fileid.clear();
+	cw.name.clear();
+	cw.size.clear();
+	cw.buf.clear();
+	cw.thread = thread;
+	cw.binary = false;
+}
+
+static FILE * chrwriter_fopen( const string & file ) {
+	FILE *fp = fopen( file.c_str(), "w" );
+	if( fp == NULL ) {
+		cerr << "FATAL: Could not open file " << file << " for write.\n";
+		exit(3);
+	}
+	return fp;
+}
+
+unsigned int chrwriter_add( chrwriter & cw, const char *file, const string & rname, unsigned int size ) {
+	unordered_map<string, unsigned int> :: iterator it = cw.fileid.find( file );
+	if( it == cw.fileid.end() ) {
+		it = cw.fileid.emplace( file, cw.fp.size() ).first;
+		cw.fp.push_back( chrwriter_fopen(file) );
+		cw.idx.push_back( NULL );
+		cw.written.push_back( 0 );
+		cw.member.push_back( vector<unsigned int>() );
+		string idxfile = file;
+		idxfile += ".idx";
+		if( cw.binary ) {
+			cw.idx.back() = chrwriter_fopen( idxfile );
+		} else {
+			unlink( idxfile.c_str() );	// left by a previous run
+		}
+	} else if( cw.idx[ it->second ] == NULL ) {	// the 2nd chr of a shard
+		string idxfile = file;
+		idxfile += ".idx";
+		cw.idx[ it->second ] = chrwriter_fopen( idxfile );
+	}
+
+	unsigned int chr = cw.name.size();
+	cw.member[ it->second ].push_back( chr );
+	cw.name.push_back( rname );
+	cw.size.push_back( size );
+
+	outbuf ob = { NULL, 0, 0 };	// the memory is allocated at the first write
+	cw.buf.insert( cw.buf.end(), cw.thread, ob );
+	return chr;
+}
+
+void chrwriter_flush( chrwriter & cw ) {
+	bool ok = true;
+	#pragma omp parallel for schedule(dynamic) reduction(&&:ok)
+	for( unsigned int i=0; i<cw.fp.size(); ++i ) {
+		for( unsigned int j=0; j!=cw.member[i].size(); ++j ) {
+			unsigned int chr = cw.member[i][j];
+			uint64_t length = 0;
+			for( unsigned int tn=0; tn!=cw.thread; ++tn ) {
+				outbuf & ob = chrwriter_buf( cw, chr, tn );
+				if( ob.used ) {
+					ok = ok && fwrite( ob.data, 1, ob.used, cw.fp[i] ) == ob.used;
+					length += ob.used;
+					ob.used = 0;
+				}
+			}
+			if( cw.idx[i] && length ) {
+				ok = ok && fprintf( cw.idx[i], "%s\t%u\t%llu\t%llu\n", cw.name[chr].c_str(), cw.size[chr],
+										(unsigned long long)cw.written[i], (unsigned long long)length ) > 0;
+			}
+			cw.written[i] += length;
+		}
+	}
+	if( ! ok ) {
+		cerr << "FATAL: Could not write to the output files.\n";
+		exit(3);
+	}
+}
+
+void chrwriter_close( chrwriter & cw ) {
+	for( unsigned int i=0; i!=cw.fp.size(); ++i ) {
+		fclose( cw.fp[i] );
+		if( cw.idx[i] )
+			fclose( cw.idx[i] );
+	}
+	for( unsigned int i=0; i!=cw.buf.size(); ++i )
+		free( cw.buf[i].data );
+	chrwriter_init( cw, cw.thread );
+}
+
+static void outbuf_reserve( outbuf & ob, size_t need ) {
+	size_t cap = ob.capacity ? ob.capacity : OUTBUF_INIT_SIZE;
+	while( cap < need )
+		cap <<= 1;
+	char *p = (char *) realloc( ob.data, cap );
+	if( p == NULL ) {
+		cerr << "Error: could not allocate memory for the output!\n";
+		exit(12);
+	}
+	ob.data = p;
+	ob.capacity = cap;
+}
+
+void outbuf_printf( outbuf & ob, const char *fmt, ... ) {
+	va_list ap;
+	va_start( ap, fmt );
+	int n = vsnprintf( ob.data+ob.used, ob.capacity-ob.used, fmt, ap );
+	va_end( ap );
+	if( n < 0 ) {
+		cerr << "Error: could not format the output!\n";
+		exit(12);
+	}
+	if( ob.used + n >= ob.capacity ) {	// not enough space, the record is written again
+		outbuf_reserve( ob, ob.used + n + 1 );
+		va_start( ap, fmt );
+		vsnprintf( ob.data+ob.used, n+1, fmt, ap );
+		va_end( ap );
+	}
+	ob.used += n;
+}
+
+void outbuf_put_frag( outbuf & ob, const char *line ) {
+	size_t need = ob.used + frag_encode_bound( line );
+	if( need > ob.capacity )
+		outbuf_reserve( ob, need );
+	ob.used += frag_encode_sam( ob.data+ob.used, line );
+}
+
+void outbuf_put_frags( outbuf & ob, outbuf & text ) {
+	register char *line = text.data;
+	register char *end  = text.data + text.used;
+	while( line != end ) {
+		register char *p = (char *) memchr( line, '\n', end-line );
+		*p = '\0';
+		outbuf_put_frag( ob, line );
+		line = p + 1;
+	}
+	text.used = 0;
+}
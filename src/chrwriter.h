@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Per-chr output of T2C.
+ * Each thread writes the records of a batch into its own buffer for each chr, so the threads do not
+ * share any FILE; after the batch, the buffers of each chr are written to its file in the order of the
+ * threads. As every thread processes a continuous range of the batch, the files keep the order of the
+ * input and are the same with any number of threads.
+ * The chrs of a shard share one file, whose offset index (file.idx, see shard.h) is written with it.
+ * With binary fragment records (see fragment.h), every file is indexed as the RNAMEs are not stored.
+*/
+
+#ifndef _MSUITE_CHRWRITER_
+#define _MSUITE_CHRWRITER_
+
+const size_t OUTBUF_INIT_SIZE = 64 << 10;
+
+typedef struct {
+	char *data;
+	size_t used;
+	size_t capacity;
+} outbuf;
+
+typedef struct {
+	vector<FILE *> fp;				// one per output file
+	vector<FILE *> idx;				// index of each file, NULL if it has 1 chr only (and is not binary)
+	vector<uint64_t> written;		// bytes written to each file
+	vector< vector<unsigned int> > member;	// chrs of each file
+	unordered_map<string, unsigned int> fileid;
+	vector<string> name;			// RNAME of each chr
+	vector<unsigned int> size;		// size of each chr
+	vector<outbuf> buf;				// buf[ chr*thread + tn ]
+	unsigned int thread;
+	bool binary;					// the records are fragments, set before adding the chrs
+} chrwriter;
+
+void chrwriter_init( chrwriter & cw, unsigned int thread );
+
+// add a chr written to file (shared by the chrs of a shard), returns the id of the chr
+unsigned int chrwriter_add( chrwriter & cw, const char *file, const string & rname, unsigned int size );
+
+// write the buffers to the files and empty them, the files are written in parallel
+void chrwriter_flush( chrwriter & cw );
+
+// the buffers must be flushed before
+void chrwriter_close( chrwriter & cw );
+
+inline outbuf & chrwriter_buf( chrwriter & cw, unsigned int chr, unsigned int tn ) {
+	return cw.buf[ chr*cw.thread + tn ];
+}
+
+void outbuf_printf( outbuf & ob, const char *fmt, ... ) __attribute__((format(printf, 2, 3)));
+
+// append the fragment record of a SAM line
+void outbuf_put_frag( outbuf & ob, const char *line );
+
+// append the fragment records of the SAM lines in text (each ending with '\n'), and empty text
+void outbuf_put_frags( outbuf & ob, outbuf & text );
+
+#endif
+
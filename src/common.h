@@ -26,13 +26,15 @@
 #ifndef _MSUITE_COMMON_
 #define _MSUITE_COMMON_
 
+#include <stdint.h>
+
 // fastq statistics structure
 typedef struct {
-	unsigned int A;
-	unsigned int C;
-	unsigned int G;
-	unsigned int T;
-	unsigned int N;
+	uint64_t A;
+	uint64_t C;
+	uint64_t G;
+	uint64_t T;
+	uint64_t N;
 } fastqstat;
 
 typedef struct {
@@ -43,31 +45,33 @@ typedef struct {
 } adapter_info;
 
 //illumina sequencing adapters
-const char* illumina_adapter_sequence = "AGATCGGAAGAGC";
+const char* const illumina_adapter_sequence = "AGATCGGAAGAGC";
 const unsigned int illumina_adapter_len = 13;	//strlen(illumina_adapter_sequence)
-const char* illumina_adapter_index = "AGA";
+const char* const illumina_adapter_index = "AGA";
 const adapter_info illumina_adapter = {illumina_adapter_sequence, illumina_adapter_sequence,
 										illumina_adapter_index, illumina_adapter_len};
 
 //nextera sequencing adapters
-const char* nextera_adapter_sequence = "CTGTCTCTTATACACATCT";
+const char* const nextera_adapter_sequence = "CTGTCTCTTATACACATCT";
 const unsigned int nextera_adapter_len = 19;	//strlen(nextera_adapter_sequence)
-const char* nextera_adapter_index = "CTG";
+const char* const nextera_adapter_index = "CTG";
 const adapter_info nextera_adapter = {nextera_adapter_sequence, nextera_adapter_sequence,
 										nextera_adapter_index, nextera_adapter_len};
 
 //bgi sequencing adapters
-const char* bgi_adapter1_sequence = "AAGTCGGAGGCCAAGCGGTC";
-const char* bgi_adapter2_sequence = "AAGTCGGATCGTAGCCATGT";
+const char* const bgi_adapter1_sequence = "AAGTCGGAGGCCAAGCGGTC";
+const char* const bgi_adapter2_sequence = "AAGTCGGATCGTAGCCATGT";
 const unsigned int bgi_adapter_len = 19;	//strlen(bgi_adapter_sequence)
-const char* bgi_adapter_index = "AAG";
+const char* const bgi_adapter_index = "AAG";
 const adapter_info bgi_adapter = {bgi_adapter1_sequence, bgi_adapter2_sequence,
 										bgi_adapter_index, bgi_adapter_len};
 
+const unsigned int adapter_index_len = 3;	// all the adapter_index are 3-mers
+
 const char FILE_SEPARATOR = ',';		// separator if multiple files are provided
 
 const int READS_PER_BATCH  = 1 << 20;	// process 1M reads per batch (for parallelization)
-const int BUFFER_SIZE_PER_BATCH_READ = 1 << 30;	// 1G buffer for each thread to convert FASTQ
+const int READS_PER_CHUNK  = 1 << 16;	// the preprocessors pass 64K reads per chunk between loaders, workers and writer
 
 // seed and error configurations
 const unsigned int impossible_seed = 10000;
@@ -0,0 +1,86 @@
+#include <stdint.h>
+#include "common.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Encodings of the converted positions in the conversion log (between the kept quality score and
+ * CONVERSION_LOG_END, see trimmer.cpp for the whole rule):
+ *   xx;xx;xx => the positions in HEX, separated by CONVERSION_LOG_SEPARATOR
+ *   =bbbb    => bitmask of the positions, 6 bits per character (position 0 is the lowest bit of the
+ *               first one) in the alphabet 0-9A-Za-z-_; the characters after the last converted
+ *               position are omitted
+ * The preprocessors use the shorter one for each read: the HEX list for reads with a few conversions
+ * (e.g., mode 4), and the bitmask for reads with many, which takes at most 1+len/6 characters.
+ * The decoder takes 10 characters (60 bits) at a time and walks through the set bits.
+*/
+
+#ifndef _MSUITE_CONVLOG_
+#define _MSUITE_CONVLOG_
+
+const char CONVERSION_BITMASK_START = '=';
+const unsigned int BITMASK_CHAR_BITS = 6;
+
+static const char bitmask_char[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz-_";
+
+static const unsigned char bitmask_value[128] = {
+	 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,62, 0, 0,
+	 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 0, 0, 0, 0, 0, 0,
+	 0,10,11,12,13,14,15,16,17,18,19,20,21,22,23,24,
+	25,26,27,28,29,30,31,32,33,34,35, 0, 0, 0, 0,63,
+	 0,36,37,38,39,40,41,42,43,44,45,46,47,48,49,50,
+	51,52,53,54,55,56,57,58,59,60,61, 0, 0, 0, 0, 0
+};
+
+/*
+ * change the converted positions in the log starting at p back to 'C'
+ * REV: the read is reverse-complemented in SAM, position j is seq[last-j]
+ * returns the CONVERSION_LOG_END of the log
+*/
+template <bool REV>
+inline const char * convlog_restore( const char *p, char *seq, unsigned int last ) {
+	if( *p == CONVERSION_BITMASK_START ) {
+		++ p;
+		register unsigned int base = 0;
+		while( *p != CONVERSION_LOG_END ) {
+			register uint64_t bits = 0;
+			register unsigned int shift = 0;
+			for( ; shift!=60 && *p!=CONVERSION_LOG_END; shift+=BITMASK_CHAR_BITS, ++p )
+				bits |= (uint64_t)bitmask_value[ (unsigned char)*p & 0x7f ] << shift;
+			for( ; bits; bits &= bits-1 ) {
+				register unsigned int j = base + __builtin_ctzll( bits );
+				seq[ REV ? last-j : j ] = 'C';
+			}
+			base += 60;
+		}
+		return p;
+	}
+
+	if( *p == CONVERSION_LOG_END )	// no conversions
+		return p;
+	register unsigned int j = 0;
+	for( ; *p != CONVERSION_LOG_END; ++p ) {
+		if( *p == CONVERSION_LOG_SEPARATOR ) {	// one change met
+			seq[ REV ? last-j : j ] = 'C';
+			j = 0;
+		} else {
+			j <<= 4;
+			if( *p <= '9' ) {	// 0-9
+				j += *p - '0';
+			} else {	// a-f
+				j += *p - 87;	// 'a'-10
+			}
+		}
+	}
+	seq[ REV ? last-j : j ] = 'C';
+	return p;
+}
+
+#endif
+
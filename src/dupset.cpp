@@ -0,0 +1,147 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include "dupset.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+static dupentry * dupset_alloc( uint64_t n ) {
+	dupentry *p = (dupentry *) calloc( n, sizeof(dupentry) );
+	if( p == NULL ) {
+		cerr << "Error: could not allocate memory for duplicate collapsing!\n";
+		exit(12);
+	}
+	return p;
+}
+
+void dupset_init( dupset & ds, size_t max_bytes ) {
+	ds.mask = ( (uint64_t)1 << DUPSET_INIT_BITS ) - 1;
+	ds.slot = dupset_alloc( ds.mask + 1 );
+	ds.used = 0;
+	ds.collapsed = 0;
+	ds.max_bytes = max_bytes;
+	ds.full = false;
+}
+
+void dupset_free( dupset & ds ) {
+	free( ds.slot );
+	ds.slot = NULL;
+}
+
+// double the table; returns false if the old and the new tables do not fit in the budget
+static bool dupset_grow( dupset & ds ) {
+	if( ds.max_bytes && ( ds.mask + 1 ) * 3 * sizeof(dupentry) > ds.max_bytes )
+		return false;
+
+	uint64_t mask = ( ds.mask << 1 ) | 1;
+	dupentry *slot = dupset_alloc( mask + 1 );
+	for( uint64_t i=0; i<=ds.mask; ++i ) {
+		if( ds.slot[i].hash == 0 )
+			continue;
+		register uint64_t j = ds.slot[i].hash & mask;
+		while( slot[j].hash )
+			j = ( j + 1 ) & mask;
+		slot[j] = ds.slot[i];
+	}
+	free( ds.slot );
+	ds.slot = slot;
+	ds.mask = mask;
+	return true;
+}
+
+bool dupset_add( dupset & ds, uint64_t hash, uint64_t check, uint32_t key ) {
+	if( hash == 0 )	// 0 marks the empty slots
+		hash = 1;
+	if( ! ds.full && ( ds.used + 1 ) << 2 > ( ds.mask + 1 ) * 3 ) {	// keep the load factor under 0.75
+		if( ! dupset_grow( ds ) ) {
+			ds.full = true;
+			cerr << "\nWarning: memory budget is used up, new reads will not be collapsed!\n";
+		}
+	}
+
+	register uint64_t i = hash & ds.mask;
+	while( ds.slot[i].hash ) {
+		register dupentry & e = ds.slot[i];
+		if( e.hash == hash && e.check == check ) {
+			if( e.copies < MAX_DUP_COPIES )
+				++ e.copies;
+			++ ds.collapsed;
+			return false;
+		}
+		i = ( i + 1 ) & ds.mask;
+	}
+	if( ds.full )	// written, but not looked up by the later copies
+		return true;
+	ds.slot[i].hash   = hash;
+	ds.slot[i].check  = check;
+	ds.slot[i].key    = key;
+	ds.slot[i].copies = 1;
+	++ ds.used;
+	return true;
+}
+
+bool dupset_write( const dupset & ds, const string & file ) {
+	vector< pair<uint32_t, uint32_t> > dup;
+	for( uint64_t i=0; i<=ds.mask; ++i ) {
+		if( ds.slot[i].hash && ds.slot[i].copies > 1 )
+			dup.push_back( make_pair(ds.slot[i].key, ds.slot[i].copies) );
+	}
+	sort( dup.begin(), dup.end() );
+
+	vector<uint32_t> key( dup.size() ), copies( dup.size() );
+	for( size_t i=0; i!=dup.size(); ++i ) {
+		key[i]    = dup[i].first;
+		copies[i] = dup[i].second;
+	}
+
+	FILE *fp = fopen( file.c_str(), "wb" );
+	if( fp == NULL )
+		return false;
+	uint64_t n = dup.size();
+	bool ok = fwrite( &n, sizeof(uint64_t), 1, fp ) == 1;
+	if( ok && n )
+		ok = fwrite( key.data(), sizeof(uint32_t), n, fp ) == n &&
+			 fwrite( copies.data(), sizeof(uint32_t), n, fp ) == n;
+	return fclose( fp ) == 0 && ok;
+}
+
+// load prefix.dup
+bool duptable_load( duptable & dt, const char *prefix ) {
+	string file = prefix;
+	file += ".dup";
+	FILE *fp = fopen( file.c_str(), "rb" );
+	if( fp == NULL ) {
+		cerr << "Error: could not open duplicate file '" << file << "'!\n";
+		return false;
+	}
+	uint64_t n;
+	bool ok = fread( &n, sizeof(uint64_t), 1, fp ) == 1;
+	if( ok ) {
+		dt.key.resize( n );
+		dt.copies.resize( n );
+		if( n )
+			ok = fread( dt.key.data(), sizeof(uint32_t), n, fp ) == n &&
+				 fread( dt.copies.data(), sizeof(uint32_t), n, fp ) == n;
+	}
+	fclose( fp );
+	if( ! ok ) {
+		cerr << "Error: broken duplicate file '" << file << "'!\n";
+		return false;
+	}
+	return true;
+}
+
+uint32_t duptable_copies( const duptable & dt, uint64_t key ) {
+	vector<uint32_t>::const_iterator it = lower_bound( dt.key.begin(), dt.key.end(), key );
+	if( it == dt.key.end() || *it != key )
+		return 1;
+	return dt.copies[ it - dt.key.begin() ];
+}
+
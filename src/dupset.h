@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "common.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Exact-duplicate collapsing before the alignment.
+ * The preprocessors hash the trimmed reads (R1+R2, before the conversion, so that the copies have the
+ * same converted sequences AND the same conversion logs) and the writer sends only the first copy of
+ * each read to the aligner. The reads are named as
+ *   [S|]log#KEY#id
+ * where KEY is the same as for the quality side file (see qualside.h), written in 8 HEX digits so that
+ * T2C could put the number of copies in its place; the per-chr SAM files then carry
+ *   COPIES#id
+ * and rmdup counts the collapsed copies as duplicates. The file is
+ *   prefix.dup: uint64 number of reads with more than 1 copy, then their KEYs (uint32, sorted) and
+ *               their numbers of copies (uint32)
+ *
+ * The writer decides in the order of the chunks, so the kept copy is always the first one in the input.
+ * The reads are looked up by a 64-bit hash and confirmed by a second, independent 64-bit hash, so that
+ * different reads are merged only if both collide. The table takes 24 bytes per distinct read (about
+ * 48 bytes with the free slots, and 3 times this while it grows); when it could not grow within the
+ * memory budget, the reads seen so far are still collapsed but the new ones are not added anymore.
+*/
+
+#ifndef _MSUITE_DUPSET_
+#define _MSUITE_DUPSET_
+
+const unsigned int DUP_KEY_DIGITS = 8;		// HEX digits of the KEY, enough for the number of copies in decimal
+const uint64_t MAX_DUP_CHUNK = 1 << 16;		// reads in later chunks are not collapsed, so the KEY fits in 32 bits
+const uint32_t MAX_DUP_COPIES = 999999999;	// the number of copies takes at most DUP_KEY_DIGITS+1 digits
+const unsigned int DUPSET_INIT_BITS = 20;
+const char DUP_COPIES_END = '#';
+
+typedef struct {
+	uint64_t hash;		// 0 for empty slots
+	uint64_t check;		// the second hash
+	uint32_t key;
+	uint32_t copies;
+} dupentry;
+
+// open-addressing hash table of the reads written so far, used by the first writing thread only
+typedef struct {
+	dupentry *slot;
+	uint64_t mask;
+	uint64_t used;
+	uint64_t collapsed;	// reads that are not written
+	size_t max_bytes;	// memory budget of the table, 0 for no limit
+	bool full;			// the table could not grow within the budget, new reads are not added
+} dupset;
+
+// the number of copies of the collapsed reads, loaded by T2C
+typedef struct {
+	vector<uint32_t> key;
+	vector<uint32_t> copies;
+} duptable;
+
+// hash of a read, chained over R1 and R2; the length is mixed in so that the boundary is kept
+inline uint64_t seq_hash( const char *s, unsigned int len, uint64_t h ) {
+	const uint64_t m = 0x9e3779b97f4a7c15ULL;
+	uint64_t v;
+	register unsigned int n = len;
+	for( ; n >= 8; n-=8, s+=8 ) {
+		memcpy( &v, s, 8 );
+		h = ( h ^ v ) * m;
+		h ^= h >> 29;
+	}
+	v = 0;
+	memcpy( &v, s, n );
+	h = ( h ^ v ^ ((uint64_t)len << 48) ) * m;
+	h ^= h >> 32;
+	h *= 0xd6e8feb86659fd93ULL;
+	h ^= h >> 32;
+	return h;
+}
+
+// the second hash, with other constants and rotations so that it collides independently of seq_hash()
+inline uint64_t seq_check( const char *s, unsigned int len, uint64_t h ) {
+	const uint64_t m = 0xff51afd7ed558ccdULL;
+	uint64_t v;
+	register unsigned int n = len;
+	for( ; n >= 8; n-=8, s+=8 ) {
+		memcpy( &v, s, 8 );
+		h = ( h + v ) * m;
+		h = ( h << 31 ) | ( h >> 33 );
+	}
+	v = 0;
+	memcpy( &v, s, n );
+	h = ( h + v + len ) * m;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 29;
+	return h;
+}
+
+// write v in DUP_KEY_DIGITS HEX digits (more if it does not fit); returns the end of the output
+inline char * emit_dup_key( char *p, uint64_t v ) {
+	register unsigned int n = DUP_KEY_DIGITS;
+	while( n < 16 && (v >> (n<<2)) )
+		++ n;
+	for( register unsigned int i=n; i; -- i, v>>=4 )
+		p[i-1] = "0123456789abcdef"[ v & 0xf ];
+	return p + n;
+}
+
+// max_bytes: memory budget of the table, 0 for no limit
+void dupset_init( dupset & ds, size_t max_bytes );
+void dupset_free( dupset & ds );
+
+// hash and check are seq_hash() and seq_check() of R1 then R2
+// returns true if the read is new (and keeps it as the first copy unless the table is full),
+// false if it is a duplicate
+bool dupset_add( dupset & ds, uint64_t hash, uint64_t check, uint32_t key );
+
+bool dupset_write( const dupset & ds, const string & file );
+
+bool duptable_load( duptable & dt, const char *prefix );
+
+// number of copies of the read with the given KEY
+uint32_t duptable_copies( const duptable & dt, uint64_t key );
+
+/*
+ * T2C: write "COPIES#" so that it ends at the '#' after the KEY (psam[end]), over the KEY and the log
+ * before it; returns the start of the new name
+*/
+inline unsigned int dup_label( char *psam, unsigned int end, uint32_t copies ) {
+	register unsigned int i = end;
+	do {
+		psam[ -- i ] = '0' + copies % 10;
+		copies /= 10;
+	} while( copies );
+	return i;
+}
+
+// rmdup: remove "COPIES#" from the name; returns the number of copies (0 if the name is broken)
+inline unsigned int dup_strip( string & name ) {
+	register unsigned int copies = 0;
+	register size_t i = 0;
+	for( ; i!=name.size() && name[i]>='0' && name[i]<='9'; ++i )
+		copies = copies * 10 + name[i] - '0';
+	if( i==0 || i==name.size() || name[i]!=DUP_COPIES_END )
+		return 0;
+	name.erase( 0, i+1 );
+	return copies;
+}
+
+#endif
+
@@ -0,0 +1,147 @@
+#include <string.h>
+#include <stdint.h>
+#include "common.h"
+#include "convlog.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Record emitter for the preprocessors.
+ * The conversion log and the fastq record are written directly into the output buffer of the chunk:
+ * the positions are turned into HEX (or a bitmask, see convlog.h) with lookup tables and the other
+ * fields are copied with memcpy, so there is no temporary string or format parsing for each read.
+ * The caller makes sure that the buffer is large enough (see emit_bound()) and commits the record by
+ * updating the buffer size.
+*/
+
+#ifndef _MSUITE_EMITTER_
+#define _MSUITE_EMITTER_
+
+// 2-digit HEX of 0x00-0xff
+static const char hex_pair[] =
+	"000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f"
+	"202122232425262728292a2b2c2d2e2f303132333435363738393a3b3c3d3e3f"
+	"404142434445464748494a4b4c4d4e4f505152535455565758595a5b5c5d5e5f"
+	"606162636465666768696a6b6c6d6e6f707172737475767778797a7b7c7d7e7f"
+	"808182838485868788898a8b8c8d8e8f909192939495969798999a9b9c9d9e9f"
+	"a0a1a2a3a4a5a6a7a8a9aaabacadaeafb0b1b2b3b4b5b6b7b8b9babbbcbdbebf"
+	"c0c1c2c3c4c5c6c7c8c9cacbcccdcecfd0d1d2d3d4d5d6d7d8d9dadbdcdddedf"
+	"e0e1e2e3e4e5e6e7e8e9eaebecedeeeff0f1f2f3f4f5f6f7f8f9fafbfcfdfeff";
+
+// write v in lower-case HEX without leading zeros (same as "%x"); returns the end of the output
+inline char * emit_hex( char *p, uint64_t v ) {
+	if( v < 0x10 ) {
+		*p = hex_pair[ (v<<1) + 1 ];
+		return p + 1;
+	}
+	if( v >= 0x100 )
+		p = emit_hex( p, v >> 8 );
+	memcpy( p, hex_pair + ((v&0xff)<<1), 2 );
+	return p + 2;
+}
+
+// one entry of the conversion log: HEX position followed by the separator
+inline char * emit_conversion( char *p, unsigned int pos ) {
+	p = emit_hex( p, pos );
+	*p = CONVERSION_LOG_SEPARATOR;
+	return p + 1;
+}
+
+// number of HEX digits of v
+inline unsigned int hex_digits( unsigned int v ) {
+	register unsigned int digits = 1;
+	for( v>>=4; v; v>>=4 )
+		++ digits;
+	return digits;
+}
+
+/*
+ * the converted positions in the shorter encoding; bit j of mask[j>>6] is set if position j is converted
+ * mask holds nword words, and mask[nword] MUST be 0
+*/
+inline char * emit_convlog( char *p, const uint64_t *mask, unsigned int nword ) {
+	register unsigned int hexlen = 0;	// with a separator after each position
+	register unsigned int last = 0;		// the last converted position
+	for( register unsigned int k=0; k!=nword; ++k ) {
+		register uint64_t m = mask[k];
+		if( m == 0 )
+			continue;
+		if( k == 0 )	// positions 0-15 take 1 digit, 16-63 take 2
+			hexlen += __builtin_popcountll( m ) * 3 - __builtin_popcountll( m & 0xffff );
+		else	// the HEX digits change at multiples of 64, so all the positions in a word have the same length
+			hexlen += __builtin_popcountll( m ) * ( hex_digits(k<<6) + 1 );
+		last = (k<<6) + 63 - __builtin_clzll( m );
+	}
+	if( hexlen == 0 )	// no conversions
+		return p;
+
+	if( hexlen-1 <= 2 + last/BITMASK_CHAR_BITS ) {	// HEX list, without the last separator
+		for( register unsigned int k=0; k!=nword; ++k )
+			for( register uint64_t m=mask[k]; m; m &= m-1 )
+				p = emit_conversion( p, (k<<6) + __builtin_ctzll(m) );
+		return p - 1;
+	}
+
+	*p ++ = CONVERSION_BITMASK_START;
+	for( register unsigned int b=0; b<=last; b+=BITMASK_CHAR_BITS ) {
+		register unsigned int off = b & 63;
+		register uint64_t v = mask[ b>>6 ] >> off;
+		if( off > 64 - BITMASK_CHAR_BITS )	// the character spans 2 words
+			v |= mask[ (b>>6) + 1 ] << ( 64-off );
+		*p ++ = bitmask_char[ v & 63 ];
+	}
+	return p;
+}
+
+// the quality score of the discarded base and its marker (mode 4)
+inline char * emit_kept_qual( char *p, char qual ) {
+	p[0] = ( qual == '@' ) ? REPLACEMENT_CHAR_AT : qual;
+	p[1] = KEEP_QUAL_MARKER;
+	return p + 2;
+}
+
+// id '\n' seq '\n' '+' '\n' qual '\n'
+inline char * emit_fastq( char *p, const char *id, unsigned int idlen,
+							const char *seq, const char *qual, unsigned int len ) {
+	memcpy( p, id, idlen );
+	p += idlen;
+	*p ++ = '\n';
+	memcpy( p, seq, len );
+	p += len;
+	memcpy( p, "\n+\n", 3 );
+	p += 3;
+	memcpy( p, qual, len );
+	p += len;
+	*p = '\n';
+	return p + 1;
+}
+
+// id '\n' seq '\n', for the reads whose qualities go to the side file
+inline char * emit_fasta( char *p, const char *id, unsigned int idlen, const char *seq, unsigned int len ) {
+	memcpy( p, id, idlen );
+	p += idlen;
+	*p ++ = '\n';
+	memcpy( p, seq, len );
+	p += len;
+	*p = '\n';
+	return p + 1;
+}
+
+// the qualities of a read in the side file, padded to stride bytes
+inline char * emit_side_qual( char *p, const char *qual, unsigned int len, unsigned int stride ) {
+	memcpy( p, qual, len );
+	memset( p+len, 0, stride-len );
+	return p + stride;
+}
+
+// the maximum size of a record: the conversion log (with every base converted) and the fastq lines
+inline unsigned int emit_bound( unsigned int idlen, unsigned int len ) {
+	return 3 + len*(hex_digits(len)+1) + idlen + (len<<1) + 4;
+}
+
+#endif
+
@@ -0,0 +1,186 @@
+#include <iostream>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "fqreader.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+/*
+ * open a fastq file; gzipped files are decompressed by a separate thread pool with gz_thread threads
+*/
+bool fq_open( fqstream & fs, const char *file, unsigned int gz_thread ) {
+	fs.eof = false;
+	fs.carried = 0;
+	fs.carry = NULL;
+	fs.fd = -1;
+	fs.gr = NULL;
+
+	size_t len = strlen( file );
+	if( len>3 && file[len-3]=='.' && file[len-2]=='g' && file[len-1]=='z' ) {	// .gz file
+		fs.is_gz = true;
+		fs.gr = gz_open( file, gz_thread );
+		if( fs.gr == NULL )
+			return false;
+	} else {	// plain text
+		fs.is_gz = false;
+		fs.fd = open( file, O_RDONLY );
+		if( fs.fd < 0 )
+			return false;
+	}
+
+	return true;
+}
+
+void fq_close( fqstream & fs ) {
+	if( fs.is_gz ) {
+		gz_close( fs.gr );
+	} else {
+		close( fs.fd );
+	}
+	if( fs.carry != NULL )
+		free( fs.carry );
+	fs.carry = NULL;
+	fs.carried = 0;
+}
+
+// arena_size is the initial size of the arena, it grows when necessary
+void fq_block_init( fqblock & blk, unsigned int max_num, size_t arena_size ) {
+	blk.arena = (char *) malloc( arena_size );
+	blk.capacity = arena_size;
+	blk.used = 0;
+	blk.rec = new fqrecord [ max_num ];
+	blk.num = 0;
+	blk.max_num = max_num;
+	if( blk.arena == NULL ) {
+		cerr << "Error: could not allocate memory for loading reads!\n";
+		exit(12);
+	}
+}
+
+void fq_block_free( fqblock & blk ) {
+	free( blk.arena );
+	delete [] blk.rec;
+	blk.arena = NULL;
+	blk.rec = NULL;
+}
+
+// make sure that the arena could hold at least 'need' bytes; offsets are kept, pointers are NOT
+static void fq_reserve( fqblock & blk, size_t need ) {
+	if( need <= blk.capacity )
+		return;
+
+	if( need > 0xffffffffULL ) {
+		cerr << "Error: the reads in one batch exceed 4GB, please check your fastq file!\n";
+		exit(12);
+	}
+	size_t cap = blk.capacity << 1;
+	while( cap < need )
+		cap <<= 1;
+	char *p = (char *) realloc( blk.arena, cap );
+	if( p == NULL ) {
+		cerr << "Error: could not allocate memory for loading reads!\n";
+		exit(12);
+	}
+	blk.arena = p;
+	blk.capacity = cap;
+}
+
+// fetch the next chunk of the file to the end of the arena
+static void fq_fetch( fqstream & fs, fqblock & blk ) {
+	fq_reserve( blk, blk.used + FQ_READ_CHUNK + FQ_BLOCK_PADDING );
+
+	long n;
+	char *p = blk.arena + blk.used;
+	if( fs.is_gz ) {
+		n = gz_read( fs.gr, p, FQ_READ_CHUNK );
+	} else {
+		n = read( fs.fd, p, FQ_READ_CHUNK );
+	}
+	if( n < 0 ) {
+		cerr << "Error: read fastq file failed!\n";
+		exit(11);
+	}
+	if( n == 0 ) {
+		fs.eof = true;
+	} else {
+		blk.used += n;
+	}
+}
+
+/*
+ * load at most blk.max_num reads from fs into blk, returns the number of loaded reads
+ * the 4 lines of a read are located using memchr, the arena is NOT touched by the parser
+*/
+unsigned int fq_load_block( fqstream & fs, fqblock & blk ) {
+	blk.num  = 0;
+	blk.used = 0;
+
+	// restore the data left by the previous block
+	if( fs.carried ) {
+		fq_reserve( blk, fs.carried + FQ_READ_CHUNK + FQ_BLOCK_PADDING );
+		memcpy( blk.arena, fs.carry, fs.carried );
+		blk.used = fs.carried;
+		fs.carried = 0;
+	}
+
+	register size_t parsed = 0;	// the first byte that is not parsed yet
+	register char *p, *end, *l1, *l2, *l3, *l4;
+	while( blk.num != blk.max_num ) {
+		p   = blk.arena + parsed;
+		end = blk.arena + blk.used;
+		l1 = l2 = l3 = l4 = NULL;
+		if( (l1=(char *)memchr(p, '\n', end-p)) != NULL &&
+				(l2=(char *)memchr(l1+1, '\n', end-l1-1)) != NULL &&
+				(l3=(char *)memchr(l2+1, '\n', end-l2-1)) != NULL ) {
+			l4 = (char *)memchr( l3+1, '\n', end-l3-1 );
+		}
+
+		if( l4 == NULL ) {	// the current read is incomplete
+			if( ! fs.eof ) {
+				fq_fetch( fs, blk );
+				continue;
+			}
+			// the last read may not contain '\n' for quality line
+			if( l3 != NULL && l3+1 != end ) {
+				l4 = end;
+			} else {
+				parsed = blk.used;
+				break;
+			}
+		}
+
+		fqrecord & r = blk.rec[ blk.num ];
+		r.id      = parsed;
+		r.idlen   = l1 - p;
+		r.seq     = r.id + r.idlen + 1;
+		r.seqlen  = l2 - l1 - 1;
+		r.qual    = l3 - blk.arena + 1;
+		r.quallen = l4 - l3 - 1;
+		++ blk.num;
+
+		parsed = l4 - blk.arena + 1;
+		if( parsed > blk.used )
+			parsed = blk.used;
+	}
+
+	// keep the unused data for the next block
+	if( parsed != blk.used ) {
+		fs.carried = blk.used - parsed;
+		fs.carry = (char *) realloc( fs.carry, fs.carried );
+		if( fs.carry == NULL ) {
+			cerr << "Error: could not allocate memory for loading reads!\n";
+			exit(12);
+		}
+		memcpy( fs.carry, blk.arena + parsed, fs.carried );
+	}
+
+	return blk.num;
+}
+
@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "gzreader.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Block-based FASTQ loader for the preprocessors.
+ * A batch of reads is loaded into ONE contiguous arena and each read is described by offsets
+ * into this arena, so no per-read memory allocation is needed; the arena is re-used between batches.
+*/
+
+#ifndef _MSUITE_FQREADER_
+#define _MSUITE_FQREADER_
+
+const size_t FQ_READ_CHUNK     = 8 << 20;	// bytes fetched from the file per read()/gz_read() call
+const size_t FQ_BLOCK_PADDING  = 64;		// readable bytes after the loaded data, for the SIMD kernels
+
+// one read in a loaded block; id/seq/qual are offsets into the arena, the tail '\n' is NOT included
+// the id line keeps its leading '@'; the '+' line is skipped
+typedef struct {
+	unsigned int id;
+	unsigned int seq;
+	unsigned int qual;
+	unsigned int idlen;
+	unsigned int seqlen;
+	unsigned int quallen;
+} fqrecord;
+
+// a batch of reads sharing one arena
+typedef struct {
+	char *arena;
+	size_t used;
+	size_t capacity;
+	fqrecord *rec;
+	unsigned int num;
+	unsigned int max_num;
+} fqblock;
+
+// an opened fastq file, plain text or gzipped
+// the bytes after the last complete read of a block are carried to the next block
+typedef struct {
+	int fd;
+	gzreader *gr;
+	bool is_gz;
+	bool eof;
+	char *carry;
+	size_t carried;
+} fqstream;
+
+bool fq_open( fqstream & fs, const char *file, unsigned int gz_thread );
+void fq_close( fqstream & fs );
+
+void fq_block_init( fqblock & blk, unsigned int max_num, size_t arena_size );
+void fq_block_free( fqblock & blk );
+
+unsigned int fq_load_block( fqstream & fs, fqblock & blk );
+
+#endif
+
@@ -0,0 +1,138 @@
+#include <iostream>
+#include <fstream>
+#include <string.h>
+#include <stdlib.h>
+#include "fqstat.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+static void * aligned_alloc64( size_t size ) {
+	void *p;
+	if( posix_memalign(&p, 64, size) != 0 ) {
+		cerr << "Error: could not allocate memory for statistics!\n";
+		exit(12);
+	}
+	memset( p, 0, size );
+	return p;
+}
+
+#ifndef __SSE2__
+static unsigned char base_row[256];	// A/C/G/T => 0/1/2/3, others => 4 (not counted)
+#endif
+
+void basecounter_init( basecounter & bc, unsigned int cycle ) {
+#ifndef __SSE2__
+	memset( base_row, 4, 256 );
+	base_row['A'] = base_row['a'] = 0;
+	base_row['C'] = base_row['c'] = 1;
+	base_row['G'] = base_row['g'] = 2;
+	base_row['T'] = base_row['t'] = 3;
+#endif
+	bc.cycle  = cycle;
+	bc.stride = ( cycle + 16 + 63 ) & ~63U;	// the kernel may touch 15 cycles after the read
+	bc.cnt8    = (unsigned char *) aligned_alloc64( bc.stride << 2 );
+	bc.cnt     = (unsigned int *)  aligned_alloc64( (bc.stride << 2) * sizeof(unsigned int) );
+	bc.lenhist = (unsigned int *)  aligned_alloc64( (cycle+1) * sizeof(unsigned int) );
+	bc.pending = 0;
+}
+
+void basecounter_free( basecounter & bc ) {
+	free( bc.cnt8 );
+	free( bc.cnt );
+	free( bc.lenhist );
+}
+
+void basecounter_reset( basecounter & bc ) {
+	memset( bc.cnt8, 0, bc.stride << 2 );
+	memset( bc.cnt, 0, (bc.stride << 2) * sizeof(unsigned int) );
+	memset( bc.lenhist, 0, (bc.cycle+1) * sizeof(unsigned int) );
+	bc.pending = 0;
+}
+
+void basecounter_flush( basecounter & bc ) {
+	register unsigned int n = bc.stride << 2;
+	for( register unsigned int i=0; i!=n; ++i )
+		bc.cnt[i] += bc.cnt8[i];
+	memset( bc.cnt8, 0, n );
+	bc.pending = 0;
+}
+
+#ifdef __SSE2__
+// 16 cycles per step; 'a'|0x20 == 'A'|0x20, and no other character maps to a lower-case base
+void basecounter_count( basecounter & bc, const char *seq, unsigned int len ) {
+	static const char tail_mask[32] = { -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+										 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	const __m128i lower = _mm_set1_epi8( 0x20 );
+	const __m128i a = _mm_set1_epi8( 'a' );
+	const __m128i c = _mm_set1_epi8( 'c' );
+	const __m128i g = _mm_set1_epi8( 'g' );
+	const __m128i t = _mm_set1_epi8( 't' );
+	unsigned char *ca = bc.cnt8;
+	unsigned char *cc = ca + bc.stride;
+	unsigned char *cg = cc + bc.stride;
+	unsigned char *ct = cg + bc.stride;
+
+	for( register unsigned int i=0; i<len; i+=16 ) {
+		__m128i s = _mm_or_si128( _mm_loadu_si128((const __m128i *)(seq+i)), lower );
+		if( len - i < 16 )	// ignore the bytes after the read
+			s = _mm_and_si128( s, _mm_loadu_si128((const __m128i *)(tail_mask + 16 - (len-i))) );
+		// a matched byte is 0xff, i.e., -1
+		_mm_store_si128( (__m128i *)(ca+i), _mm_sub_epi8(_mm_load_si128((__m128i *)(ca+i)), _mm_cmpeq_epi8(s, a)) );
+		_mm_store_si128( (__m128i *)(cc+i), _mm_sub_epi8(_mm_load_si128((__m128i *)(cc+i)), _mm_cmpeq_epi8(s, c)) );
+		_mm_store_si128( (__m128i *)(cg+i), _mm_sub_epi8(_mm_load_si128((__m128i *)(cg+i)), _mm_cmpeq_epi8(s, g)) );
+		_mm_store_si128( (__m128i *)(ct+i), _mm_sub_epi8(_mm_load_si128((__m128i *)(ct+i)), _mm_cmpeq_epi8(s, t)) );
+	}
+}
+#else
+// table-driven fallback
+void basecounter_count( basecounter & bc, const char *seq, unsigned int len ) {
+	for( register unsigned int i=0; i!=len; ++i ) {
+		register unsigned int r = base_row[ (unsigned char)seq[i] ];
+		if( r != 4 )
+			++ bc.cnt8[ r*bc.stride + i ];
+	}
+}
+#endif
+
+void basecounter_merge( fastqstat *all, basecounter & bc ) {
+	basecounter_flush( bc );
+
+	const unsigned int *ca = bc.cnt;
+	const unsigned int *cc = ca + bc.stride;
+	const unsigned int *cg = cc + bc.stride;
+	const unsigned int *ct = cg + bc.stride;
+	register uint64_t covered = 0;	// number of reads longer than cycle i
+	for( register unsigned int i=bc.cycle; i!=0; -- i ) {
+		covered += bc.lenhist[i];
+		register unsigned int j = i - 1;
+		all[j].A += ca[j];
+		all[j].C += cc[j];
+		all[j].G += cg[j];
+		all[j].T += ct[j];
+		all[j].N += covered - ca[j] - cc[j] - cg[j] - ct[j];
+	}
+}
+
+bool fqstat_write( const char *file, const fastqstat *stat, unsigned int cycle ) {
+	ofstream fout( file );
+	if( fout.fail() )
+		return false;
+	fout << "Cycle\tA\tC\tG\tT\tN\n";
+	for( unsigned int j=0; j!=cycle; ++j ) {
+		fout << j+1 << '\t' << stat[j].A << '\t' << stat[j].C << '\t'<< stat[j].G
+				<< '\t' << stat[j].T << '\t'<< stat[j].N << '\n';
+	}
+	fout.close();
+	return true;
+}
+
@@ -0,0 +1,55 @@
+#include <stdint.h>
+#include "common.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Per-cycle base composition for the preprocessors.
+ * Each read is added as a whole: its bases are compared with A/C/G/T 16 cycles at a time and the
+ * results are subtracted from 8-bit counters, which are flushed to 32-bit counters every 255 reads.
+ * N is not counted directly but derived from the read length histogram when merging into the
+ * 64-bit totals. The counters are cache-line aligned and each one is used by one thread at a time.
+ *
+ * basecounter_add() may read up to 15 bytes after the end of a read (see FQ_BLOCK_PADDING).
+*/
+
+#ifndef _MSUITE_FQSTAT_
+#define _MSUITE_FQSTAT_
+
+const unsigned int BASE_COUNTER_FLUSH = 255;	// 8-bit counters could hold 255 reads
+
+typedef struct {
+	unsigned int cycle;
+	unsigned int stride;	// row size of the counters, padded to cache line
+	unsigned char *cnt8;	// 4 rows: A, C, G, T (case-insensitive)
+	unsigned int *cnt;		// 4 rows, the same layout as cnt8
+	unsigned int *lenhist;	// read length histogram, [0, cycle]
+	unsigned int pending;	// reads in cnt8
+} basecounter;
+
+void basecounter_init( basecounter & bc, unsigned int cycle );
+void basecounter_free( basecounter & bc );
+void basecounter_reset( basecounter & bc );
+void basecounter_flush( basecounter & bc );
+void basecounter_count( basecounter & bc, const char *seq, unsigned int len );
+
+// add the bases of one read to the per-cycle counters; len MUST NOT exceed cycle
+inline void basecounter_add( basecounter & bc, const char *seq, unsigned int len ) {
+	basecounter_count( bc, seq, len );
+	++ bc.lenhist[ len ];
+	if( ++ bc.pending == BASE_COUNTER_FLUSH )
+		basecounter_flush( bc );
+}
+
+// add the counts to the 64-bit totals
+void basecounter_merge( fastqstat *all, basecounter & bc );
+
+// write the per-cycle totals as a table; returns false if the file could not be written
+bool fqstat_write( const char *file, const fastqstat *stat, unsigned int cycle );
+
+#endif
+
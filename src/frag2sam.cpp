@@ -0,0 +1,101 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include "fragment.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Prints the binary fragment records written by rmdup/tag (see fragment.h) as SAM, the same as their
+ * text output; used to make the BAM file in "msuite2 --binary-frag".
+ * The mates of a pair are adjacent, RNEXT is '=' with the position of the other mate; the TLEN of
+ * read 2 is printed as "-TLEN of read 1".
+*/
+
+const size_t FRAG2SAM_BUFFER_SIZE = 4 << 20;
+
+void frag2sam( fragrec & r, const string & rname, unsigned int mpos, bool paired, const char *tlen, string & out ) {
+	char num[16];
+	string field;
+	frag_field( r, SAM_QNAME, field );
+	out += field;
+	sprintf( num, "\t%d\t", r.h->flag );
+	out += num;
+	out += rname;
+	sprintf( num, "\t%u\t%u\t", r.h->pos, r.h->mapq );
+	out += num;
+	frag_field( r, SAM_CIGAR, field );
+	out += field;
+	if( paired ) {
+		sprintf( num, "\t=\t%u\t", mpos );
+		out += num;
+	} else {
+		out += "\t*\t0\t";
+	}
+	out += tlen;
+	out += '\t';
+	frag_field( r, SAM_SEQ, field );
+	out += field;
+	out += '\t';
+	frag_field( r, SAM_QUAL, field );
+	out += field;
+	out.append( frag_tag(r.h), r.h->l_tag );
+	out += '\n';
+}
+
+int main( int argc, char *argv[] ) {
+	if( argc != 2 ) {
+		cerr << "\nUsage: " << argv[0] << " <in.frag>\n\n"
+			 << "This program is part of Msuite2, designed to print the fragment records as SAM (to STDOUT).\n\n";
+		return 2;
+	}
+
+	fragsource fs;
+	if( ! frag_is_file(argv[1]) || ! frag_source_open(fs, argv[1]) ) {
+		cerr << "Error: could not read fragment file '" << argv[1] << "'!\n";
+		exit( 1 );
+	}
+
+	fragrec r1, r2;
+	string out;
+	char tlen1[16], tlen2[16];
+	out.reserve( FRAG2SAM_BUFFER_SIZE + 4096 );
+	while( frag_source_next(fs, r1) ) {
+		const string & rname = frag_source_contig( fs ).name;
+		if( r1.h->flag & 1 ) {	// paired
+			if( ! frag_source_next(fs, r2) ) {
+				cerr << "Error: the last record has no mate!\n";
+				exit( 1 );
+			}
+			sprintf( tlen1, "%d", r1.h->tlen );
+			if( r1.h->tlen >= 0 ) {
+				sprintf( tlen2, "-%d", r1.h->tlen );
+			} else {
+				sprintf( tlen2, "%d", r2.h->tlen );
+			}
+			frag2sam( r1, rname, r2.h->pos, true, tlen1, out );
+			frag2sam( r2, rname, r1.h->pos, true, tlen2, out );
+		} else {
+			sprintf( tlen1, "%d", r1.h->tlen );
+			frag2sam( r1, rname, 0, false, tlen1, out );
+		}
+		if( out.size() >= FRAG2SAM_BUFFER_SIZE ) {
+			fwrite( out.data(), 1, out.size(), stdout );
+			out.clear();
+		}
+	}
+	fwrite( out.data(), 1, out.size(), stdout );
+	frag_source_close( fs );
+
+	if( fflush(stdout) != 0 ) {
+		cerr << "Error: could not write the output!\n";
+		exit( 1 );
+	}
+	return 0;
+}
+
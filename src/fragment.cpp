@@ -0,0 +1,352 @@
+#include <iostream>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "fragment.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+static const char FRAG_BASES[] = "ACGT";
+static const char FRAG_CIGAR_OPS[] = "MIDNSHP=X";
+
+static inline int frag_base_code( char c ) {
+	switch( c ) {
+		case 'A': return 0;
+		case 'C': return 1;
+		case 'G': return 2;
+		case 'T': return 3;
+		default : return -1;
+	}
+}
+
+// bytes needed for the record of a SAM line of len bytes
+static inline size_t frag_bound( size_t len ) {
+	return sizeof(fraghead) + 3*len + 8;
+}
+
+// CIGAR text into the ops at out; returns the number of ops
+static unsigned int frag_put_cigar( uint32_t *out, const char *cigar, unsigned int l_cigar ) {
+	register unsigned int n = 0;
+	register uint32_t len = 0;
+	if( l_cigar == 1 && cigar[0] == '*' )
+		return 0;
+	for( register unsigned int i=0; i!=l_cigar; ++i ) {
+		if( cigar[i]>='0' && cigar[i]<='9' ) {
+			len = len*10 + cigar[i] - '0';
+			continue;
+		}
+		const char *op = strchr( FRAG_CIGAR_OPS, cigar[i] );
+		if( op == NULL || cigar[i] == '\0' ) {
+			cerr << "Error: unsupported CIGAR '" << string(cigar, l_cigar) << "'!\n";
+			exit( 1 );
+		}
+		out[ n ++ ] = len << 4 | ( op - FRAG_CIGAR_OPS );
+		len = 0;
+	}
+	return n;
+}
+
+// SEQ and QUAL into 2-bit bases, the qualities and the odd bases (marked in QUAL); returns the end
+static char * frag_put_seq( fraghead *h, char *out, const char *seq, const char *qual ) {
+	register unsigned int l_seq = h->l_seq;
+	register uint8_t *s = (uint8_t *) out;
+	register unsigned int bytes = (l_seq+3) >> 2;
+	memset( s, 0, bytes );
+	register char *q = out + bytes;
+	register char *odd = q + l_seq;
+	for( register unsigned int i=0; i!=l_seq; ++i ) {
+		register int code = frag_base_code( seq[i] );
+		q[i] = qual[i];
+		if( code < 0 ) {
+			q[i] |= FRAG_QUAL_ODD;
+			*odd ++ = seq[i];
+		} else {
+			s[ i>>2 ] |= code << ( (i&3) << 1 );
+		}
+	}
+	h->n_odd = odd - (q + l_seq);
+	return odd;
+}
+
+// pad the record started at h to 4 bytes and set its size; returns the end
+static char * frag_finish( fraghead *h, char *p ) {
+	while( (p - (char *)h) & 3 )
+		*p ++ = '\0';
+	h->size = p - (char *)h;
+	return p;
+}
+
+static char * frag_put_sam( char *out, const char *line ) {
+	samtoken t;
+	sam_tokenize( t, line );
+	unsigned int l_seq = sam_length( t, SAM_SEQ );
+	if( sam_length(t, SAM_QUAL) != l_seq ) {
+		cerr << "Error: SEQ and QUAL differ in length for read '" << string(line, sam_length(t, SAM_QNAME)) << "'!\n";
+		exit( 1 );
+	}
+
+	fraghead *h = (fraghead *) out;
+	memset( h, 0, sizeof(fraghead) );
+	h->pos   = sam_pos( t );
+	h->tlen  = sam_tlen( t );
+	h->l_seq = l_seq;
+	h->flag  = sam_flag( t );
+	h->mapq  = sam_mapq( t );
+	h->l_name = sam_length( t, SAM_QNAME );
+	h->n_cigar = frag_put_cigar( (uint32_t *)(h+1), sam_field(t, SAM_CIGAR), sam_length(t, SAM_CIGAR) );
+
+	register char *p = (char *) frag_name( h );
+	memcpy( p, line, h->l_name );
+	p = frag_put_seq( h, p + h->l_name, sam_field(t, SAM_SEQ), sam_field(t, SAM_QUAL) );
+
+	// the AS and NM tags, as sam_keep_tags
+	register char *tag = p;
+	register unsigned int n = sam_fields( t );
+	bool AStag = false;
+	bool NMtag = false;
+	for( register unsigned int i=SAM_TAGS; i<n; ++i ) {
+		register const char *f = line + t.field[i];
+		if( f[0]=='A' && f[1]=='S' ) {
+			AStag = true;
+		} else if( f[0]=='N' && f[1]=='M' ) {
+			NMtag = true;
+		} else {
+			continue;
+		}
+		register unsigned int len = t.field[i+1] - t.field[i] - 1;
+		*p ++ = '\t';
+		memcpy( p, f, len );
+		p += len;
+		if( AStag && NMtag )break;
+	}
+	h->l_tag = p - tag;
+
+	return frag_finish( h, p );
+}
+
+size_t frag_encode_sam( char *out, const char *line ) {
+	return frag_put_sam( out, line ) - out;
+}
+
+size_t frag_encode_bound( const char *line ) {
+	return frag_bound( strlen(line) );
+}
+
+void frag_rewrite( string & out, const fraghead *h, const string & name, unsigned int flag,
+				   unsigned int mapq, int tlen, const char *tag, unsigned int l_tag ) {
+	size_t start = out.size();
+	out.append( (const char *)h, sizeof(fraghead) );
+	out.append( (const char *)frag_cigar(h), h->n_cigar * sizeof(uint32_t) );
+	out += name;
+	out.append( (const char *)frag_seq(h), ((h->l_seq+3) >> 2) + h->l_seq + h->n_odd );
+	out.append( tag, l_tag );
+	while( (out.size() - start) & 3 )
+		out += '\0';
+
+	fraghead *r = (fraghead *) &out[ start ];
+	r->size   = out.size() - start;
+	r->tlen   = tlen;
+	r->flag   = flag;
+	r->mapq   = mapq;
+	r->l_name = name.size();
+	r->l_tag  = l_tag;
+}
+
+void frag_cigar_string( const fraghead *h, string & s ) {
+	if( h->n_cigar == 0 ) {
+		s = "*";
+		return;
+	}
+	s.clear();
+	char num[16];
+	const uint32_t *c = frag_cigar( h );
+	for( register unsigned int i=0; i!=h->n_cigar; ++i ) {
+		sprintf( num, "%u", c[i] >> 4 );
+		s += num;
+		s += FRAG_CIGAR_OPS[ c[i] & 15 ];
+	}
+}
+
+void frag_seq_string( const fraghead *h, string & s ) {
+	register const uint8_t *b = frag_seq( h );
+	register const char *q = frag_qual( h );
+	register const char *odd = frag_odd( h );
+	s.resize( h->l_seq );
+	for( register unsigned int i=0; i!=h->l_seq; ++i ) {
+		s[i] = ( q[i] & FRAG_QUAL_ODD ) ? *odd ++ : FRAG_BASES[ (b[i>>2] >> ((i&3)<<1)) & 3 ];
+	}
+}
+
+void frag_qual_string( const fraghead *h, string & s ) {
+	register const char *q = frag_qual( h );
+	s.resize( h->l_seq );
+	for( register unsigned int i=0; i!=h->l_seq; ++i ) {
+		s[i] = q[i] & ~FRAG_QUAL_ODD;
+	}
+}
+
+// move to the current segment, or the first one of the next contig; returns false after the last one
+static bool frag_seek( fragsource & fs ) {
+	for( ; fs.c != fs.contig.size(); ++fs.c, fs.seg=0 ) {
+		const shardcontig & c = fs.contig[ fs.c ];
+		if( fs.seg != c.offset.size() ) {
+			fs.at  = c.offset[ fs.seg ];
+			fs.end = fs.at + c.length[ fs.seg ];
+			if( fs.end > fs.size || (fs.at & 3) ) {
+				cerr << "Error: the index does not match the fragment file!\n";
+				exit( 1 );
+			}
+			return true;
+		}
+	}
+	fs.at = fs.end = 0;
+	return false;
+}
+
+bool frag_source_open( fragsource & fs, const char *file ) {
+	fs.binary = frag_is_file( file );
+	fs.data = NULL;
+	fs.size = 0;
+	if( ! fs.binary ) {
+		fs.fin.open( file );
+		if( fs.fin.fail() )
+			return false;
+		fs.indexed = shard_load( file, fs.contig );
+		shard_start( fs.sc, fs.fin, fs.contig );
+		return true;
+	}
+
+	int fd = open( file, O_RDONLY );
+	if( fd < 0 )
+		return false;
+	struct stat st;
+	if( fstat(fd, &st) != 0 ) {
+		close( fd );
+		return false;
+	}
+	fs.size = st.st_size;
+	if( fs.size ) {
+		void *p = mmap( NULL, fs.size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if( p == MAP_FAILED ) {
+			close( fd );
+			return false;
+		}
+		madvise( p, fs.size, MADV_SEQUENTIAL );
+		fs.data = (const char *) p;
+	}
+	close( fd );
+
+	fs.indexed = shard_load( file, fs.contig );
+	if( ! fs.indexed ) {	// RNAME is in the index only
+		cerr << "Error: no index for fragment file '" << file << "'!\n";
+		exit( 1 );
+	}
+	fs.c = 0;
+	fs.seg = 0;
+	fs.last = (unsigned int) -1;
+	fs.changed = false;
+	frag_seek( fs );
+	return true;
+}
+
+void frag_source_close( fragsource & fs ) {
+	if( fs.binary ) {
+		if( fs.data )
+			munmap( (void *)fs.data, fs.size );
+		fs.data = NULL;
+	} else {
+		fs.fin.close();
+	}
+}
+
+bool frag_source_next( fragsource & fs, fragrec & r ) {
+	if( ! fs.binary ) {
+		if( ! shard_getline(fs.sc, r.line) )
+			return false;
+		r.h = NULL;
+		sam_tokenize( r.sam, r.line.c_str(), r.line.size() );
+		return true;
+	}
+
+	while( fs.at == fs.end ) {
+		if( fs.c == fs.contig.size() )
+			return false;
+		++ fs.seg;
+		if( ! frag_seek(fs) )
+			return false;
+	}
+	const fraghead *h = (const fraghead *)( fs.data + fs.at );
+	if( fs.end - fs.at < sizeof(fraghead) || h->size < sizeof(fraghead) || h->size > fs.end - fs.at ) {
+		cerr << "Error: broken fragment file!\n";
+		exit( 1 );
+	}
+	fs.at += h->size;
+	r.h = h;
+	r.rname = & fs.contig[ fs.c ].name;
+	fs.changed = ( fs.c != fs.last );
+	fs.last = fs.c;
+	return true;
+}
+
+void frag_field( fragrec & r, unsigned int i, string & s ) {
+	if( r.h == NULL ) {
+		sam_string( r.sam, i, s );
+		return;
+	}
+	switch( i ) {
+		case SAM_QNAME: s.assign( frag_name(r.h), r.h->l_name ); break;
+		case SAM_RNAME: s = *r.rname; break;
+		case SAM_MAPQ : s = to_string( r.h->mapq ); break;
+		case SAM_CIGAR: frag_cigar_string( r.h, s ); break;
+		case SAM_SEQ  : frag_seq_string( r.h, s ); break;
+		case SAM_QUAL : frag_qual_string( r.h, s ); break;
+		default: s.clear();
+	}
+}
+
+void frag_tags( fragrec & r, string & tag ) {
+	if( r.h == NULL ) {
+		sam_keep_tags( r.sam, tag );
+	} else {	// only AS and NM are stored
+		tag.append( frag_tag(r.h), r.h->l_tag );
+	}
+}
+
+void frag_put( ofstream & fout, const fragrec & r ) {
+	if( r.h == NULL ) {
+		fout << r.line << '\n';
+	} else {
+		fout.write( (const char *)r.h, r.h->size );
+	}
+}
+
+void frag_index_add( fragindex & fi, const shardcontig & c, uint64_t offset ) {
+	fi.name.push_back( c.name );
+	fi.size.push_back( c.size );
+	fi.offset.push_back( offset );
+}
+
+void frag_index_write( const fragindex & fi, const string & file, uint64_t end ) {
+	string idxfile = file;
+	idxfile += ".idx";
+	ofstream fidx( idxfile.c_str() );
+	if( fidx.fail() ) {
+		cerr << "Error: could not write index file '" << idxfile << "'!\n";
+		exit( 1 );
+	}
+	for( unsigned int i=0; i!=fi.name.size(); ++i ) {
+		uint64_t length = ( i+1 != fi.name.size() ? fi.offset[i+1] : end ) - fi.offset[i];
+		if( length )
+			fidx << fi.name[i] << '\t' << fi.size[i] << '\t' << fi.offset[i] << '\t' << length << '\n';
+	}
+	fidx.close();
+}
+
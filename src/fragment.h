@@ -0,0 +1,161 @@
+#include <stdint.h>
+#include <string.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "shard.h"
+#include "samtoken.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Binary fragment records, used in place of the per-chr SAM files between T2C, rmdup/tag and
+ * meth.caller with "msuite2 --binary-frag"; the SAM text is then only written for the BAM (frag2sam).
+ *
+ * A fragment file (*.frag) is a series of records. Each record is a fixed-width header followed by
+ *   CIGAR (uint32 per op, len<<4|op as in BAM) | QNAME | SEQ (2 bits per base) | QUAL | odd bases | tags
+ * padded to 4 bytes, so the records are used in place from the mmap-ed file.
+ * A base other than ACGT (N, or the lower case ones kept from the reads) has bit 7 of its quality set
+ * and is stored as it is in the odd bases, in order, so SEQ is decoded exactly.
+ * The tags keep the leading '\t's of SAM; only AS and NM are kept by T2C, as rmdup/tag do.
+ * RNAME is not stored: each fragment file has an index (file.idx, see shard.h) even for 1 contig.
+ * RNEXT/PNEXT are not stored either: they are '=' and the mate for a pair, '*' and 0 otherwise.
+ * The numbers are in the byte order of the machine, the files are meant for one run only.
+*/
+
+#ifndef _MSUITE_FRAGMENT_
+#define _MSUITE_FRAGMENT_
+
+typedef struct {
+	uint32_t size;		// bytes of the whole record, a multiple of 4
+	uint32_t pos;
+	int32_t  tlen;
+	uint32_t l_seq;
+	uint16_t flag;
+	uint16_t n_cigar;
+	uint16_t l_name;
+	uint16_t l_tag;
+	uint8_t  mapq;
+	uint8_t  pad;
+	uint16_t n_odd;		// bases other than ACGT
+} fraghead;
+
+const uint8_t FRAG_QUAL_ODD = 0x80;	// bit in QUAL for the bases that are not ACGT
+
+inline bool frag_is_file( const char *file ) {
+	size_t len = strlen( file );
+	return len > 5 && strcmp( file+len-5, ".frag" ) == 0;
+}
+
+inline const uint32_t * frag_cigar( const fraghead *h ) {
+	return (const uint32_t *)( h + 1 );
+}
+
+inline const char * frag_name( const fraghead *h ) {
+	return (const char *)( frag_cigar(h) + h->n_cigar );
+}
+
+inline const uint8_t * frag_seq( const fraghead *h ) {
+	return (const uint8_t *)( frag_name(h) + h->l_name );
+}
+
+inline const char * frag_qual( const fraghead *h ) {
+	return (const char *)( frag_seq(h) + ((h->l_seq+3) >> 2) );
+}
+
+inline const char * frag_odd( const fraghead *h ) {
+	return frag_qual(h) + h->l_seq;
+}
+
+inline const char * frag_tag( const fraghead *h ) {
+	return frag_odd(h) + h->n_odd;
+}
+
+// bytes that are enough for the record of a SAM line
+size_t frag_encode_bound( const char *line );
+
+// write the record of a SAM line to out (4-byte aligned), only the AS and NM tags are kept; returns its size
+size_t frag_encode_sam( char *out, const char *line );
+
+// append a copy of record h with another QNAME, FLAG, MAPQ, TLEN and tags; CIGAR, SEQ and QUAL are kept
+void frag_rewrite( string & out, const fraghead *h, const string & name, unsigned int flag,
+				   unsigned int mapq, int tlen, const char *tag, unsigned int l_tag );
+
+// the fields in SAM text
+void frag_cigar_string( const fraghead *h, string & s );
+void frag_seq_string( const fraghead *h, string & s );
+void frag_qual_string( const fraghead *h, string & s );
+
+// a record of a SAM or fragment file
+typedef struct {
+	const fraghead *h;		// the fragment record, NULL for a SAM line
+	const string *rname;	// RNAME of the fragment record, from the index
+	string line;			// the SAM line
+	samtoken sam;
+} fragrec;
+
+// reader of a SAM file or a fragment file (mmap-ed), through the contigs of its index
+typedef struct {
+	bool binary;
+	bool indexed;			// the file has an index, always true for a fragment file
+	vector<shardcontig> contig;
+	ifstream fin;			// SAM
+	shardcursor sc;
+	const char *data;		// fragment
+	size_t size;
+	unsigned int c;			// current contig
+	unsigned int seg;		// current segment of the contig
+	uint64_t at;			// next record
+	uint64_t end;			// end of the segment
+	unsigned int last;		// contig of the last record read
+	bool changed;			// the last record read is the first one of its contig
+} fragsource;
+
+// a file ending with .frag is read as a fragment file
+bool frag_source_open( fragsource & fs, const char *file );
+void frag_source_close( fragsource & fs );
+
+// read the next record; returns false after the last one
+bool frag_source_next( fragsource & fs, fragrec & r );
+
+inline const shardcontig & frag_source_contig( const fragsource & fs ) {
+	return fs.binary ? fs.contig[ fs.c ] : shard_contig( fs.sc );
+}
+
+inline bool frag_source_changed( const fragsource & fs ) {
+	return fs.binary ? fs.changed : fs.sc.changed;
+}
+
+inline int frag_flag( fragrec & r ) { return r.h ? r.h->flag : sam_flag( r.sam ); }
+inline int frag_pos ( fragrec & r ) { return r.h ? r.h->pos  : sam_pos ( r.sam ); }
+inline int frag_mapq( fragrec & r ) { return r.h ? r.h->mapq : sam_mapq( r.sam ); }
+inline int frag_tlen( fragrec & r ) { return r.h ? r.h->tlen : sam_tlen( r.sam ); }
+
+// field i (SAM_QNAME, SAM_RNAME, SAM_MAPQ, SAM_CIGAR, SAM_SEQ or SAM_QUAL) of the record in SAM text
+void frag_field( fragrec & r, unsigned int i, string & s );
+
+// append the AS and NM tags of the record to tag, each with a leading '\t'
+void frag_tags( fragrec & r, string & tag );
+
+// write the record as it is read
+void frag_put( ofstream & fout, const fragrec & r );
+
+// index of a fragment file written by rmdup/tag: the contigs are written one after another
+typedef struct {
+	vector<string> name;
+	vector<unsigned int> size;
+	vector<uint64_t> offset;
+} fragindex;
+
+// the records of contig c start at offset
+void frag_index_add( fragindex & fi, const shardcontig & c, uint64_t offset );
+
+// write file.idx; end is the size of the file
+void frag_index_write( const fragindex & fi, const string & file, uint64_t end );
+
+#endif
+
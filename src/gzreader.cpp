@@ -0,0 +1,406 @@
+#include <iostream>
+#include <string.h>
+#include <stdlib.h>
+#include <zlib.h>
+#include "gzreader.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+static inline unsigned int le16( const unsigned char *p ) {
+	return p[0] | (p[1]<<8);
+}
+
+static inline unsigned int le32( const unsigned char *p ) {
+	return p[0] | (p[1]<<8) | (p[2]<<16) | ((unsigned int)p[3]<<24);
+}
+
+// gzip header with FEXTRA and a 'BC' subfield as the only extra field, see the SAM/BAM specification
+static bool is_bgzf_header( const unsigned char *p ) {
+	return p[0]==31 && p[1]==139 && p[2]==8 && (p[3]&4) && le16(p+10)==6 &&
+			p[12]=='B' && p[13]=='C' && le16(p+14)==2;
+}
+
+static void gz_fatal( const char *msg ) {
+	cerr << "Error: " << msg << "!\n";
+	exit(11);
+}
+
+static void * gz_realloc( void *p, size_t size ) {
+	p = realloc( p, size );
+	if( p == NULL ) {
+		cerr << "Error: could not allocate memory for decompression!\n";
+		exit(12);
+	}
+	return p;
+}
+
+// wait for a free chunk in the ring, returns NULL if the reader is closed
+static gzchunk * gz_wait_free( gzreader *gr ) {
+	unique_lock<mutex> lck( gr->mtx );
+	while( ! gr->stop && gr->produced - gr->consumed >= gr->ring_size )
+		gr->cv_free.wait( lck );
+	if( gr->stop )
+		return NULL;
+
+	gzchunk *c = gr->ring + gr->produced % gr->ring_size;
+	c->inlen  = 0;
+	c->outlen = 0;
+	c->used   = 0;
+	c->blocks = 0;
+	return c;
+}
+
+static void gz_set_finished( gzreader *gr ) {
+	{
+		lock_guard<mutex> lck( gr->mtx );
+		gr->finished = true;
+	}
+	gr->cv_job.notify_all();
+	gr->cv_ready.notify_all();
+}
+
+// reading thread for BGZF files: cut the file into groups of blocks WITHOUT inflating them
+static void bgzf_reader( gzreader *gr ) {
+	unsigned char hdr[ BGZF_BLOCK_HEADER ];
+	gzchunk *c;
+	while( (c=gz_wait_free(gr)) != NULL ) {
+		size_t need = 0;
+		while( need + BGZF_MAX_BLOCK <= GZ_CHUNK_SIZE ) {
+			size_t n = fread( hdr, 1, BGZF_BLOCK_HEADER, gr->fp );
+			if( n == 0 )
+				break;
+			if( n != BGZF_BLOCK_HEADER || ! is_bgzf_header(hdr) )
+				gz_fatal( "broken BGZF block in fastq file" );
+
+			size_t bsize = le16( hdr+16 ) + 1;
+			if( bsize < BGZF_BLOCK_HEADER + 8 )
+				gz_fatal( "broken BGZF block in fastq file" );
+			if( c->inlen + bsize > c->incap ) {
+				c->incap = (c->inlen + bsize) << 1;
+				c->in = (char *) gz_realloc( c->in, c->incap );
+			}
+			unsigned char *p = (unsigned char *)c->in + c->inlen;
+			memcpy( p, hdr, BGZF_BLOCK_HEADER );
+			if( fread(p+BGZF_BLOCK_HEADER, 1, bsize-BGZF_BLOCK_HEADER, gr->fp) != bsize-BGZF_BLOCK_HEADER )
+				gz_fatal( "unexpected end of BGZF file" );
+
+			need += le32( p+bsize-4 );	// ISIZE
+			c->inlen += bsize;
+			++ c->blocks;
+		}
+		if( c->blocks == 0 )	// end of file
+			break;
+
+		if( need > c->outcap ) {
+			c->outcap = need;
+			c->out = (char *) gz_realloc( c->out, c->outcap );
+		}
+		{
+			lock_guard<mutex> lck( gr->mtx );
+			c->status = GZ_CHUNK_PENDING;
+			++ gr->produced;
+		}
+		gr->cv_job.notify_one();
+	}
+	gz_set_finished( gr );
+}
+
+// inflate all the BGZF blocks in a chunk
+static void bgzf_inflate( z_stream & strm, gzchunk *c ) {
+	unsigned char *p = (unsigned char *)c->in;
+	for( unsigned int i=0; i!=c->blocks; ++i ) {
+		size_t bsize = le16( p+16 ) + 1;
+		unsigned int crc   = le32( p+bsize-8 );
+		unsigned int isize = le32( p+bsize-4 );
+		if( isize ) {	// the empty block is the EOF marker
+			unsigned char *out = (unsigned char *)c->out + c->outlen;
+			inflateReset( &strm );
+			strm.next_in   = p + BGZF_BLOCK_HEADER;
+			strm.avail_in  = bsize - BGZF_BLOCK_HEADER - 8;
+			strm.next_out  = out;
+			strm.avail_out = isize;
+			if( inflate(&strm, Z_FINISH) != Z_STREAM_END || strm.avail_out != 0 )
+				gz_fatal( "broken BGZF block in fastq file" );
+			if( crc32(crc32(0L, Z_NULL, 0), out, isize) != crc )
+				gz_fatal( "CRC error in BGZF file" );
+			c->outlen += isize;
+		}
+		p += bsize;
+	}
+}
+
+static void bgzf_ready( gzreader *gr, gzchunk *c ) {
+	{
+		lock_guard<mutex> lck( gr->mtx );
+		c->status = GZ_CHUNK_READY;
+	}
+	gr->cv_ready.notify_all();
+}
+
+// inflating thread for BGZF files
+static void bgzf_worker( gzreader *gr ) {
+	z_stream strm;
+	memset( &strm, 0, sizeof(z_stream) );
+	if( inflateInit2(&strm, -15) != Z_OK )
+		gz_fatal( "could not initialize zlib" );
+
+	while( true ) {
+		gzchunk *c;
+		{
+			unique_lock<mutex> lck( gr->mtx );
+			while( ! gr->stop && ! gr->finished && gr->taken == gr->produced )
+				gr->cv_job.wait( lck );
+			if( gr->stop || gr->taken == gr->produced )
+				break;
+			c = gr->ring + gr->taken % gr->ring_size;
+			++ gr->taken;
+		}
+
+		bgzf_inflate( strm, c );
+		bgzf_ready( gr, c );
+	}
+	inflateEnd( &strm );
+}
+
+/*
+ * open BGZF readers whose chunks could be inflated by other threads, see gz_help()
+ * a reader is removed in gz_close() and freed only after all its helpers have finished
+*/
+static mutex helped_mtx;
+static vector<gzreader *> helped;
+static unsigned int help_turn = 0;
+
+// zlib stream of a helping thread, kept for the life of the thread
+typedef struct helper_stream {
+	z_stream strm;
+	bool ready;
+	helper_stream() : ready(false) {}
+	~helper_stream() {
+		if( ready )
+			inflateEnd( &strm );
+	}
+} helper_stream;
+
+/*
+ * inflate one pending BGZF chunk of any open reader in the calling thread
+ * returns false if there is nothing to inflate, i.e., the inflating threads keep up with the parsing
+*/
+bool gz_help() {
+	gzreader *gr = NULL;
+	gzchunk *c = NULL;
+	{
+		lock_guard<mutex> lck( helped_mtx );
+		for( unsigned int i=0; i!=helped.size() && gr==NULL; ++i ) {	// the readers take turns
+			gzreader *g = helped[ (help_turn+i) % helped.size() ];
+			lock_guard<mutex> glck( g->mtx );
+			if( ! g->stop && g->taken != g->produced ) {
+				c = g->ring + g->taken % g->ring_size;
+				++ g->taken;
+				++ g->helpers;
+				gr = g;
+				help_turn += i + 1;
+			}
+		}
+	}
+	if( gr == NULL )
+		return false;
+
+	static thread_local helper_stream hs;
+	if( ! hs.ready ) {
+		memset( &hs.strm, 0, sizeof(z_stream) );
+		if( inflateInit2(&hs.strm, -15) != Z_OK )
+			gz_fatal( "could not initialize zlib" );
+		hs.ready = true;
+	}
+	bgzf_inflate( hs.strm, c );
+	{
+		lock_guard<mutex> lck( gr->mtx );
+		c->status = GZ_CHUNK_READY;
+		-- gr->helpers;
+	}
+	gr->cv_ready.notify_all();
+	return true;
+}
+
+// reading thread for normal gzip (or plain) files: inflate the file sequentially
+static void gzip_reader( gzreader *gr ) {
+	z_stream strm;
+	memset( &strm, 0, sizeof(z_stream) );
+	if( inflateInit2(&strm, 15+16) != Z_OK )	// gzip format only
+		gz_fatal( "could not initialize zlib" );
+
+	unsigned char *inbuf = (unsigned char *) gz_realloc( NULL, GZ_INPUT_SIZE );
+	bool eof = false;
+	bool in_member = false;	// inside a gzip member
+	gzchunk *c;
+	while( ! eof && (c=gz_wait_free(gr)) != NULL ) {
+		if( c->outcap < GZ_CHUNK_SIZE ) {
+			c->outcap = GZ_CHUNK_SIZE;
+			c->out = (char *) gz_realloc( c->out, c->outcap );
+		}
+
+		if( gr->transparent ) {
+			c->outlen = fread( c->out, 1, GZ_CHUNK_SIZE, gr->fp );
+			eof = ( c->outlen != GZ_CHUNK_SIZE );
+		} else {
+			while( c->outlen != GZ_CHUNK_SIZE ) {
+				if( strm.avail_in == 0 ) {
+					strm.avail_in = fread( inbuf, 1, GZ_INPUT_SIZE, gr->fp );
+					strm.next_in  = inbuf;
+					if( strm.avail_in == 0 ) {
+						if( in_member )
+							gz_fatal( "unexpected end of gzipped fastq file" );
+						eof = true;
+						break;
+					}
+				}
+				if( ! in_member ) {	// a new member is coming; ignore the trailing garbage as gzread() does
+					if( strm.next_in[0] != 31 ) {
+						eof = true;
+						break;
+					}
+					in_member = true;
+				}
+
+				strm.next_out  = (unsigned char *)c->out + c->outlen;
+				strm.avail_out = GZ_CHUNK_SIZE - c->outlen;
+				int ret = inflate( &strm, Z_NO_FLUSH );
+				c->outlen = GZ_CHUNK_SIZE - strm.avail_out;
+				if( ret == Z_STREAM_END ) {	// multi-member gzip
+					inflateReset( &strm );
+					in_member = false;
+				} else if( ret != Z_OK && ret != Z_BUF_ERROR ) {
+					gz_fatal( "broken gzipped fastq file" );
+				}
+			}
+		}
+
+		{
+			lock_guard<mutex> lck( gr->mtx );
+			c->status = GZ_CHUNK_READY;
+			++ gr->produced;
+		}
+		gr->cv_ready.notify_all();
+	}
+	gz_set_finished( gr );
+
+	free( inbuf );
+	inflateEnd( &strm );
+}
+
+/*
+ * open a gzipped file, 'threads' is the number of inflating threads for BGZF files
+ * returns NULL if the file could not be opened
+*/
+gzreader * gz_open( const char *file, unsigned int threads ) {
+	FILE *fp = fopen( file, "rb" );
+	if( fp == NULL )
+		return NULL;
+
+	gzreader *gr = new gzreader;
+	gr->fp = fp;
+
+	unsigned char hdr[ BGZF_BLOCK_HEADER ];
+	size_t n = fread( hdr, 1, BGZF_BLOCK_HEADER, fp );
+	gr->bgzf = ( n == BGZF_BLOCK_HEADER && is_bgzf_header(hdr) );
+	gr->transparent = ( n < 2 || hdr[0] != 31 || hdr[1] != 139 );
+	rewind( fp );
+
+	if( threads == 0 )
+		threads = 1;
+	gr->ring_size = ( threads << 1 ) + 2;
+	gr->ring = new gzchunk [ gr->ring_size ];
+	memset( gr->ring, 0, gr->ring_size*sizeof(gzchunk) );
+	gr->produced = 0;
+	gr->taken    = 0;
+	gr->consumed = 0;
+	gr->finished = false;
+	gr->stop     = false;
+	gr->helpers  = 0;
+
+	if( gr->bgzf ) {
+		gr->reader = thread( bgzf_reader, gr );
+		for( unsigned int i=0; i!=threads; ++i )
+			gr->workers.push_back( thread(bgzf_worker, gr) );
+		lock_guard<mutex> lck( helped_mtx );
+		helped.push_back( gr );
+	} else {
+		gr->reader = thread( gzip_reader, gr );
+	}
+
+	return gr;
+}
+
+// read at most len decompressed bytes into buf; returns 0 at the end of the file
+long gz_read( gzreader *gr, char *buf, size_t len ) {
+	size_t got = 0;
+	while( got != len ) {
+		gzchunk *c = gr->ring + gr->consumed % gr->ring_size;
+		{
+			unique_lock<mutex> lck( gr->mtx );
+			while( c->status != GZ_CHUNK_READY && ! (gr->finished && gr->consumed == gr->produced) )
+				gr->cv_ready.wait( lck );
+			if( c->status != GZ_CHUNK_READY )	// end of file
+				break;
+		}
+
+		size_t n = c->outlen - c->used;
+		if( n > len - got )
+			n = len - got;
+		memcpy( buf+got, c->out+c->used, n );
+		got += n;
+		c->used += n;
+
+		if( c->used == c->outlen ) {	// this chunk is used up
+			{
+				lock_guard<mutex> lck( gr->mtx );
+				c->status = GZ_CHUNK_FREE;
+				++ gr->consumed;
+			}
+			gr->cv_free.notify_one();
+		}
+	}
+	return got;
+}
+
+void gz_close( gzreader *gr ) {
+	if( gr->bgzf ) {
+		lock_guard<mutex> lck( helped_mtx );
+		for( unsigned int i=0; i!=helped.size(); ++i )
+			if( helped[i] == gr ) {
+				helped.erase( helped.begin() + i );
+				break;
+			}
+	}
+	{
+		lock_guard<mutex> lck( gr->mtx );
+		gr->stop = true;
+	}
+	gr->cv_free.notify_all();
+	gr->cv_job.notify_all();
+	gr->cv_ready.notify_all();
+
+	gr->reader.join();
+	for( unsigned int i=0; i!=gr->workers.size(); ++i )
+		gr->workers[i].join();
+	{	// a helping thread may still be inflating a chunk
+		unique_lock<mutex> lck( gr->mtx );
+		while( gr->helpers )
+			gr->cv_ready.wait( lck );
+	}
+
+	for( unsigned int i=0; i!=gr->ring_size; ++i ) {
+		free( gr->ring[i].in );
+		free( gr->ring[i].out );
+	}
+	delete [] gr->ring;
+	fclose( gr->fp );
+	delete gr;
+}
+
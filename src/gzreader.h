@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Multi-threaded reader for gzipped fastq files.
+ * A reading thread walks through the compressed file and fills a ring of chunks:
+ *   BGZF files (e.g., by bgzip): each chunk holds a group of BGZF blocks, which are inflated by a thread pool
+ *   other gzip files (including multi-member ones): inflated by the reading thread itself, so the
+ *     decompression still overlaps with the parsing of the reads
+ * gz_read() returns the decompressed data in the original order.
+ * Idle threads of the caller could inflate the pending BGZF chunks of all the open readers with gz_help().
+*/
+
+#ifndef _MSUITE_GZREADER_
+#define _MSUITE_GZREADER_
+
+const size_t GZ_CHUNK_SIZE     = 4 << 20;	// decompressed bytes per chunk
+const size_t GZ_INPUT_SIZE     = 1 << 20;	// compressed bytes per fread() for normal gzip
+const unsigned int BGZF_BLOCK_HEADER = 18;	// BGZF block header size (with the BC extra field)
+const unsigned int BGZF_MAX_BLOCK    = 65536;
+
+// status of a chunk in the ring
+const int GZ_CHUNK_FREE    = 0;
+const int GZ_CHUNK_PENDING = 1;	// compressed data loaded, waiting for inflating
+const int GZ_CHUNK_READY   = 2;	// decompressed data available
+
+typedef struct {
+	char *in;			// compressed BGZF blocks
+	size_t inlen;
+	size_t incap;
+	char *out;			// decompressed data
+	size_t outlen;
+	size_t outcap;
+	size_t used;		// bytes of out already returned by gz_read
+	unsigned int blocks;
+	int status;
+} gzchunk;
+
+typedef struct {
+	FILE *fp;
+	bool bgzf;
+	bool transparent;	// not gzipped at all, copy the file as-is
+	unsigned int ring_size;
+	gzchunk *ring;
+	uint64_t produced;	// chunks filled by the reading thread
+	uint64_t taken;		// chunks taken by the inflating threads (BGZF only)
+	uint64_t consumed;	// chunks returned to the caller
+	bool finished;		// the reading thread reaches the end of the file
+	bool stop;			// gz_close() is called before EOF
+	unsigned int helpers;	// threads in gz_help() that are inflating a chunk of this reader
+	mutex mtx;
+	condition_variable cv_free;
+	condition_variable cv_job;
+	condition_variable cv_ready;
+	thread reader;
+	vector<thread> workers;
+} gzreader;
+
+gzreader * gz_open( const char *file, unsigned int threads );
+long gz_read( gzreader *gr, char *buf, size_t len );
+void gz_close( gzreader *gr );
+bool gz_help();
+
+#endif
+
@@ -6,6 +6,7 @@
 #include <unordered_map>
 #include "common.h"
 #include "util.h"
+#include "fragment.h"
 
 using namespace std;
 
@@ -23,11 +24,13 @@ void deal_PE_CpH( const char *gfile, const char *samfile, const int cycle, const
 
 void callmeth_CpH( string &realSEQ, string &realQUAL, int pos,
 				string &g, unordered_map<int, meth> &methcall, int cycle, bool rev );
-void write_methcall( unordered_map<int, meth> &m, const char *pre, const char *suf );
+void open_methcall( ofstream &fout, const char *pre, const char *suf );
+void write_methcall( unordered_map<int, meth> &m, ofstream &fout );
+void switch_contig( const char *gdir, const string &chr, string &g, unordered_map<int, meth> &methcall, ofstream &fout );
 
 int main( int argc, char *argv[] ) {
 	if( argc != 6 ) {
-        cerr<< "\nUsage: " << argv[0] << " <mode=SE|PE> <chr.fa> <chr.sam> <cycle> <output.prefix>\n"
+        cerr<< "\nUsage: " << argv[0] << " <mode=SE|PE> <chr.fa|fasta.dir/ for a shard> <chr.sam|chr.frag> <cycle> <output.prefix>\n"
 			<< "\nThis program is a component of Msuite2, designed to call CpH methylation from SAM file.\n"
 			<< "Both SE/PE data are supported; indels are also supported.\n\n";
 		return 2;
@@ -54,45 +57,53 @@ int main( int argc, char *argv[] ) {
 
 // process SE data
 void deal_SE_CpH( const char *gfile, const char *samfile, const int cycle, const char *output) {
-	// load genome
-	string g;
-	loadchr( gfile, g );
+	// load genome; for a shard, the genome of each contig is loaded at its first read
+	bool shard = shard_is_dir( gfile );
+	string g, curr_chr;
+	if( ! shard )
+		loadchr( gfile, g );
 
 	unordered_map<int, meth> methcall;
 
-	// open sam file
-	ifstream fsam( samfile );
-	if( fsam.fail() ) {
+	// open sam file, or the binary fragment records (see fragment.h)
+	fragsource fs;
+	if( ! frag_source_open(fs, samfile) ) {
 		cerr << "Error file: cannot open " << samfile << " to read!\n";
 		exit(200);
 	}
+	ofstream fcall;
+	open_methcall( fcall, output, ".CpH.call" );
 //	cout << "Loading alignment " << samfile << " in SE mode ...\n";
 //	unsigned int count = 0;
-	string line, seqName, chr, cigar, seq, qual;
-	int flag;
-	string mateinfo, matepos, dist;   //fields that are ignored; all the sequence are converted to WATSON chain
+	string chr, cigar, seq, qual;	// the other fields are ignored; all the sequence are converted to WATSON chain
 	register unsigned int pos, score;
-	stringstream ss;
+	fragrec r;
 	string realSEQ, realQUAL;   //these are CIGAR-processed seq and qual
-	line.resize( MAX_SAMLINE_SIZE );
+	r.line.resize( MAX_SAMLINE_SIZE );
 	// load sam file
 	while( true ) {
-		getline( fsam, line );
-		if( fsam.eof() ) break;
+		if( ! frag_source_next(fs, r) ) break;
 		//14_R1	83	chr9	73301642	42	36M	=	73301399	-279	TCCTTCTCTCCCTC	GHHHHHHHHHH	XG:Z:GA
 
-		ss.clear();
-		ss.str( line );
-		ss >> seqName >> flag >> chr >> pos >> score >> cigar >> mateinfo >> matepos >> dist >> seq >> qual;
+		frag_field( r, SAM_RNAME, chr );
+		if( shard && chr != curr_chr ) {	// the first read of a contig
+			switch_contig( gfile, chr, g, methcall, fcall );
+			curr_chr = chr;
+		}
 		
+		score = frag_mapq( r );
 		if( score < MIN_ALIGN_SCORE_METH ) {
 			//cerr << "Discard " << seqName << " due to poor alignment score.\n";
 			continue;
 		}
+		pos = frag_pos( r );
+		frag_field( r, SAM_CIGAR, cigar );
+		frag_field( r, SAM_SEQ, seq );
+		frag_field( r, SAM_QUAL, qual );
 
 		// process the CIGAR, handle the indels
 		if( ! fix_cigar(cigar, realSEQ, realQUAL, seq, qual) ) {
-			cerr << "ERROR: Unsupported CIGAR (" << cigar << ") at line " << line << "!\n";
+			cerr << "ERROR: Unsupported CIGAR (" << cigar << ") at line " << r.line << "!\n";
 			continue;
 		}
 
@@ -104,74 +115,86 @@ void deal_SE_CpH( const char *gfile, const char *samfile, const int cycle, const
 //		if( ! (count & 0x003fffff) )
 //			cout << '\r' << count << " lines loaded.";
 	}
-	fsam.close();
+	frag_source_close( fs );
 //	cout << '\r' << "Done: " << count << " lines loaded.\n";
 
-	write_methcall( methcall, output, ".CpH.call" );
+	write_methcall( methcall, fcall );
+	fcall.close();
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////
 void deal_PE_CpH( const char *gfile, const char *samfile, const int cycle, const char *output) {
-	// load genome
-	string g;
-	loadchr( gfile, g );
+	// load genome; for a shard, the genome of each contig is loaded at its first read
+	bool shard = shard_is_dir( gfile );
+	string g, curr_chr;
+	if( ! shard )
+		loadchr( gfile, g );
 
 	unordered_map<int, meth> methcall;
 
-	// open sam file
-	ifstream fsam( samfile );
-	if( fsam.fail() ) {
+	// open sam file, or the binary fragment records (see fragment.h)
+	fragsource fs;
+	if( ! frag_source_open(fs, samfile) ) {
 		cerr << "Error file: cannot open " << samfile << " to read!\n";
 		exit(200);
 	}
+	ofstream fcall;
+	open_methcall( fcall, output, ".CpH.call" );
 //	cerr << "Loading alignment " << samfile << " in PE mode ...\n";
 
 //	unsigned int count = 0;
-	string line1, line2, seqName, chr, cigar1, seq1, qual1, cigar2, seq2, qual2, score2;
-	register int flag;
-	string mateinfo, matepos, dist;   //fields that are ignored; all the sequence are converted to WATSON chain
+	string seqName, chr, cigar1, seq1, qual1, cigar2, seq2, qual2;	// the other fields are ignored; all the sequence are converted to WATSON chain
 	register unsigned int pos1, pos2, score;
-	stringstream ss;
+	fragrec r1, r2;
 	string realSEQ1, realQUAL1, realSEQ2, realQUAL2;   //these are CIGAR-processed seq and qual
 	string mSEQ, mQUAL; //merged sequence and quality if read1 and read2 has overlap
-	line1.resize( MAX_SAMLINE_SIZE );
-	line2.resize( MAX_SAMLINE_SIZE );
+	r1.line.resize( MAX_SAMLINE_SIZE );
+	r2.line.resize( MAX_SAMLINE_SIZE );
 	mSEQ.resize( MAX_MERGED_SEQ );
 	mQUAL.resize( MAX_MERGED_SEQ );
 //	bool strand;
 
 	// load sam file
 	while( true ) {
-		getline( fsam, line1 );
-		if( fsam.eof() ) break;
-		getline( fsam, line2 );
+		if( ! frag_source_next(fs, r1) ) break;
+		frag_source_next( fs, r2 );
 
 		//14_R1	83	chr9	73301642	42	36M	=	73301399	-279	TCCTCCTTCTCTCCCTC	HHHHHHHHH	XG:Z:CT
 		//14_R2	163	chr9	73301399	42	36M	=	73301642	279	TTTATTTTGATCCTGTA	DDCBA@?>=<;986420.
 
-		ss.clear();
-		ss.str( line1 );
-		ss >> seqName >> flag >> chr >> pos1 >> score >> cigar1 >> mateinfo >> matepos >> dist >> seq1 >> qual1;
+		frag_field( r1, SAM_RNAME, chr );
+		if( shard && chr != curr_chr ) {	// the first read of a contig
+			switch_contig( gfile, chr, g, methcall, fcall );
+			curr_chr = chr;
+		}
 //		cerr << seqName << '\n';
 
+		score = frag_mapq( r1 );
 		if( score < MIN_ALIGN_SCORE_METH ) {
 			//cerr << "Discard " << seqName << " due to poor alignment score.\n";
 			continue;
 		}
 
-		ss.clear();
-		ss.str( line2 );
-		ss >> seqName >> flag >> chr >> pos2 >> score2 >> cigar2 >> mateinfo >> matepos >> dist >> seq2 >> qual2;
+		pos1 = frag_pos( r1 );
+		pos2 = frag_pos( r2 );
 
 		if( pos1 > pos2 ) {	// rare scenario that read2 contains read1!!! Mapping error?
 //			cerr << "ERROR: Read2 contains Read1 in " << seqName << ", skip!\n";
 			continue;
 		}
 
+		frag_field( r1, SAM_CIGAR, cigar1 );
+		frag_field( r1, SAM_SEQ, seq1 );
+		frag_field( r1, SAM_QUAL, qual1 );
+		frag_field( r2, SAM_CIGAR, cigar2 );
+		frag_field( r2, SAM_SEQ, seq2 );
+		frag_field( r2, SAM_QUAL, qual2 );
+
 		// process CIGAR 1, handle the indels
 		realSEQ1.clear();
 		realQUAL1.clear();
 		if( ! fix_cigar( cigar1, realSEQ1, realQUAL1, seq1, qual1 ) ) {
+			frag_field( r2, SAM_QNAME, seqName );
 			cerr << "ERROR: Unsupported CIGAR (" << cigar1 << ") in " << seqName << "!\n";
 			continue;
 		}
@@ -179,6 +202,7 @@ void deal_PE_CpH( const char *gfile, const char *samfile, const int cycle, const
 		realSEQ2.clear();
 		realQUAL2.clear();
 		if( ! fix_cigar( cigar2, realSEQ2, realQUAL2, seq2, qual2 ) ) {
+			frag_field( r2, SAM_QNAME, seqName );
 			cerr << "ERROR: Unsupported CIGAR (" << cigar2 << ") in " << seqName << "!\n";
 			continue;
 		}
@@ -232,10 +256,11 @@ void deal_PE_CpH( const char *gfile, const char *samfile, const int cycle, const
 //			cout << '\r' << count << " lines loaded.";
 	}
 //	cerr << '\r' << "Done: " << count << " lines loaded.\n";
-	fsam.close();
+	frag_source_close( fs );
 
 	// write meth call
-	write_methcall( methcall, output, ".CpH.call" );
+	write_methcall( methcall, fcall );
+	fcall.close();
 }
 
 // call meth from sequence
@@ -243,6 +268,8 @@ void callmeth_CpH( string &seq, string &qual, int pos,
 			string &g, unordered_map<int, meth> &methcall, int cycle, bool rev ) {
 	unsigned int rs = seq.size();
 	unsigned int os = rs - 1;	// offset for rev-cmp-ed R2
+	if( pos + rs >= g.size() )	// the read runs over the end of the chr, whose genome is g[1, g.size()-2]
+		rs = ( pos + 1 < g.size() ) ? g.size() - 1 - pos : 0;
 	char c1, c2;
 	unordered_map<int, meth> :: iterator it;
 	for( unsigned int i=0, j=pos; i!=rs; ++i, ++j) {
@@ -280,20 +307,29 @@ void callmeth_CpH( string &seq, string &qual, int pos,
 }
 
 // write meth call into file
-void write_methcall( unordered_map<int, meth> &m, const char *pre, const char *suf ) {
+void open_methcall( ofstream &fout, const char *pre, const char *suf ) {
 	string outfile = pre;
 	outfile += suf;
-	ofstream fout( outfile.c_str() );
+	fout.open( outfile.c_str() );
 	if( fout.fail() ) {
 		cerr << "ERROR: write output file " << outfile << " failed.\n";
 		exit(20);
 	}
+	fout << "#Locus\tC\tT\tZ\n";
+}
 
+void write_methcall( unordered_map<int, meth> &m, ofstream &fout ) {
 	unordered_map<int, meth> :: iterator it;
-	fout << "#Locus\tC\tT\tZ\n";
 	for( it=m.begin(); it!=m.end(); ++it ) {
 		fout << it->first << '\t' << it->second.C << '\t' << it->second.T << '\t' << it->second.Z << '\n';
 	}
-	fout.close();
+}
+
+// write the calls of the previous contig of a shard and load the genome of the next one
+void switch_contig( const char *gdir, const string &chr, string &g, unordered_map<int, meth> &methcall, ofstream &fout ) {
+	write_methcall( methcall, fout );
+	methcall.clear();
+	fout << SHARD_CONTIG_MARKER << chr << '\n';
+	loadchr( shard_fasta(gdir, chr).c_str(), g );
 }
 
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "namedict.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+bool namedict_write_index( const string & file, const vector<uint64_t> & bytes ) {
+	FILE *fp = fopen( file.c_str(), "wb" );
+	if( fp == NULL )
+		return false;
+
+	uint32_t nchunk = bytes.size();
+	bool ok = fwrite( &nchunk, sizeof(uint32_t), 1, fp ) == 1;
+	if( ok && nchunk )
+		ok = fwrite( bytes.data(), sizeof(uint64_t), nchunk, fp ) == nchunk;
+	return fclose( fp ) == 0 && ok;
+}
+
+// map prefix.names and load prefix.names.idx
+bool namedict_open( namedict & nd, const char *prefix ) {
+	string file = prefix;
+	file += ".names.idx";
+	FILE *fp = fopen( file.c_str(), "rb" );
+	if( fp == NULL ) {
+		cerr << "Error: could not open name index file '" << file << "'!\n";
+		return false;
+	}
+	uint32_t nchunk;
+	bool ok = fread( &nchunk, sizeof(uint32_t), 1, fp ) == 1;
+	if( ok ) {
+		nd.bytes.resize( nchunk );
+		if( nchunk )
+			ok = fread( nd.bytes.data(), sizeof(uint64_t), nchunk, fp ) == nchunk;
+	}
+	fclose( fp );
+	if( ! ok ) {
+		cerr << "Error: broken name index file '" << file << "'!\n";
+		return false;
+	}
+
+	nd.first.resize( nchunk );
+	uint64_t total = 0;
+	for( uint32_t i=0; i!=nchunk; ++i ) {
+		nd.first[i] = total;
+		total += nd.bytes[i];
+	}
+
+	file = prefix;
+	file += ".names";
+	int fd = open( file.c_str(), O_RDONLY );
+	struct stat st;
+	if( fd < 0 || fstat(fd, &st) != 0 ) {
+		cerr << "Error: could not open name file '" << file << "'!\n";
+		if( fd >= 0 )
+			close( fd );
+		return false;
+	}
+	nd.size = st.st_size;
+	if( nd.size != total ) {
+		cerr << "Error: name file '" << file << "' does not match its index!\n";
+		close( fd );
+		return false;
+	}
+	nd.data = NULL;
+	if( nd.size ) {
+		void *p = mmap( NULL, nd.size, PROT_READ, MAP_SHARED, fd, 0 );
+		if( p == MAP_FAILED ) {
+			cerr << "Error: could not map name file '" << file << "'!\n";
+			close( fd );
+			return false;
+		}
+		nd.data = (const char *) p;
+	}
+	close( fd );	// the mapping is kept
+	return true;
+}
+
+void namedict_close( namedict & nd ) {
+	if( nd.data )
+		munmap( (void *)nd.data, nd.size );
+	nd.data = NULL;
+}
+
+static unsigned char base62_value( char c ) {
+	if( c>='0' && c<='9' )
+		return c - '0';
+	if( c>='A' && c<='Z' )
+		return c - 'A' + 10;
+	if( c>='a' && c<='z' )
+		return c - 'a' + 36;
+	return 62;
+}
+
+bool namedict_restore( const namedict & nd, string & name ) {
+	if( name.empty() || name.size() > MAX_NAME_KEY_SIZE )
+		return false;
+	register uint64_t key = 0;
+	for( unsigned int i=0; i!=name.size(); ++i ) {
+		register unsigned char v = base62_value( name[i] );
+		if( v == 62 )
+			return false;
+		key = key * 62 + v;
+	}
+
+	uint64_t chunk  = key >> NAME_KEY_SHIFT;
+	uint64_t offset = key & ( ((uint64_t)1 << NAME_KEY_SHIFT) - 1 );
+	if( chunk >= nd.bytes.size() || offset >= nd.bytes[chunk] )
+		return false;
+
+	const char *p = nd.data + nd.first[chunk] + offset;
+	const char *e = (const char *) memchr( p, '\n', nd.bytes[chunk] - offset );
+	if( e == NULL )
+		return false;
+	name.assign( p, e-p );
+	return true;
+}
+
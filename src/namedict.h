@@ -0,0 +1,66 @@
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "common.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Read-name compaction between the preprocessors and the rmdup/tag stages.
+ * The preprocessors could replace the read names with short keys in base-62 (0-9A-Za-z), so the
+ * aligner output and the per-chr SAM files carry a few bytes per read instead of the 40-70 bytes of
+ * an Illumina name; rmdup/tag then put the original names back for the reads they keep. The key is
+ *   chunk << NAME_KEY_SHIFT | offset of the name in the dictionary block of the chunk
+ * and the files are
+ *   prefix.names    : the original names of the reads in output order, one per line (without "/1")
+ *   prefix.names.idx: uint32 number of chunks, then uint64 size of the dictionary block of each chunk
+ * so a name is found from its key directly, without any per-read index.
+*/
+
+#ifndef _MSUITE_NAMEDICT_
+#define _MSUITE_NAMEDICT_
+
+const unsigned int NAME_KEY_SHIFT = 32;
+const unsigned int NAME_BYTES_PER_READ = 64;	// estimated size of a name in the dictionary
+const unsigned int MAX_NAME_KEY_SIZE = 11;		// base-62 digits of a 64-bit key
+
+static const char base62_char[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
+
+typedef struct {
+	const char *data;			// the dictionary, mapped into memory
+	size_t size;
+	vector<uint64_t> first;		// the first byte of each chunk
+	vector<uint64_t> bytes;		// bytes of each chunk
+} namedict;
+
+inline uint64_t name_key( uint64_t chunk, uint64_t offset ) {
+	return ( chunk << NAME_KEY_SHIFT ) | offset;
+}
+
+// write v in base-62; returns the end of the output
+inline char * emit_base62( char *p, uint64_t v ) {
+	char digit[ MAX_NAME_KEY_SIZE ];
+	register unsigned int n = 0;
+	do {
+		digit[ n ++ ] = base62_char[ v % 62 ];
+		v /= 62;
+	} while( v );
+	while( n )
+		*p ++ = digit[ -- n ];
+	return p;
+}
+
+bool namedict_write_index( const string & file, const vector<uint64_t> & bytes );
+
+bool namedict_open( namedict & nd, const char *prefix );
+void namedict_close( namedict & nd );
+
+// replace the key in name with the original name; returns false if it is not in the dictionary
+bool namedict_restore( const namedict & nd, string & name );
+
+#endif
+
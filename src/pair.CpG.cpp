@@ -6,6 +6,7 @@
 #include <map>
 #include "common.h"
 #include "util.h"
+#include "shard.h"
 
 using namespace std;
 
@@ -18,17 +19,11 @@ using namespace std;
 
 int main( int argc, char *argv[] ) {
 	if( argc != 6 ) {
-        cerr<< "\nUsage: " << argv[0] << " <chr.label> <chr.fa> <mode=BS|TAPS> <w.call> <c.call>\n"
+        cerr<< "\nUsage: " << argv[0] << " <chr.label> <chr.fa|fasta.dir/ for a shard> <mode=BS|TAPS> <w.call> <c.call>\n"
 			<< "\nThis program is a component of Msuite2, designed to merge CpG methylation from watson and crick strands.\n";
 		return 2;
 	}
 
-	string seq;
-	loadchr( argv[2], seq );
-	int chrsize = seq.length() - 2;
-	//seq contains 2 additional letters "X", "Y"
-	//CpGs in Crick chain should have +1 position compared to its Watson partner
-
 	bool mode;	// true is BS, false is TAPS
 	if( strcmp(argv[3], "BS")==0 || strcmp(argv[3], "bs")==0 ) {
 		mode = true;
@@ -49,59 +44,17 @@ int main( int argc, char *argv[] ) {
 	pm.wC=0; pm.wT=0; pm.wZ=0;
 	pm.cC=0; pm.cT=0; pm.cZ=0;
 
-	// watson
-	ifstream fcall( argv[4] );
-	if( fcall.fail() ) {
+	// watson and crick
+	ifstream fw( argv[4] );
+	if( fw.fail() ) {
 		cerr << "Error file: cannot open " << argv[4] << " to read!\n";
 		exit(10);
 	}
-	while( true ) {
-		getline( fcall, line );
-		if( fcall.eof() ) break;
-
-		if( line[0] == '#' ) continue;
-
-		ss.clear();
-		ss.str( line );
-		ss >> pos >> C >> T >> Z;
-		pm.wC = C;
-		pm.wT = T;
-		pm.wZ = Z;
-		meth.insert( pair<int, pairedmeth>(pos, pm) );
-	}
-	fcall.close();
-
-	// crick
-	fcall.open( argv[5] );
-	if( fcall.fail() ) {
+	ifstream fc( argv[5] );
+	if( fc.fail() ) {
 		cerr << "Error file: cannot open " << argv[5] << " to read!\n";
 		exit(11);
 	}
-	pm.wC=0; pm.wT=0; pm.wZ=0;
-	while( true ) {
-		getline( fcall, line );
-		if( fcall.eof() ) break;
-
-		if( line[0] == '#' ) continue;
-
-		ss.clear();
-		ss.str( line );
-		ss >> pos >> C >> T >> Z;
-		pos = chrsize - pos;
-
-		it = meth.find( pos );
-		if( it == meth.end() ) {
-			pm.cC = C;
-			pm.cT = T;
-			pm.cZ = Z;
-			meth.insert( pair<int, pairedmeth>(pos, pm) );
-		} else {
-			it->second.cC = C;
-			it->second.cT = T;
-			it->second.cZ = Z;
-		}
-	}
-	fcall.close();
 
 	//write output
 	string output = argv[1];
@@ -120,36 +73,110 @@ int main( int argc, char *argv[] ) {
 		exit(13);
 	}
 
-	//#chr	Locus	Total	wC	wT	wOther	Context	cC	cT	cOther
-	int wC_total = 0;
-	int wT_total = 0;
-	int cC_total = 0;
-	int cT_total = 0;
-	for( it=meth.begin(); it!=meth.end(); ++it ) {
-		pos = it->first;
-		int total_valid = it->second.wC + it->second.wT + it->second.cC + it->second.cT;
-		int total = total_valid + it->second.wZ + it->second.cZ;
-		fout << argv[1] << '\t' << pos << '\t' << total << '\t'
-			 << it->second.wC << '\t' << it->second.wT << '\t' << it->second.wZ << '\t'
-			 << seq[pos-1] << seq[pos] << seq[pos+1] << seq[pos+2] << '\t'
-			 << it->second.cC << '\t' << it->second.cT << '\t' << it->second.cZ << '\n';
-
-		wC_total += it->second.wC;
-		wT_total += it->second.wT;
-		cC_total += it->second.cC;
-		cT_total += it->second.cT;
-
-		float meth;
-		if( mode ) {
-			meth = (it->second.wC+it->second.cC)*100.0/total_valid;
+	// the call files of a shard give the contigs in the same order (see shard.h), and a contig may be
+	// missing in either of them; a file without markers is 1 contig
+	bool shard = shard_is_dir( argv[2] );
+	callreader wcr, ccr;
+	call_start( wcr, fw );
+	call_start( ccr, fc );
+	string wcontig, ccontig, contig, label;
+	bool wmore = call_next_contig( wcr, wcontig );
+	bool cmore = call_next_contig( ccr, ccontig );
+	if( ! shard )
+		wmore = cmore = true;
+
+	while( wmore || cmore ) {
+		if( wmore && cmore ) {
+			contig = ( wcontig < ccontig ) ? wcontig : ccontig;
 		} else {
-			meth = (it->second.wT+it->second.cT)*100.0/total_valid;
+			contig = wmore ? wcontig : ccontig;
 		}
-		fbed << argv[1] << '\t' << pos-1 << '\t' << pos << '\t' << meth << '\n';
+
+		string seq;
+		if( shard ) {
+			label = "chr";
+			label += contig;
+			loadchr( shard_fasta(argv[2], label).c_str(), seq );
+		} else {
+			label = argv[1];
+			loadchr( argv[2], seq );
+		}
+		int chrsize = seq.length() - 2;
+		//seq contains 2 additional letters "X", "Y"
+		//CpGs in Crick chain should have +1 position compared to its Watson partner
+
+		meth.clear();
+		if( wmore && wcontig == contig ) {
+			pm.cC=0; pm.cT=0; pm.cZ=0;
+			while( call_getline(wcr, line) ) {
+				ss.clear();
+				ss.str( line );
+				ss >> pos >> C >> T >> Z;
+				pm.wC = C;
+				pm.wT = T;
+				pm.wZ = Z;
+				meth.insert( pair<int, pairedmeth>(pos, pm) );
+			}
+			wmore = shard && call_next_contig( wcr, wcontig );
+		}
+
+		// crick
+		if( cmore && ccontig == contig ) {
+			pm.wC=0; pm.wT=0; pm.wZ=0;
+			while( call_getline(ccr, line) ) {
+				ss.clear();
+				ss.str( line );
+				ss >> pos >> C >> T >> Z;
+				pos = chrsize - pos;
+
+				it = meth.find( pos );
+				if( it == meth.end() ) {
+					pm.cC = C;
+					pm.cT = T;
+					pm.cZ = Z;
+					meth.insert( pair<int, pairedmeth>(pos, pm) );
+				} else {
+					it->second.cC = C;
+					it->second.cT = T;
+					it->second.cZ = Z;
+				}
+			}
+			cmore = shard && call_next_contig( ccr, ccontig );
+		}
+
+		//#chr	Locus	Total	wC	wT	wOther	Context	cC	cT	cOther
+		int wC_total = 0;
+		int wT_total = 0;
+		int cC_total = 0;
+		int cT_total = 0;
+		for( it=meth.begin(); it!=meth.end(); ++it ) {
+			pos = it->first;
+			int total_valid = it->second.wC + it->second.wT + it->second.cC + it->second.cT;
+			int total = total_valid + it->second.wZ + it->second.cZ;
+			fout << label << '\t' << pos << '\t' << total << '\t'
+				 << it->second.wC << '\t' << it->second.wT << '\t' << it->second.wZ << '\t'
+				 << seq[pos-1] << seq[pos] << seq[pos+1] << seq[pos+2] << '\t'
+				 << it->second.cC << '\t' << it->second.cT << '\t' << it->second.cZ << '\n';
+
+			wC_total += it->second.wC;
+			wT_total += it->second.wT;
+			cC_total += it->second.cC;
+			cT_total += it->second.cT;
+
+			float meth;
+			if( mode ) {
+				meth = (it->second.wC+it->second.cC)*100.0/total_valid;
+			} else {
+				meth = (it->second.wT+it->second.cT)*100.0/total_valid;
+			}
+			fbed << label << '\t' << pos-1 << '\t' << pos << '\t' << meth << '\n';
+		}
+
+		cout << label << '\t' << wC_total << '\t' << wT_total << '\t' << cC_total << '\t' << cT_total << '\n';
 	}
+	fw.close();
+	fc.close();
 	fout.close();
 	fbed.close();
-
-	cout << argv[1] << '\t' << wC_total << '\t' << wT_total << '\t' << cC_total << '\t' << cT_total << '\n';
 }
 
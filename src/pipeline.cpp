@@ -0,0 +1,550 @@
+#include <iostream>
+#include <chrono>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "pipeline.h"
+#include "gzreader.h"
+#include "qualside.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+static inline uint64_t now_us() {
+	return chrono::duration_cast<chrono::microseconds>( chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+static void write_all( int fd, const char *buf, size_t size ) {
+	while( size ) {
+		ssize_t n = write( fd, buf, size );
+		if( n < 0 ) {
+			if( errno == EINTR )
+				continue;
+			cerr << "Error: write file failed!\n";
+			exit(3);
+		}
+		buf  += n;
+		size -= n;
+	}
+}
+
+// first writing thread: keep the first copy of each read in the chunk, in order
+static void collapse_chunk( ordered_writer *w, outchunk *c ) {
+	unsigned int n = c->hash.size();
+	c->keep.resize( n );
+	if( c->seq < MAX_DUP_CHUNK ) {
+		for( unsigned int i=0; i!=n; ++i )
+			c->keep[i] = dupset_add( *(w->dups), c->hash[i], c->check[i], (uint32_t)qual_key(c->seq, i) );
+	} else {
+		for( unsigned int i=0; i!=n; ++i )
+			c->keep[i] = 1;
+	}
+
+	c->collapsed.store( true, memory_order_release );
+	{
+		lock_guard<mutex> lck( w->ready_mtx );
+	}
+	w->ready_cv.notify_all();
+}
+
+// remove the duplicates from buf[k]
+static void compact_chunk( outchunk *c, unsigned int k ) {
+	register size_t from = 0, to = 0;
+	for( unsigned int i=0; i!=c->keep.size(); ++i ) {
+		register size_t end = c->rec_end[k][i];
+		if( c->keep[i] ) {
+			if( to != from )
+				memmove( c->buf[k]+to, c->buf[k]+from, end-from );
+			to += end - from;
+		}
+		from = end;
+	}
+	c->size[k] = to;
+}
+
+// the k-th writing thread: emit the chunks for file k in order
+static void writer_thread( ordered_writer *w, unsigned int k ) {
+	// open the file here so that the named pipes could be opened in any order by the reader
+	int fd = open( w->file[k].c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644 );
+	if( fd < 0 ) {
+		cerr << "Error: write file failed!\n";
+		exit(3);
+	}
+
+	for( uint64_t s=0; ; ++s ) {
+		atomic<outchunk *> & sl = w->slot[ s % w->nchunk ];
+		outchunk *c = sl.load( memory_order_acquire );
+		if( c == NULL || c->seq != s ) {	// not ready, sleep until a new chunk is submitted
+			uint64_t start = now_us();
+			unique_lock<mutex> lck( w->ready_mtx );
+			while( true ) {
+				c = sl.load( memory_order_acquire );
+				if( c != NULL && c->seq == s )
+					break;
+				if( s >= w->end_seq.load() )
+					break;
+				w->ready_cv.wait( lck );
+			}
+			w->stall += now_us() - start;
+		}
+		if( c == NULL || c->seq != s )	// all chunks are written
+			break;
+
+		if( w->dups && k < w->nfile ) {
+			if( k == 0 ) {
+				collapse_chunk( w, c );
+			} else if( ! c->collapsed.load(memory_order_acquire) ) {
+				uint64_t start = now_us();
+				unique_lock<mutex> lck( w->ready_mtx );
+				while( ! c->collapsed.load(memory_order_acquire) )
+					w->ready_cv.wait( lck );
+				w->stall += now_us() - start;
+			}
+			compact_chunk( c, k );
+		}
+
+		write_all( fd, c->buf[k], c->size[k] );
+		w->chunk_bytes[k].push_back( c->size[k] );
+
+		if( k == 0 ) {	// merge statistics
+			for( unsigned int i=0; i!=w->nfile; ++i ) {
+				basecounter_merge( w->stat[i], c->stat[i] );
+				basecounter_merge( w->stat_trimmed[i], c->stat_trimmed[i] );
+			}
+			w->chunk_reads.push_back( c->in[0].num - c->dropped );
+			w->dropped      += c->dropped;
+			w->real_adapter += c->real_adapter;
+			w->tail_adapter += c->tail_adapter;
+		}
+
+		if( c->pending.fetch_sub(1) == 1 ) {	// the last writer for this chunk, recycle it
+			sl.store( NULL, memory_order_release );
+			lock_guard<mutex> lck( w->pool_mtx );
+			w->pool[ w->nfree ++ ] = c;
+			w->pool_cv.notify_all();
+		}
+	}
+
+	close( fd );
+}
+
+void cq_init( chunkqueue & cq ) {
+	cq.q.clear();
+	cq.closed = false;
+}
+
+void cq_push( chunkqueue & cq, outchunk *c ) {
+	{
+		lock_guard<mutex> lck( cq.mtx );
+		cq.q.push_back( c );
+	}
+	cq.cv.notify_one();
+}
+
+// take the first chunk in the queue; returns NULL if the queue is closed and empty
+outchunk * cq_pop( chunkqueue & cq ) {
+	unique_lock<mutex> lck( cq.mtx );
+	while( cq.q.empty() && ! cq.closed )
+		cq.cv.wait( lck );
+	if( cq.q.empty() )
+		return NULL;
+
+	outchunk *c = cq.q.front();
+	cq.q.pop_front();
+	return c;
+}
+
+// take the first chunk in the queue without waiting; returns NULL if the queue is empty
+outchunk * cq_try_pop( chunkqueue & cq ) {
+	lock_guard<mutex> lck( cq.mtx );
+	if( cq.q.empty() )
+		return NULL;
+
+	outchunk *c = cq.q.front();
+	cq.q.pop_front();
+	return c;
+}
+
+// no more chunks will be pushed
+void cq_close( chunkqueue & cq ) {
+	{
+		lock_guard<mutex> lck( cq.mtx );
+		cq.closed = true;
+	}
+	cq.cv.notify_all();
+}
+
+// the reads in one chunk are expected to take this size in each input/output file
+static size_t block_size( unsigned int reads_per_chunk, unsigned int cycle ) {
+	return reads_per_chunk * ( (cycle<<1) + EXTRA_BYTES_PER_READ );
+}
+
+void outchunk_grow( outchunk *c, unsigned int k, size_t more ) {
+	size_t cap = c->capacity[k] + (c->capacity[k] >> 1);
+	if( cap < c->size[k] + more )
+		cap = c->size[k] + more;
+	char *p = (char *) realloc( c->buf[k], cap );
+	if( p == NULL ) {
+		cerr << "Error: could not allocate memory for output!\n";
+		exit(12);
+	}
+	c->buf[k] = p;
+	c->capacity[k] = cap;
+}
+
+// input lanes; returns the number of lanes that are read at the same time
+unsigned int lanes_init( lanesched & ls, unsigned int nfile, unsigned int max_lanes ) {
+	ls.nfile  = nfile;
+	ls.opened = ( nfile < max_lanes ) ? nfile : max_lanes;
+	ls.active.clear();
+	for( unsigned int i=0; i!=ls.opened; ++i )
+		ls.active.push_back( i );
+	ls.turn = 0;
+	return ls.opened;
+}
+
+void lanes_next( lanesched & ls ) {
+	if( ++ ls.turn == ls.active.size() )
+		ls.turn = 0;
+}
+
+// the new file is loaded right away in the turn of the ended lane
+int lanes_end( lanesched & ls ) {
+	if( ls.opened != ls.nfile ) {
+		ls.active[ ls.turn ] = ls.opened;
+		return ls.opened ++;
+	}
+	ls.active.erase( ls.active.begin() + ls.turn );
+	if( ls.turn == ls.active.size() )
+		ls.turn = 0;
+	return -1;
+}
+
+// estimated memory of one chunk: input arena (with the bytes fetched in advance) and output buffer per file,
+// and the side buffers if there are any
+size_t chunk_memory( unsigned int nfile, unsigned int nout, const unsigned int *side_bytes,
+						unsigned int reads_per_chunk, unsigned int cycle ) {
+	size_t side = 0;
+	for( unsigned int k=nfile; k<nout; ++k )
+		side += (size_t)reads_per_chunk * side_bytes[ k-nfile ];
+	return nfile * ( (block_size(reads_per_chunk, cycle) << 1) + FQ_READ_CHUNK ) + side;
+}
+
+/*
+ * number of chunks that fit in max_mem MB (0 for no limit), at most nchunk
+ * at least 2 chunks are used so that loading and processing could overlap
+*/
+unsigned int chunks_in_budget( unsigned int nfile, unsigned int nout, const unsigned int *side_bytes,
+								unsigned int reads_per_chunk, unsigned int cycle, unsigned int max_mem, unsigned int nchunk ) {
+	if( max_mem == 0 )
+		return nchunk;
+
+	size_t n = ( (size_t)max_mem << 20 ) / chunk_memory( nfile, nout, side_bytes, reads_per_chunk, cycle );
+	if( n < 2 ) {
+		n = 2;
+		cerr << "Warning: memory budget is too small, "
+			 << ( (chunk_memory(nfile, nout, side_bytes, reads_per_chunk, cycle) * n) >> 20 ) << " MB will be used!\n";
+	}
+	if( n < nchunk )
+		nchunk = n;
+	return nchunk;
+}
+
+/*
+ * bytes of max_mem MB (0 for no limit) left after nchunk chunks, e.g., for the duplicate table
+ * at least 1 is returned if there is a budget, so that it is never taken as no limit
+*/
+size_t budget_left( unsigned int nfile, unsigned int nout, const unsigned int *side_bytes,
+					unsigned int reads_per_chunk, unsigned int cycle, unsigned int max_mem, unsigned int nchunk ) {
+	if( max_mem == 0 )
+		return 0;
+
+	size_t total = (size_t)max_mem << 20;
+	size_t used  = nchunk * chunk_memory( nfile, nout, side_bytes, reads_per_chunk, cycle );
+	return used < total ? total - used : 1;
+}
+
+// peak resident memory of this process in MB
+unsigned int peak_rss() {
+	struct rusage ru;
+	if( getrusage(RUSAGE_SELF, &ru) != 0 )
+		return 0;
+#ifdef __APPLE__
+	return ru.ru_maxrss >> 20;	// in bytes on macOS
+#else
+	return ru.ru_maxrss >> 10;	// in KB on Linux
+#endif
+}
+
+/*
+ * nfile: number of input files (1 for SE, 2 for PE)
+ * nout: number of output files, the converted reads for each input file and optionally the side files
+ *       (the quality side file and the name dictionary)
+ * side_bytes: initial size per read of the buffer for each side file, the buffers grow on demand
+ * nchunk: number of chunks in the pool, each chunk holds reads_per_chunk reads for each input file
+ *         and the converted reads for each output file
+ * dups: the reads written so far if duplicates are collapsed, NULL otherwise
+*/
+void writer_open( ordered_writer & w, unsigned int nfile, unsigned int nout, const string *file,
+					const unsigned int *side_bytes, unsigned int nchunk, unsigned int reads_per_chunk, unsigned int cycle,
+					dupset *dups ) {
+	w.nfile  = nfile;
+	w.nout   = nout;
+	w.cycle  = cycle;
+	w.nchunk = nchunk;
+	w.chunks = new outchunk [ nchunk ];
+	w.pool   = new outchunk * [ nchunk ];
+	w.slot   = new atomic<outchunk *> [ nchunk ];
+	for( unsigned int i=0; i!=nchunk; ++i ) {
+		outchunk *c = w.chunks + i;
+		for( unsigned int k=0; k!=nfile; ++k ) {
+			fq_block_init( c->in[k], reads_per_chunk, block_size(reads_per_chunk, cycle) + FQ_READ_CHUNK );
+			c->capacity[k] = block_size( reads_per_chunk, cycle );
+			c->buf[k] = (char *) malloc( c->capacity[k] );
+			if( c->buf[k] == NULL ) {
+				cerr << "Error: could not allocate memory for output!\n";
+				exit(12);
+			}
+			basecounter_init( c->stat[k], cycle );
+			basecounter_init( c->stat_trimmed[k], cycle );
+		}
+		for( unsigned int k=nfile; k!=nout; ++k ) {
+			c->capacity[k] = (size_t)reads_per_chunk * side_bytes[ k-nfile ];
+			c->buf[k] = (char *) malloc( c->capacity[k] );
+			if( c->buf[k] == NULL ) {
+				cerr << "Error: could not allocate memory for output!\n";
+				exit(12);
+			}
+		}
+		w.pool[i] = c;
+		w.slot[i].store( NULL );
+	}
+	w.nfree = nchunk;
+	w.dups  = dups;
+
+	for( unsigned int k=0; k!=nout; ++k )
+		w.file[k] = file[k];
+	for( unsigned int k=0; k!=nfile; ++k ) {
+		w.stat[k] = new fastqstat [ cycle ];
+		memset( w.stat[k], 0, cycle*sizeof(fastqstat) );
+		w.stat_trimmed[k] = new fastqstat [ cycle ];
+		memset( w.stat_trimmed[k], 0, cycle*sizeof(fastqstat) );
+	}
+	w.dropped = 0;
+	w.real_adapter = 0;
+	w.tail_adapter = 0;
+	w.stall.store( 0 );
+	w.chunk_reads.clear();
+	for( unsigned int k=0; k!=nout; ++k )
+		w.chunk_bytes[k].clear();
+	w.end_seq.store( UINT64_MAX );
+
+	for( unsigned int k=0; k!=nout; ++k )
+		w.th[k] = thread( writer_thread, &w, k );
+}
+
+static void chunk_reset( ordered_writer & w, outchunk *c ) {
+	for( unsigned int k=0; k!=w.nout; ++k )
+		c->size[k] = 0;
+	for( unsigned int k=0; k!=w.nfile; ++k ) {
+		basecounter_reset( c->stat[k] );
+		basecounter_reset( c->stat_trimmed[k] );
+	}
+	c->dropped = 0;
+	c->real_adapter = 0;
+	c->tail_adapter = 0;
+	if( w.dups ) {
+		c->hash.clear();
+		c->check.clear();
+		for( unsigned int k=0; k!=w.nfile; ++k )
+			c->rec_end[k].clear();
+		c->collapsed.store( false );
+	}
+	c->pending.store( w.nout );
+}
+
+// take an empty chunk from the pool; wait if all the chunks are in use
+outchunk * writer_get_chunk( ordered_writer & w ) {
+	outchunk *c;
+	{
+		unique_lock<mutex> lck( w.pool_mtx );
+		while( w.nfree == 0 )
+			w.pool_cv.wait( lck );
+		c = w.pool[ -- w.nfree ];
+	}
+	chunk_reset( w, c );
+	return c;
+}
+
+// take an empty chunk from the pool without waiting; returns NULL if all the chunks are in use
+static outchunk * writer_try_get_chunk( ordered_writer & w ) {
+	outchunk *c;
+	{
+		lock_guard<mutex> lck( w.pool_mtx );
+		if( w.nfree == 0 )
+			return NULL;
+		c = w.pool[ -- w.nfree ];
+	}
+	chunk_reset( w, c );
+	return c;
+}
+
+// put back a chunk that is not used, e.g., the one that hits the end of the input file
+void writer_recycle( ordered_writer & w, outchunk *c ) {
+	lock_guard<mutex> lck( w.pool_mtx );
+	w.pool[ w.nfree ++ ] = c;
+	w.pool_cv.notify_all();
+}
+
+// hand over a processed chunk; the sequence numbers (c->seq set by the loader) MUST be 0,1,2,... without gaps
+void writer_submit( ordered_writer & w, outchunk *c ) {
+	uint64_t seq = c->seq.load();
+	atomic<outchunk *> & sl = w.slot[ seq % w.nchunk ];
+	if( sl.load(memory_order_acquire) != NULL ) {	// the previous user of this slot is not written yet
+		unique_lock<mutex> lck( w.pool_mtx );
+		while( sl.load(memory_order_acquire) != NULL )
+			w.pool_cv.wait( lck );
+	}
+
+	sl.store( c, memory_order_release );
+	{
+		lock_guard<mutex> lck( w.ready_mtx );
+	}
+	w.ready_cv.notify_all();
+}
+
+// wait for all the 'total' chunks to be written, then release the buffers
+// the merged statistics in w are kept for the caller
+void writer_close( ordered_writer & w, uint64_t total ) {
+	{
+		lock_guard<mutex> lck( w.ready_mtx );
+		w.end_seq.store( total );
+	}
+	w.ready_cv.notify_all();
+	for( unsigned int k=0; k!=w.nout; ++k )
+		w.th[k].join();
+
+	for( unsigned int i=0; i!=w.nchunk; ++i ) {
+		for( unsigned int k=0; k!=w.nout; ++k )
+			free( w.chunks[i].buf[k] );
+		for( unsigned int k=0; k!=w.nfile; ++k ) {
+			basecounter_free( w.chunks[i].stat[k] );
+			basecounter_free( w.chunks[i].stat_trimmed[k] );
+		}
+	}
+	delete [] w.chunks;
+	delete [] w.pool;
+	delete [] w.slot;
+}
+
+
+void work_init( workpool & wp, ordered_writer & w, chunk_kernel kernel, const trim_param & tp ) {
+	cq_init( wp.jobs );
+	wp.writer = &w;
+	wp.kernel = kernel;
+	wp.tp = &tp;
+	wp.loader_stall.store( 0 );
+	wp.relay_stall.store( 0 );
+	wp.worker_stall.store( 0 );
+	wp.loader_jobs.store( 0 );
+	wp.worker_inflates.store( 0 );
+}
+
+// process a loaded chunk and hand it over to the writer
+void work_run( workpool & wp, outchunk *c ) {
+	wp.kernel( c, *wp.tp );
+	writer_submit( *wp.writer, c );
+}
+
+// for the loaders: process one queued chunk if there is any
+static bool loader_help( workpool & wp ) {
+	outchunk *c = cq_try_pop( wp.jobs );
+	if( c == NULL )
+		return false;
+	work_run( wp, c );
+	++ wp.loader_jobs;
+	return true;
+}
+
+// worker: process the chunks until the job queue is closed; inflate the input files while it is empty
+void work_loop( workpool & wp ) {
+	chunkqueue & cq = wp.jobs;
+	while( true ) {
+		outchunk *c = NULL;
+		{
+			unique_lock<mutex> lck( cq.mtx );
+			while( cq.q.empty() && ! cq.closed ) {
+				lck.unlock();
+				if( gz_help() ) {
+					++ wp.worker_inflates;
+					lck.lock();
+					continue;
+				}
+				uint64_t start = now_us();
+				lck.lock();
+				if( cq.q.empty() && ! cq.closed )
+					cq.cv.wait_for( lck, chrono::microseconds(HELP_POLL_US) );
+				wp.worker_stall += now_us() - start;
+			}
+			if( cq.q.empty() )	// closed
+				return;
+			c = cq.q.front();
+			cq.q.pop_front();
+		}
+		work_run( wp, c );
+	}
+}
+
+// take an empty chunk for loading; while all the chunks are in use, process the queued ones
+outchunk * loader_get_chunk( workpool & wp ) {
+	ordered_writer & w = *wp.writer;
+	while( true ) {
+		outchunk *c = writer_try_get_chunk( w );
+		if( c != NULL )
+			return c;
+		if( loader_help(wp) )
+			continue;
+
+		uint64_t start = now_us();
+		{
+			unique_lock<mutex> lck( w.pool_mtx );
+			if( w.nfree == 0 )
+				w.pool_cv.wait_for( lck, chrono::microseconds(HELP_POLL_US) );
+		}
+		wp.loader_stall += now_us() - start;
+	}
+}
+
+// read2 loader: take the next chunk from read1 loader; while there is none, process the queued ones
+// returns NULL if the relay is closed and empty
+outchunk * loader_pop( workpool & wp, chunkqueue & relay ) {
+	while( true ) {
+		{
+			lock_guard<mutex> lck( relay.mtx );
+			if( ! relay.q.empty() ) {
+				outchunk *c = relay.q.front();
+				relay.q.pop_front();
+				return c;
+			}
+			if( relay.closed )
+				return NULL;
+		}
+		if( loader_help(wp) )
+			continue;
+
+		uint64_t start = now_us();
+		{
+			unique_lock<mutex> lck( relay.mtx );
+			if( relay.q.empty() && ! relay.closed )
+				relay.cv.wait_for( lck, chrono::microseconds(HELP_POLL_US) );
+		}
+		wp.relay_stall += now_us() - start;
+	}
+}
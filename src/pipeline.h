@@ -0,0 +1,196 @@
+#include <stdint.h>
+#include <string>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "common.h"
+#include "fqreader.h"
+#include "fqstat.h"
+#include "dupset.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Streaming pipeline for the preprocessors: loader(s) -> workers -> writer.
+ * The reads flow through the pipeline in small chunks. A loader takes an empty chunk from the pool,
+ * fills its input blocks, gives it a sequence number and pushes it to the job queue; any idle worker
+ * takes the next chunk from the queue, so a chunk with many adapter hits or long reads only delays
+ * one worker. The filled chunk is then submitted to the ordered writer, and one writing thread per
+ * output file emits the chunks strictly in sequence order with large write() calls; the first one
+ * also merges the statistics. Written chunks go back to the pool, so the pool size bounds the memory
+ * and the number of chunks in flight. Chunks are handed over to the writer through a ring of atomic
+ * pointers indexed by the sequence number.
+ *
+ * The buffers of a chunk are sized from the cycle and grow on demand; the number of chunks in the pool
+ * could be limited by a memory budget.
+ *
+ * The quality side file (see qualside.h) and the name dictionary (see namedict.h) are more output files
+ * of the writer, each takes a given number of bytes per read in the chunk at first.
+ *
+ * With duplicate collapsing (see dupset.h), the workers record the two hashes and the end of each
+ * read in the output buffers; the first writing thread looks the reads up in the order of the chunks
+ * and removes the duplicates from its buffer, then the other threads for R1/R2 do the same with its
+ * decisions.
+ *
+ * As each output file has its own thread, R1 and R2 are written at the same time, which is required
+ * when the outputs are named pipes read by the aligner in lockstep.
+ *
+ * The threads are not tied to their stages: a loader that finds the pool empty (the workers or the
+ * writer are behind) processes the queued chunks itself, and a worker that finds the job queue empty
+ * (the loaders are behind) inflates the pending BGZF blocks of the input files. The loaders become
+ * workers at the end of the input, so the pipeline runs even without dedicated workers. The time each
+ * stage spends waiting with nothing to help with is recorded, which tells how to size the threads.
+ *
+ * Multiple input files (lanes) are read at the same time, each with its own decompressor, and the
+ * loader takes one chunk from each open lane in turn. When a lane ends, the next file takes its place
+ * in the rotation, so the order of the chunks (hence the output) only depends on the input files.
+*/
+
+#ifndef _MSUITE_PIPELINE_
+#define _MSUITE_PIPELINE_
+
+const unsigned int MAX_FASTQ_FILE = 2;	// R1 and R2
+const unsigned int MAX_OUTPUT_FILE = MAX_FASTQ_FILE + 2;	// R1, R2, the quality side file and the name dictionary
+const size_t EXTRA_BYTES_PER_READ = 128;	// estimated size of the id, '+' and conversion log of a read
+const unsigned int MAX_LANES = 4;		// input files that are read at the same time
+const unsigned int HELP_POLL_US = 1000;	// an idle thread looks for other work this often
+
+typedef struct {
+	fqblock in[ MAX_FASTQ_FILE ];	// loaded reads, modified in-place by the worker
+	unsigned int file;				// index of the input file (for multiple input files)
+	char *buf[ MAX_OUTPUT_FILE ];	// converted reads for each output file
+	size_t size[ MAX_OUTPUT_FILE ];
+	size_t capacity[ MAX_OUTPUT_FILE ];
+	basecounter stat[ MAX_FASTQ_FILE ];	// per-cycle statistics before and after trimming
+	basecounter stat_trimmed[ MAX_FASTQ_FILE ];
+	unsigned int dropped;
+	unsigned int real_adapter;
+	unsigned int tail_adapter;
+	vector<uint64_t> hash;		// hash of each read in the output, for duplicate collapsing
+	vector<uint64_t> check;		// the second hash of each read
+	vector<size_t> rec_end[ MAX_FASTQ_FILE ];	// end of each read in buf
+	vector<char> keep;			// whether each read is the first copy, set by the first writing thread
+	atomic<bool> collapsed;		// keep is ready
+	atomic<uint64_t> seq;
+	atomic<unsigned int> pending;	// writing threads that have not finished this chunk
+} outchunk;
+
+// FIFO queue of chunks between the pipeline stages; it is bounded by the size of the chunk pool
+typedef struct {
+	deque<outchunk *> q;
+	bool closed;
+	mutex mtx;
+	condition_variable cv;
+} chunkqueue;
+
+typedef struct {
+	unsigned int nfile;
+	unsigned int nout;
+	string file[ MAX_OUTPUT_FILE ];
+	unsigned int cycle;
+
+	outchunk *chunks;
+	unsigned int nchunk;
+	outchunk **pool;	// free chunks
+	unsigned int nfree;
+	mutex pool_mtx;
+	condition_variable pool_cv;
+
+	atomic<outchunk *> *slot;	// chunk with sequence number s is in slot[s % nchunk]
+	atomic<uint64_t> end_seq;	// total number of chunks, set by writer_close()
+	mutex ready_mtx;			// only used to sleep when the next chunk is not ready
+	condition_variable ready_cv;
+	thread th[ MAX_OUTPUT_FILE ];
+	dupset *dups;				// reads written so far, NULL if duplicates are not collapsed
+
+	// merged statistics
+	fastqstat *stat[ MAX_FASTQ_FILE ];
+	fastqstat *stat_trimmed[ MAX_FASTQ_FILE ];
+	uint64_t dropped;
+	uint64_t real_adapter;
+	uint64_t tail_adapter;
+	atomic<uint64_t> stall;		// time in microseconds the writing threads wait for the next chunk
+	vector<uint32_t> chunk_reads;	// reads written from each chunk, in order
+	vector<uint64_t> chunk_bytes[ MAX_OUTPUT_FILE ];	// bytes written from each chunk to each file, in order
+} ordered_writer;
+
+struct trim_param;
+typedef void (*chunk_kernel)( outchunk *oc, const trim_param & tp );
+
+// the processing stage, shared by the workers and the loaders
+typedef struct {
+	chunkqueue jobs;			// loaded chunks waiting for processing
+	ordered_writer *writer;
+	chunk_kernel kernel;
+	const trim_param *tp;
+
+	// time in microseconds the threads wait with nothing to do, summed over the threads
+	atomic<uint64_t> loader_stall;	// loaders waiting for a free chunk (the pool is used up)
+	atomic<uint64_t> relay_stall;	// read2 loader waiting for the chunks from read1 loader (PE only)
+	atomic<uint64_t> worker_stall;	// workers waiting for a loaded chunk (the job queue is empty)
+	atomic<uint64_t> loader_jobs;	// chunks processed by the loaders
+	atomic<uint64_t> worker_inflates;	// BGZF chunks inflated by the workers
+} workpool;
+
+// round-robin schedule of the input lanes
+typedef struct {
+	unsigned int nfile;				// number of input files
+	unsigned int opened;			// files opened so far, in the given order
+	vector<unsigned int> active;	// files being read, in the order of loading
+	unsigned int turn;				// index in active of the lane to load next
+} lanesched;
+
+void cq_init( chunkqueue & cq );
+void cq_push( chunkqueue & cq, outchunk *c );
+outchunk * cq_pop( chunkqueue & cq );
+outchunk * cq_try_pop( chunkqueue & cq );
+void cq_close( chunkqueue & cq );
+
+void outchunk_grow( outchunk *c, unsigned int k, size_t more );
+
+// make sure that buf[k] could hold 'more' bytes
+inline void outchunk_reserve( outchunk *c, unsigned int k, size_t more ) {
+	if( c->size[k] + more > c->capacity[k] )
+		outchunk_grow( c, k, more );
+}
+
+// the lanes to open first are in ls.active; the loader then loads from lanes_current() and calls
+// lanes_next() after a chunk, or lanes_end() at the end of the lane, which returns the file to open
+// in its place (-1 if there is none)
+unsigned int lanes_init( lanesched & ls, unsigned int nfile, unsigned int max_lanes );
+inline bool lanes_left( const lanesched & ls ) { return ! ls.active.empty(); }
+inline unsigned int lanes_current( const lanesched & ls ) { return ls.active[ ls.turn ]; }
+void lanes_next( lanesched & ls );
+int lanes_end( lanesched & ls );
+
+size_t chunk_memory( unsigned int nfile, unsigned int nout, const unsigned int *side_bytes,
+						unsigned int reads_per_chunk, unsigned int cycle );
+unsigned int chunks_in_budget( unsigned int nfile, unsigned int nout, const unsigned int *side_bytes,
+								unsigned int reads_per_chunk, unsigned int cycle, unsigned int max_mem, unsigned int nchunk );
+size_t budget_left( unsigned int nfile, unsigned int nout, const unsigned int *side_bytes,
+					unsigned int reads_per_chunk, unsigned int cycle, unsigned int max_mem, unsigned int nchunk );
+unsigned int peak_rss();
+
+void writer_open( ordered_writer & w, unsigned int nfile, unsigned int nout, const string *file,
+					const unsigned int *side_bytes, unsigned int nchunk, unsigned int reads_per_chunk, unsigned int cycle,
+					dupset *dups );
+outchunk * writer_get_chunk( ordered_writer & w );
+void writer_recycle( ordered_writer & w, outchunk *c );
+void writer_submit( ordered_writer & w, outchunk *c );
+void writer_close( ordered_writer & w, uint64_t total );
+
+void work_init( workpool & wp, ordered_writer & w, chunk_kernel kernel, const trim_param & tp );
+void work_run( workpool & wp, outchunk *c );
+void work_loop( workpool & wp );
+outchunk * loader_get_chunk( workpool & wp );
+outchunk * loader_pop( workpool & wp, chunkqueue & relay );
+
+#endif
+
@@ -3,6 +3,7 @@
 #include <string>
 #include <sstream>
 #include <algorithm>
+#include <iomanip>
 #include <vector>
 #include <ctime>
 #include <stdio.h>
@@ -10,19 +11,20 @@
 #include <memory.h>
 #include <omp.h>
 #include <zlib.h>
-#include <chrono>
-#include <thread>
 #include "common.h"
 #include "util.h"
+#include "fqreader.h"
+#include "pipeline.h"
+#include "adapter.h"
+#include "trimmer.h"
+#include "qualside.h"
+#include "namedict.h"
+#include "dupset.h"
 
 using namespace std;
 
 // hisat2 supports atmost 256 character long of read id, and does not has --sam-no-qname-trunc option
 const unsigned int MAX_CONVERTED_READ_ID = 200;	// leave 56 char for read name
-const static chrono::microseconds waiting_time_for_writing(100);
-string unk;
-char *gz_buffer_1 = NULL;
-char *gz_buffer_2 = NULL;
 
 // changes in v2.1: use 2 threads for file loading; change Phred64 to Phred33 when necessary
 /**
@@ -41,93 +43,11 @@ char *gz_buffer_2 = NULL;
  *	   @$		 => for reads without frontG and conversions
 **/
 
-/*
- * use dynamic max_mismatch as the covered size can range from 3 to a large number such as 50
-*/
-bool check_mismatch_dynamic_PE( const string & s1, string & s2, unsigned int pos, const adapter_info* ai ) {
-	register unsigned int mis1=0, mis2=0;
-	register unsigned int i, len;
-	len = s1.length() - pos;
-	if( len > ai->adapter_len )
-		len = ai->adapter_len;
-
-	register unsigned int max_mismatch_dynamic = len >> 3;
-	// here use 1/8 of the total length, use roof(len/8)
-
-	if( (max_mismatch_dynamic<<3) != len )
-		++ max_mismatch_dynamic;
-
-	// check mismatch for each read
-	const char * p = s1.c_str();
-	for( i=0; i!=len; ++i ) {
-		if( p[pos+i] != ai->adapter_r1[i] ) {
-			++ mis1;
-			if( mis1 > max_mismatch_dynamic )
-				return false;
-		}
-	}
-	p = s2.c_str();
-	for( i=0; i!=len; ++i ) {
-		if( p[pos+i] != ai->adapter_r2[i] ) {
-			++ mis2;
-			if( mis2 > max_mismatch_dynamic )
-				return false;
-		}
-	}
-	// check total mismatch
-	max_mismatch_dynamic = (len+1) >> 2;
-	if( mis1 + mis2 > max_mismatch_dynamic )
-		return false;
-
-	return true;
-}
-
-bool inline is_revcomp( const char a, const char b ) {
-	switch( a ) {
-		case 'A': return b=='T';
-		case 'C': return b=='G';
-		case 'G': return b=='C';
-		case 'T': return b=='A';
-		default : return false;
-	}
-}
-
-unsigned int load_read_batch_gz( gzFile &gfp, char * gz_buffer, string *id, string *seq, string *qual ) {
-	unsigned int loaded = 0;
-	for( ; loaded!=READS_PER_BATCH; ++loaded ) {
-		if( gzgets( gfp, gz_buffer, MAX_SEQNAME_SIZE ) == NULL ) break;
-		id [ loaded ] = gz_buffer;
-		gzgets( gfp, gz_buffer, MAX_SEQNAME_SIZE );
-		seq [ loaded ] = gz_buffer;
-		gzgets( gfp, gz_buffer, MAX_SEQNAME_SIZE );	// this line is useless
-		gzgets( gfp, gz_buffer, MAX_SEQNAME_SIZE );
-		qual[ loaded ] = gz_buffer;
-
-		id [ loaded ].pop_back();	// trim the tail '\n'
-		seq[ loaded ].pop_back();
-		if( qual[loaded].size() != seq[loaded].size() )	//the last read may not contain '\n' for quality line
-			qual[loaded].pop_back();
-	}
-	return loaded;
-}
-
-unsigned int load_read_batch( ifstream &fq, string *id, string *seq, string *qual ) {
-	unsigned int loaded = 0;
-	for( ; loaded!=READS_PER_BATCH; ++loaded ) {
-		getline( fq, id  [ loaded ] );
-		if( fq.eof() )break;
-		getline( fq, seq [ loaded ] );
-		getline( fq, qual[ loaded ] );	// this line is useless
-		getline( fq, qual[ loaded ] );
-	}
-	return loaded;
-}
-
 int main( int argc, const char *argv[] ) {
 	if( argc < 5 ) {
 		cerr << "\nUsage: " << argv[0] << " <r1.fq> <r2.fq> <cycle> <out.prefix> "
 			 << "[mode] [thread] [min.length] [min.quality] [library] "
-			 << "[cut.head.r1] [cut.tail.r1] [cut.head.r2] [cut.tail.r2]\n\n"
+			 << "[cut.head.r1] [cut.tail.r1] [cut.head.r2] [cut.tail.r2] [max.mem] [qual.side] [compact.names] [collapse.dup]\n\n"
 
 			 << "This program is part of Msuite and is designed to do fastq statistics, quality-trimming,\n"
 			 << "adapter-trimming and C->T/G->A conversions for Paired-End reads generated by illumina sequencers.\n\n"
@@ -139,7 +59,9 @@ int main( int argc, const char *argv[] ) {
 
 			 << "Default parameters:\n"
 			 << "  mode: 0 (could be 0,3,4)\n"
-			 << "  thread: 8 (requires >=4)\n"
+			 << "  thread: 8 (requires >=2)\n"
+			 << "    gzipped files are decompressed by extra thread/4 threads per file (BGZF in parallel)\n"
+			 << "    multiple files are loaded " << MAX_LANES << " at a time and share these threads\n"
 			 << "  min.length: 36\n"
 			 << "  min.quality: 53 (33+20 for phred33('!', or '#') scoring system)\n"
 			 << "    Phred33 to Phred64 conversion is automatically ON if min.quality >= 74\n"
@@ -147,7 +69,14 @@ int main( int argc, const char *argv[] ) {
 			 << "  cut.head.r1: 0\n"
 			 << "  cut.tail.r1: 0\n"
 			 << "  cut.head.r2: 0\n"
-			 << "  cut.tail.r2: 0\n\n";
+			 << "  cut.tail.r2: 0\n"
+			 << "  max.mem: 0 (memory budget in MB for buffering reads, 0 for no limit)\n"
+			 << "  qual.side: 0 (set to 1 to write FASTA reads to out.prefix.R1/R2.fa and the qualities to\n"
+			 << "    out.prefix.qual for T2C; mode 3 and 4 only)\n"
+			 << "  compact.names: 0 (set to 1 to replace the read names by short keys and write the names\n"
+			 << "    to out.prefix.names for rmdup/tag)\n"
+			 << "  collapse.dup: 0 (set to 1 to write only the first copy of identical reads and the numbers of\n"
+			 << "    copies to out.prefix.dup for T2C/rmdup; mode 3 and 4 only)\n\n";
 
 		return 2;
 	}
@@ -158,6 +87,10 @@ int main( int argc, const char *argv[] ) {
 	char quality = 53;
 	const char *libraryKit = "illumina";
 	int cut_head_r1=0, cut_tail_r1=0, cut_head_r2=0, cut_tail_r2=0;
+	unsigned int max_mem = 0;
+	bool qual_side = false;
+	bool compact_names = false;
+	bool collapse_dup = false;
 	const adapter_info* ai;
 	unsigned int cycle = atoi( argv[3] );
 	if( cycle == 0 ) {
@@ -182,6 +115,17 @@ int main( int argc, const char *argv[] ) {
 									cut_head_r2 = atoi( argv[12] );
 									if( argc > 13 ) {
 										cut_tail_r2 = atoi( argv[13] );
+										if( argc > 14 ) {
+											max_mem = atoi( argv[14] );
+											if( argc > 15 ) {
+												qual_side = ( atoi(argv[15]) != 0 );
+												if( argc > 16 ) {
+													compact_names = ( atoi(argv[16]) != 0 );
+													if( argc > 17 )
+														collapse_dup = ( atoi(argv[17]) != 0 );
+												}
+											}
+										}
 									}
 								}
 							}
@@ -196,15 +140,26 @@ int main( int argc, const char *argv[] ) {
 		cerr << "Error: invalid run mode! Must be 0, 3, or 4!\n";
 		return 100;
 	}
+	if( qual_side && mode == 0 ) {
+		cerr << "Error: quality side channel is only available in mode 3 and 4!\n";
+		return 100;
+	}
+	if( collapse_dup && mode == 0 ) {
+		cerr << "Error: duplicate collapsing is only available in mode 3 and 4!\n";
+		return 100;
+	}
 	if( thread == 0 ) {
 		cerr << "Warning: thread is set to 0! I will use all threads instead.\n";
 		thread = omp_get_max_threads();
 	}
-	if( thread < 4 ) {
-		cerr << "Error: at least 4 threads are required!\n";
+	if( thread < 2 ) {
+		cerr << "Error: at least 2 threads are required!\n";
 		return 103;
 	}
-	unsigned int real_wk_thread = thread - 2;	// reserve 2 threads for file loading
+	unsigned int real_wk_thread = thread - 2;	// reserve 2 threads for file loading; they also process the reads when idle
+	unsigned int gz_thread = thread >> 2;	// extra threads to decompress EACH gzipped file
+	if( gz_thread == 0 )
+		gz_thread = 1;
 	if( min_length == 0 ) {
 		cerr << "Error: invalid min_length! Must be a positive number!\n";
 		return 101;
@@ -223,71 +178,27 @@ int main( int argc, const char *argv[] ) {
 		cerr << "Error: invalid library kit! Currently only supports illumina, nextera, and bgi!\n";
 		return 103;
 	}
+	adapter_init( ai );
 
 	bool changePhred = false;
 	if( quality >= 74 ) {	// consider it is Phred 64, otherwise it means Phred>=40 which is impossible
 		changePhred = true;
 	}
 
-// read buffer a
-	string *rba_id1   = new string [READS_PER_BATCH];
-	string *rba_id2   = new string [READS_PER_BATCH];
-	string *rba_seq1  = new string [READS_PER_BATCH];
-	string *rba_seq2  = new string [READS_PER_BATCH];
-	string *rba_qual1 = new string [READS_PER_BATCH];
-	string *rba_qual2 = new string [READS_PER_BATCH];
-// read buffer b
-	string *rbb_id1   = new string [READS_PER_BATCH];
-	string *rbb_id2   = new string [READS_PER_BATCH];
-	string *rbb_seq1  = new string [READS_PER_BATCH];
-	string *rbb_seq2  = new string [READS_PER_BATCH];
-	string *rbb_qual1 = new string [READS_PER_BATCH];
-	string *rbb_qual2 = new string [READS_PER_BATCH];
-	
-	// working buffer
-	string *id1, *id2, *seq1, *seq2, *qual1, *qual2;
-	// loading buffer
-	string *ld_id1, *ld_id2, *ld_seq1, *ld_seq2, *ld_qual1, *ld_qual2;
-
-	int *dropped	  = new int [real_wk_thread];
-	int *real_adapter = new int [real_wk_thread];
-	int *tail_adapter = new int [real_wk_thread];
-
-	fastqstat * AllR1stat = new fastqstat[ cycle ];
-	memset( AllR1stat, 0, cycle*sizeof(fastqstat) );
-	fastqstat * AllR2stat = new fastqstat[ cycle ];
-	memset( AllR2stat, 0, cycle*sizeof(fastqstat) );
-
-	fastqstat * AllR1stat_trimmed = new fastqstat[ cycle ];
-	memset( AllR1stat_trimmed, 0, cycle*sizeof(fastqstat) );
-	fastqstat * AllR2stat_trimmed = new fastqstat[ cycle ];
-	memset( AllR2stat_trimmed, 0, cycle*sizeof(fastqstat) );
-
-	// buffer for storing the modified reads per thread
-	char ** buffer1 = new char * [real_wk_thread];
-	char ** buffer2 = new char * [real_wk_thread];
-	int  * b1stored = new int    [real_wk_thread];
-	int  * b2stored = new int    [real_wk_thread];
-	fastqstat **R1stat = new fastqstat * [real_wk_thread];
-	fastqstat **R2stat = new fastqstat * [real_wk_thread];
-	// new in v2: report the fqstat after trimming
-	fastqstat **R1stat_trimmed = new fastqstat * [real_wk_thread];
-	fastqstat **R2stat_trimmed = new fastqstat * [real_wk_thread];
-
-	for(unsigned int i=0; i!=real_wk_thread; ++i) {
-		buffer1[i] = new char[ BUFFER_SIZE_PER_BATCH_READ ];
-		buffer2[i] = new char[ BUFFER_SIZE_PER_BATCH_READ ];
-
-		R1stat[i]  = new fastqstat [ cycle ];
-		R2stat[i]  = new fastqstat [ cycle ];
-
-		R1stat_trimmed[i]  = new fastqstat [ cycle ];
-		R2stat_trimmed[i]  = new fastqstat [ cycle ];
-
-		dropped[i] = 0;
-		real_adapter[i] = 0;
-		tail_adapter[i] = 0;
-	}
+	// the per-read engine specialized for this run
+	trim_param tp;
+	tp.cycle = cycle;
+	tp.min_length = min_length;
+	tp.min_quality = quality;
+	tp.cut_head[0] = cut_head_r1;
+	tp.cut_tail[0] = cut_tail_r1;
+	tp.cut_head[1] = cut_head_r2;
+	tp.cut_tail[1] = cut_tail_r2;
+	tp.max_log = MAX_CONVERTED_READ_ID;
+	tp.qual_side = qual_side;
+	tp.compact_names = compact_names;
+	tp.collapse_dup = collapse_dup;
+	chunk_kernel kernel = trim_kernel( true, mode, changePhred, ai );
 
 	cerr << "Loading files ...\n";
 	// deal with multiple input files
@@ -322,548 +233,134 @@ int main( int argc, const char *argv[] ) {
 	cout << "INFO: " << totalFiles << " paired fastq files will be loaded.\n";
 
 	string base = argv[4];
-	ofstream fout1( (base+".R1.fq").c_str() );
-	ofstream fout2( (base+".R2.fq").c_str() );
-	if( fout1.fail() || fout2.fail() ) {
-		cout << "Error: write file failed!\n";
-		fout1.close();
-		fout2.close();
-		return 3;
+	string outfile[ MAX_OUTPUT_FILE ] = { base+".R1.fq", base+".R2.fq" };
+	unsigned int side_bytes[ MAX_OUTPUT_FILE ];	// for the side files after R1 and R2
+	unsigned int nout = 2;
+	if( qual_side ) {
+		outfile[0] = base + ".R1.fa";
+		outfile[1] = base + ".R2.fa";
+		outfile[nout] = base + ".qual";
+		side_bytes[nout-2] = cycle << 1;
+		++ nout;
 	}
-
-	ifstream fq1, fq2;
-	gzFile gfp1, gfp2;
-	gz_buffer_1 = new char [ MAX_SEQNAME_SIZE ];
-	gz_buffer_2 = new char [ MAX_SEQNAME_SIZE ];
-	register int totalReads = 0;
-	for( int fileCnt=0; fileCnt!=totalFiles; ++ fileCnt ) {
-		bool file_is_gz = false;
-		register int i_file = R1s[fileCnt].size() - 3;
-		register const char * p_file = R1s[fileCnt].c_str();
-		if( p_file[i_file]=='.' && p_file[i_file+1]=='g' && p_file[i_file+2]=='z' ) {	// .gz file
-			file_is_gz = true;
-			gfp1 = gzopen( p_file, "r" );
-			gfp2 = gzopen( R2s[fileCnt].c_str(), "r" );
-			if( gfp1==NULL || gfp2==NULL ) {
-				cerr << "Error: open fastq file failed!\n";
-				fout1.close();
-				fout2.close();
-				return 11;
-			}
-		} else {	// plain text
-			file_is_gz = false;
-			fq1.open( R1s[fileCnt] );
-			fq2.open( R2s[fileCnt] );
-			if( fq1.fail() || fq2.fail() ) {
-				cerr << "Error: open fastq file failed!\n";
-				fout1.close();
-				fout2.close();
-				return 11;
-			}
+	unsigned int name_out = nout;
+	if( compact_names ) {
+		outfile[nout] = base + ".names";
+		side_bytes[nout-2] = NAME_BYTES_PER_READ;
+		++ nout;
+	}
+	// the pool holds enough chunks to keep all the workers busy, unless limited by the memory budget
+	unsigned int nchunk = chunks_in_budget( 2, nout, side_bytes, READS_PER_CHUNK, cycle, max_mem, (real_wk_thread<<1)+4 );
+	dupset dups;	// the reads written so far, if duplicates are collapsed; it takes the rest of the budget
+	if( collapse_dup )
+		dupset_init( dups, budget_left(2, nout, side_bytes, READS_PER_CHUNK, cycle, max_mem, nchunk) );
+	ordered_writer writer;
+	writer_open( writer, 2, nout, outfile, side_bytes, nchunk, READS_PER_CHUNK, cycle, collapse_dup ? &dups : NULL );
+	chunkqueue relay;	// chunks with read1 loaded, waiting for read2
+	workpool work;		// chunks waiting for the workers
+	cq_init( relay );
+	work_init( work, writer, kernel, tp );
+	uint64_t chunk_seq = 0;	// updated by the read1 loader only
+	uint64_t totalReads = 0;
+
+	// several lanes are read at the same time, and the decompression threads are shared among them
+	lanesched lanes;
+	unsigned int nlane = lanes_init( lanes, totalFiles, MAX_LANES );
+	unsigned int lane_gz_thread = gz_thread / nlane;
+	if( lane_gz_thread == 0 )
+		lane_gz_thread = 1;
+	if( nlane > 1 )
+		cout << "INFO: " << nlane << " lanes will be loaded at the same time.\n";
+	fqstream *fs1 = new fqstream [ totalFiles ];
+	fqstream *fs2 = new fqstream [ totalFiles ];	// opened by the read1 loader, closed by the read2 loader
+
+	// the pipeline: 2 threads load read1 and read2, the others process the chunks as they come
+	// the loaders turn into workers at the end of the input
+	// the roles are taken from the team that is really started, which may be smaller than requested
+	omp_set_dynamic( 0 );
+	omp_set_num_threads( thread );
+	#pragma omp parallel
+	{
+		unsigned int tn = omp_get_thread_num();
+		unsigned int team = omp_get_num_threads();
+		if( team < 2 ) {
+			cerr << "Error: at least 2 threads are required, but only " << team << " could be started!\n";
+			exit(103);
 		}
-		// load the first batch of reads
-		unsigned int loaded = 0;
-		unsigned int loaded_2 = 0;
 
-		omp_set_num_threads( 2 );
-		#pragma omp parallel
-		{
-			unsigned int tn = omp_get_thread_num();
-			if( tn == 0 ) {
-				if( file_is_gz ) {
-					loaded = load_read_batch_gz( gfp1, gz_buffer_1, rba_id1, rba_seq1, rba_qual1 );
-				} else {
-					loaded = load_read_batch( fq1, rba_id1, rba_seq1, rba_qual1 );
-				}
-			} else {
-				if( file_is_gz ) {
-					loaded_2 = load_read_batch_gz( gfp2, gz_buffer_2, rba_id2, rba_seq2, rba_qual2 );
-				} else {
-					loaded_2 = load_read_batch( fq2, rba_id2, rba_seq2, rba_qual2 );
+		if( tn == team - 2 ) {	// loading read1 from the lanes in turn, an empty chunk marks the end of each lane
+			for( unsigned int k=0; k!=nlane; ++k ) {
+				if( ! fq_open(fs1[k], R1s[k].c_str(), lane_gz_thread) ||
+						! fq_open(fs2[k], R2s[k].c_str(), lane_gz_thread) ) {
+					cerr << "Error: open fastq file failed!\n";
+					exit(11);
 				}
 			}
-		}
-		if( loaded != loaded_2 ) {
-			cerr << "Error: unequal read number in R1 and R2!\n";
-			exit(1);
-		}
-		id1=rba_id1; id2=rba_id2; seq1=rba_seq1; seq2=rba_seq2; qual1=rba_qual1; qual2=rba_qual2;
-		ld_id1=rbb_id1; ld_id2=rbb_id2; ld_seq1=rbb_seq1; ld_seq2=rbb_seq2; ld_qual1=rbb_qual1; ld_qual2=rbb_qual2;
-
-		// load and process reads
-		while( loaded ) {
-			unsigned int loaded_batch = 0;
-			//TODO: use 2 threads to load data
-			unsigned int loaded_2_batch = 0;
-			unsigned int write_thread = 0;
-
-			omp_set_num_threads( thread );
-			#pragma omp parallel
-			{
-				unsigned int tn = omp_get_thread_num();
-
-				// reserve the last 2 threads for loading files
-				if( tn == thread - 2 ) {
-					if( file_is_gz ) {
-						loaded_batch = load_read_batch_gz( gfp1, gz_buffer_1, ld_id1, ld_seq1, ld_qual1 );
-					} else {
-						loaded_batch = load_read_batch( fq1, ld_id1, ld_seq1, ld_qual1 );
-					}
-				} else if( tn == thread - 1 ) {
-					if( file_is_gz ) {
-						loaded_2_batch = load_read_batch_gz( gfp2, gz_buffer_2, ld_id2, ld_seq2, ld_qual2 );
-					} else {
-						loaded_2_batch = load_read_batch( fq2, ld_id2, ld_seq2, ld_qual2 );
-					}
+			while( lanes_left(lanes) ) {
+				unsigned int fileCnt = lanes_current( lanes );
+				outchunk *c = loader_get_chunk( work );
+				c->file = fileCnt;
+				if( fq_load_block(fs1[fileCnt], c->in[0]) ) {
+					c->seq.store( chunk_seq ++ );
+					totalReads += c->in[0].num;
+					if( totalReads % READS_PER_BATCH < c->in[0].num )
+						cerr << '\r' << totalReads << " reads loaded";
+					cq_push( relay, c );
+					lanes_next( lanes );
 				} else {
-					unsigned int start = loaded * tn / real_wk_thread;
-					unsigned int end   = loaded * (tn+1) / real_wk_thread;
-//					cerr << "Thread " << tn << ": analyze " << start << " - " << end << "\n";
-
-					// normalization
-					b1stored[tn] = 0;
-					b2stored[tn] = 0;
-					memset( R1stat[tn], 0, cycle*sizeof(fastqstat) );
-					memset( R2stat[tn], 0, cycle*sizeof(fastqstat) );
-					memset( R1stat_trimmed[tn], 0, cycle*sizeof(fastqstat) );
-					memset( R2stat_trimmed[tn], 0, cycle*sizeof(fastqstat) );
-
-					string conversionLog1, conversionLog2;
-					register int i, j;
-					register int last_seed;
-					vector<int> seed;
-					vector<int> :: iterator it;
-					const char *p, *q;
-					char *conversion = new char [MAX_CONVERSION];
-					char numstr[10]; // enough to hold all numbers up to 99,999,999 plus ':'
-
-					for( register int ii=start; ii!=end; ++ii ) {
-						// check R1/R2 cycles
-						if( seq2[ii].size() != seq1[ii].size() ) {
-							if( seq2[ii].size() > seq1[ii].size() ) {
-								seq2[ii].resize(  seq1[ii].size()  );
-								qual2[ii].resize( qual1[ii].size() );
-							} else {
-								seq1[ii].resize(  seq2[ii].size()  );
-								qual1[ii].resize( qual2[ii].size() );
-							}
-						}
-
-						//if the reads are longer than "cycle" paramater, only keep the head "cycle" ones
-						if( seq1[ii].size() > cycle ) {
-							seq1[ii].resize(  cycle );
-							qual1[ii].resize( cycle );
-							seq2[ii].resize(  cycle );
-							qual2[ii].resize( cycle );
-						}
-
-						// raw fqstatistics
-						p = seq1[ii].c_str();
-						q = seq2[ii].c_str();
-
-						j = seq1[ii].size();
-						for( i=0; i!=j; ++i ) {
-							switch ( p[i] ) {
-								case 'a':
-								case 'A': R1stat[tn][i].A ++; break;
-								case 'c':
-								case 'C': R1stat[tn][i].C ++; break;
-								case 'g':
-								case 'G': R1stat[tn][i].G ++; break;
-								case 't':
-								case 'T': R1stat[tn][i].T ++; break;
-								default : R1stat[tn][i].N ++; break;
-							}
-						}
-						j = seq2[ii].size();
-						for( i=0; i!=j; ++i ) {
-							switch ( q[i] ) {
-								case 'a':
-								case 'A': R2stat[tn][i].A ++; break;
-								case 'c':
-								case 'C': R2stat[tn][i].C ++; break;
-								case 'g':
-								case 'G': R2stat[tn][i].G ++; break;
-								case 't':
-								case 'T': R2stat[tn][i].T ++; break;
-								default : R2stat[tn][i].N ++; break;
-							}
-						}
-
-						// quality control
-						p = qual1[ii].c_str();
-						q = qual2[ii].c_str();
-						i = get_quality_trim_cycle_pe( p, q, qual1[ii].size(), min_length, quality );
-
-						if( i < min_length ) { // not long enough
-							++ dropped[ tn ];
-							continue;
-						}
-						seq1[ii].resize(  i );
-						seq2[ii].resize(  i );
-						qual1[ii].resize( i );
-						qual2[ii].resize( i );
-						if( changePhred ) {
-							for( j=0; j!=i; ++j ) {
-								qual1[ii][j] -= 31;
-								qual2[ii][j] -= 31;
-							}
-						}
-
-						// looking for seed target, 1 mismatch is allowed for these 2 seeds
-						// which means seq1 and seq2 at least should take 1 perfect seed match
-						seed.clear();
-						for( i=0; (i=seq1[ii].find(ai->adapter_index, i)) != string::npos; ++i )
-							seed.push_back( i );
-						for( i=0; (i=seq2[ii].find(ai->adapter_index, i)) != string::npos; ++i )
-							seed.push_back( i );
-
-						sort( seed.begin(), seed.end() );
-
-						last_seed = impossible_seed;	// a position which cannot be in seed
-						for( it=seed.begin(); it!=seed.end(); ++it ) {
-							if( *it != last_seed ) {
-							// as there maybe the same value in seq1_seed and seq2_seed,
-							// use this to avoid re-calculate that pos
-								if( check_mismatch_dynamic_PE( seq1[ii], seq2[ii], *it, ai) )
-									break;
-								last_seed = *it;
-							}
-						}
-
-						if( it != seed.end() ) {	// adapter found
-							++ real_adapter[tn];
-							if( *it >= min_length )	{
-								seq1[ii].resize(  *it );
-								seq2[ii].resize(  *it );
-								qual1[ii].resize( *it );
-								qual2[ii].resize( *it );
-							} else {	// drop this read as its length is not enough
-								++ dropped[tn];
-								continue;
-							}
-						} else {	// seed not found, now check the tail, if perfect match, trim the tail
-							i = seq1[ii].length() - 2;
-							p = seq1[ii].c_str();
-							q = seq2[ii].c_str();
-							if( p[i]==ai->adapter_r1[0] && p[i+1]==ai->adapter_r1[1] &&
-										q[i]==ai->adapter_r2[0] && q[i+1]==ai->adapter_r2[1] ) {
-								// if it is a real adapter, then Read1 and Read2 should be complimentary
-								// in real data, the heading 5 bp are usually of poor quality, therefore we test the 6th, 7th
-								if( is_revcomp(p[5], q[i-6]) && is_revcomp(q[5], p[i-6]) ) {
-									if( i < min_length ) {
-										++ dropped[tn];
-										continue;
-									}
-									seq1[ii].resize( i );
-									seq2[ii].resize( i );
-									qual1[ii].resize( i );
-									qual2[ii].resize( i );
-
-									++ tail_adapter[tn];
-								}
-							} else {	// tail 2 is not good, check tail 1
-								++ i;
-								if( p[i] == ai->adapter_r1[0] && q[i] == ai->adapter_r2[0] ) {
-									if(is_revcomp(p[5], q[i-6]) && is_revcomp(q[5], p[i-6]) &&
-											is_revcomp(p[6], q[i-7]) && is_revcomp(q[6], p[i-7]) ) {
-										if( i < min_length ) {
-											++ dropped[tn];
-											continue;
-										}
-										seq1[ii].resize(  i );
-										seq2[ii].resize(  i );
-										qual1[ii].resize( i );
-										qual2[ii].resize( i );
-
-										++ tail_adapter[tn];
-									}
-								}
-							}
-						}
-
-						// cut head and tail
-						if( cut_head_r1 ) {
-							seq1[ii].erase(  0, cut_head_r1 );
-							qual1[ii].erase( 0, cut_head_r1 );
-						}
-						if( cut_tail_r1 ) {
-							seq1[ii].resize(  seq1[ii].length()  - cut_tail_r1 );
-							qual1[ii].resize( qual1[ii].length() - cut_tail_r1 );
-						}
-
-						if( seq1[ii].length() < min_length ) {
-							++ dropped[tn];
-							continue;
-						}
-
-						if( cut_head_r2 ) {
-							seq2[ii].erase(  0, cut_head_r2 );
-							qual2[ii].erase( 0, cut_head_r2 );
-						}
-						if( cut_tail_r2 ) {
-							seq2[ii].resize(  seq2[ii].length()  - cut_tail_r2 );
-							qual2[ii].resize( qual2[ii].length() - cut_tail_r2 );
-						}
-
-						//fqstatistics after trimming
-						p = seq1[ii].c_str();
-						q = seq2[ii].c_str();
-						j = seq1[ii].size();
-						for( i=0; i!=j; ++i ) {
-							switch ( p[i] ) {
-								case 'a':
-								case 'A': R1stat_trimmed[tn][i].A ++; break;
-								case 'c':
-								case 'C': R1stat_trimmed[tn][i].C ++; break;
-								case 'g':
-								case 'G': R1stat_trimmed[tn][i].G ++; break;
-								case 't':
-								case 'T': R1stat_trimmed[tn][i].T ++; break;
-								default : R1stat_trimmed[tn][i].N ++; break;
-							}
-						}
-						j = seq2[ii].size();
-						for( i=0; i!=j; ++i ) {
-							switch ( q[i] ) {
-								case 'a':
-								case 'A': R2stat_trimmed[tn][i].A ++; break;
-								case 'c':
-								case 'C': R2stat_trimmed[tn][i].C ++; break;
-								case 'g':
-								case 'G': R2stat_trimmed[tn][i].G ++; break;
-								case 't':
-								case 'T': R2stat_trimmed[tn][i].T ++; break;
-								default : R2stat_trimmed[tn][i].N ++; break;
-							}
-						}
-
-						//check if there is any white space in the IDs; if so, remove all the data after the whitespace
-						j = id1[ii].size();
-						p = id1[ii].c_str();
-						for( i=1; i!=j; ++i ) {
-							if( p[i]==' ' || p[i]=='\t' ) {	// white space, then trim ID
-								id1[ii].resize( i );
-								break;
-							}
-						}
-						j = id2[ii].size();
-						q = id2[ii].c_str();
-						for( i=0; i!=j; ++i ) {
-							if( q[i]==' ' || q[i]=='\t' ) {	// white space, then trim ID
-								id2[ii].resize( i );
-								break;
-							}
-						}
-
-						// do C->T and G->A conversion
-						if( mode == 3 ) {	// in the current implementation, id1 and id2 are different!!!
-							// in mode 3, there is NO endC and frontG issues
-							id1[ii][0] = CONVERSION_LOG_END;
-							j = seq1[ii].size();	// seq1 and seq2 are of the same size
-							conversionLog1 = NORMAL_SEQNAME_START;
-							for( i=0; i!=j; ++i ) {
-								if( seq1[ii][i] == 'C' ) {
-									seq1[ii][i] = 'T';
-									sprintf( numstr, "%x%c", i, CONVERSION_LOG_SEPARATOR );
-									conversionLog1 += numstr;
-								}
-							}
-							if( conversionLog1.back() == CONVERSION_LOG_SEPARATOR )
-								conversionLog1.pop_back();
-
-							if( conversionLog1.length() > MAX_CONVERTED_READ_ID ) {
-								//cerr << "LONG read ID!\n";
-								++ dropped[tn];
-								continue;
-							}
-							/*fout1 << NORMAL_SEQNAME_START << line << conversionLog << id1 << '\n'
-									<< seq1 << "\n+\n" << qual1 << '\n';*/
-
-							id2[ii][0] = CONVERSION_LOG_END;
-							conversionLog2 = NORMAL_SEQNAME_START;	// read2 does not record line number
-							for( i=0; i!=j; ++i ) {
-								if( seq2[ii][i] == 'G' ) {
-									seq2[ii][i] = 'A';
-									sprintf( numstr, "%x%c", i, CONVERSION_LOG_SEPARATOR );
-									conversionLog2 += numstr;
-								}
-							}
-							if( conversionLog2.back() == CONVERSION_LOG_SEPARATOR )
-								conversionLog2.pop_back();
-
-							if( conversionLog2.length() > MAX_CONVERTED_READ_ID ) {
-								//cerr << "LONG read ID!\n";
-								++ dropped[tn];
-								continue;
-							}
-
-							b1stored[tn] += sprintf( buffer1[tn]+b1stored[tn], "%s%s\n%s\n+\n%s\n",
-													conversionLog1.c_str(), id1[ii].c_str(), seq1[ii].c_str(), qual1[ii].c_str() );
-							b2stored[tn] += sprintf( buffer2[tn]+b2stored[tn], "%s%s\n%s\n+\n%s\n",
-													conversionLog2.c_str(), id2[ii].c_str(), seq2[ii].c_str(), qual2[ii].c_str() );
-						} else if ( mode == 4 ) {	// this is the major task for EMaligner
-							// modify id1 to add line number (to facilitate the removing ambigous step)
-							// check seq1 for C>T conversion
-							id1[ii][0] = CONVERSION_LOG_END;
-							conversionLog1 = NORMAL_SEQNAME_START;
-							j = seq1[ii].size()-1;
-							if( seq1[ii].back() == 'C' ) { //ther is a 'C' and the end, discard it (but record its Quality score);
-								//otherwise it may introduce a mismatch in alignment
-								if( qual1[ii].back() == '@' ) {
-									conversionLog1 += REPLACEMENT_CHAR_AT;
-								} else {
-									conversionLog1 += qual1[ii].back();
-								}
-								conversionLog1 += KEEP_QUAL_MARKER;
-								seq1[ii].pop_back();
-								qual1[ii].pop_back();
-							}
-							for( i=0; i!=j; ++i ) {
-								if( seq1[ii][i]=='C' && seq1[ii][i+1]=='G' ) {
-									seq1[ii][i] = 'T';
-									sprintf( numstr, "%x%c", i, CONVERSION_LOG_SEPARATOR );
-									conversionLog1 += numstr;
-								}
-							}
-							if( conversionLog1.back() == CONVERSION_LOG_SEPARATOR )
-								conversionLog1.pop_back();
-
-							if( conversionLog1.length() > MAX_CONVERTED_READ_ID ) {
-								//cerr << "LONG read ID!\n";
-								++ dropped[tn];
-								continue;
-							}
-
-							// format for ID1:
-							// if there is a C at the end
-							//	@ x | C1;C2;C3# raw_seq_name
-							//	the | is the marker for the existence of tail 'C' and 'x' is its quality score
-							//	if exists, | is ALWAYS two bytes after '+' (use this to test its existence)
-							// if there is No C at the end
-							//	@C1;C2;C3# raw_seq_name
-							//
-							// All the numbers in line_number and C1,C2,C3... are HEX
-
-							// check seq2 for G>A conversion
-							id2[ii][0] = CONVERSION_LOG_END;
-							conversionLog2 = NORMAL_SEQNAME_START;
-							if( seq2[ii][0] == 'G' ) { //'G' at the front, discard it (but record its Quality score)
-								if( qual2[ii][0] == '@' ) {
-									conversionLog2 += REPLACEMENT_CHAR_AT;
-								} else {
-									conversionLog2 += qual2[ii][0];
-								}
-								conversionLog2 += KEEP_QUAL_MARKER;
-							}
-							j = seq2[ii].size();
-							for( i=1; i!=j; ++i ) {
-								if( seq2[ii][i]=='G' && seq2[ii][i-1]=='C' ) {
-									seq2[ii][i] = 'A';
-									sprintf( numstr, "%x%c", i, CONVERSION_LOG_SEPARATOR );
-									conversionLog2 += numstr;
-								}
-							}
-							if( conversionLog2.back() == CONVERSION_LOG_SEPARATOR )
-								conversionLog2.pop_back();
-
-							if( conversionLog2.length() > MAX_CONVERTED_READ_ID ) {
-								//cerr << "LONG read ID!\n";
-								++ dropped[tn];
-								continue;
-							}
-
-							b1stored[tn] += sprintf( buffer1[tn]+b1stored[tn], "%s%s\n%s\n+\n%s\n",
-										conversionLog1.c_str(), id1[ii].c_str(), seq1[ii].c_str(), qual1[ii].c_str() );
-
-							if( seq2[ii][0] != 'G' ) {
-								b2stored[tn] += sprintf( buffer2[tn]+b2stored[tn], "%s%s\n%s\n+\n%s\n",
-														conversionLog2.c_str(), id2[ii].c_str(), seq2[ii].c_str(), qual2[ii].c_str() );
-							} else {
-								p = seq2[ii].c_str();
-								q = qual2[ii].c_str();
-								b2stored[tn] += sprintf( buffer2[tn]+b2stored[tn], "%s%s\n%s\n+\n%s\n",
-														conversionLog2.c_str(), id2[ii].c_str(), p+1, q+1 );
-							}
-						} else {	// mode 0: no need to do conversion
-							b1stored[tn] += sprintf( buffer1[tn]+b1stored[tn], "%s\n%s\n+\n%s\n",
-										id1[ii].c_str(), seq1[ii].c_str(), qual1[ii].c_str() );
-							b2stored[tn] += sprintf( buffer2[tn]+b2stored[tn], "%s\n%s\n+\n%s\n",
-										id2[ii].c_str(), seq2[ii].c_str(), qual2[ii].c_str() );
+					cq_push( relay, c );
+					fq_close( fs1[fileCnt] );
+					int next = lanes_end( lanes );
+					if( next >= 0 ) {
+						if( ! fq_open(fs1[next], R1s[next].c_str(), lane_gz_thread) ||
+								! fq_open(fs2[next], R2s[next].c_str(), lane_gz_thread) ) {
+							cerr << "Error: open fastq file failed!\n";
+							exit(11);
 						}
 					}
-
-					//wait for my turn to output
-					while( true ) {
-						if( tn == write_thread ) {
-							// output to stdout for pipe with aligners?
-							fout1 << buffer1[tn];
-							fout2 << buffer2[tn];
-
-							for( register int j=0; j!=cycle; ++j ) {
-								AllR1stat[j].A += R1stat[tn][j].A;
-								AllR1stat[j].C += R1stat[tn][j].C;
-								AllR1stat[j].G += R1stat[tn][j].G;
-								AllR1stat[j].T += R1stat[tn][j].T;
-								AllR1stat[j].N += R1stat[tn][j].N;
-
-								AllR2stat[j].A += R2stat[tn][j].A;
-								AllR2stat[j].C += R2stat[tn][j].C;
-								AllR2stat[j].G += R2stat[tn][j].G;
-								AllR2stat[j].T += R2stat[tn][j].T;
-								AllR2stat[j].N += R2stat[tn][j].N;
-
-								AllR1stat_trimmed[j].A += R1stat_trimmed[tn][j].A;
-								AllR1stat_trimmed[j].C += R1stat_trimmed[tn][j].C;
-								AllR1stat_trimmed[j].G += R1stat_trimmed[tn][j].G;
-								AllR1stat_trimmed[j].T += R1stat_trimmed[tn][j].T;
-								AllR1stat_trimmed[j].N += R1stat_trimmed[tn][j].N;
-
-								AllR2stat_trimmed[j].A += R2stat_trimmed[tn][j].A;
-								AllR2stat_trimmed[j].C += R2stat_trimmed[tn][j].C;
-								AllR2stat_trimmed[j].G += R2stat_trimmed[tn][j].G;
-								AllR2stat_trimmed[j].T += R2stat_trimmed[tn][j].T;
-								AllR2stat_trimmed[j].N += R2stat_trimmed[tn][j].N;
-							}
-							++ write_thread;
-							break;
-						} else {
-							this_thread::sleep_for( waiting_time_for_writing );
-						}
-					}
-				}	// parallel body per batch
+				}
 			}
-			totalReads += loaded;
-			cerr << '\r' << totalReads << " reads loaded";
-
-			if( loaded_batch != loaded_2_batch ) {	// error happens
-				cerr << "ERROR in loading file (" << loaded_batch << " vs " << loaded_2_batch << ")!\n";
-				exit(10);
+			cq_close( relay );
+			work_loop( work );
+		} else if( tn == team - 1 ) {	// loading read2 into the chunks from read1 loader
+			outchunk *c;
+			while( (c=loader_pop(work, relay)) != NULL ) {
+				unsigned int loaded_2 = fq_load_block( fs2[c->file], c->in[1] );
+				if( loaded_2 != c->in[0].num ) {	// error happens
+					cerr << "ERROR in loading file (" << c->in[0].num << " vs " << loaded_2 << ")!\n";
+					exit(10);
+				}
+				if( loaded_2 == 0 ) {	// end of this lane
+					fq_close( fs2[c->file] );
+					writer_recycle( writer, c );
+					continue;
+				}
+				cq_push( work.jobs, c );
 			}
-			loaded = loaded_batch;
-				
-			// swap work and load buffers
-			string *tmp;
-			tmp=id1;   id1=ld_id1;     ld_id1=tmp;
-			tmp=seq1;  seq1=ld_seq1;   ld_seq1=tmp;
-			tmp=qual1; qual1=ld_qual1; ld_qual1=tmp;
-			tmp=id2;   id2=ld_id2;     ld_id2=tmp;
-			tmp=seq2;  seq2=ld_seq2;   ld_seq2=tmp;
-			tmp=qual2; qual2=ld_qual2; ld_qual2=tmp;
-		}//process file
-
-		if( file_is_gz ) {
-			gzclose( gfp1 );
-			gzclose( gfp2 );
-		} else {
-			fq1.close();
-			fq2.close();
+			cq_close( work.jobs );
+			work_loop( work );
+		} else {	// workers
+			work_loop( work );
 		}
-	}// process file list
+	}
 
-	fout1.close();
-	fout2.close();
+	writer_close( writer, chunk_seq );
+	delete [] fs1;
+	delete [] fs2;
+	if( qual_side && ! qualside_write_index(outfile[2]+".idx", cycle, 2, writer.chunk_reads) ) {
+		cerr << "Error: write file failed!\n";
+		exit(3);
+	}
+	if( compact_names && ! namedict_write_index(outfile[name_out]+".idx", writer.chunk_bytes[name_out]) ) {
+		cerr << "Error: write file failed!\n";
+		exit(3);
+	}
+	if( collapse_dup && ! dupset_write(dups, base+".dup") ) {
+		cerr << "Error: write file failed!\n";
+		exit(3);
+	}
 	cerr << "\rDone: totally " << totalReads << " lines processed.\n";
+	cout << "INFO: peak memory usage " << peak_rss() << " MB.\n";
 
 	// write trim.log
 	ofstream fout( "Msuite2.trim.log" );
@@ -871,98 +368,47 @@ int main( int argc, const char *argv[] ) {
 		cerr << "Error: cannot write log file!\n";
 		return 4;
 	}
-	int dropped_all=0, real_all=0, tail_all=0;
-	for( unsigned int i=0; i!=real_wk_thread; ++i ) {
-		dropped_all += dropped[i];
-		real_all += real_adapter[i];
-		tail_all += tail_adapter[i];
-	}
+	uint64_t dropped_all = writer.dropped;
+	uint64_t real_all    = writer.real_adapter;
+	uint64_t tail_all    = writer.tail_adapter;
 	fout << "Total\t"		<< totalReads	<< '\n'
 		 << "Dropped\t"		<< dropped_all	<< '\n'
 		 << "Aadaptor\t"	<< real_all		<< '\n'
 		 << "Tail Hit\t"	<< tail_all		<< '\n';
+	if( collapse_dup )	// not sent to the aligner, counted as duplicates by rmdup
+		fout << "Collapsed\t"	<< dups.collapsed	<< '\n';
+	// time (in seconds, summed over the threads) each stage waits with nothing to do
+	fout << fixed << setprecision(3)
+		 << "Loader stall\t"	<< work.loader_stall / 1e6	<< '\n'
+		 << "Relay stall\t"	<< work.relay_stall / 1e6	<< '\n'
+		 << "Worker stall\t"	<< work.worker_stall / 1e6	<< '\n'
+		 << "Writer stall\t"	<< writer.stall / 1e6		<< '\n'
+		 << "Loader jobs\t"		<< work.loader_jobs			<< '\n'
+		 << "Worker inflates\t"	<< work.worker_inflates		<< '\n';
 	fout.close();
 
 	// write fqstatistics
-	fout.open( "R1.fqstat" );
-	if( fout.fail() ) {
-		cerr << "Error: cannot write R1.fqstat file!\n";
-		return 5;
-	}
-	fout << "Cycle\tA\tC\tG\tT\tN\n";
-	for( unsigned int j=0; j!=cycle; ++j ) {
-		fout << j+1 << '\t' << AllR1stat[j].A << '\t' << AllR1stat[j].C << '\t'<< AllR1stat[j].G
-				<< '\t' << AllR1stat[j].T << '\t'<< AllR1stat[j].N << '\n';
-	}
-	fout.close();
-
-	fout.open( "R2.fqstat" );
-	if( fout.fail() ) {
-		cerr << "Error: cannot write R2.fqstat file!\n";
-		return 5;
-	}
-	fout << "Cycle\tA\tC\tG\tT\tN\n";
-	for( unsigned int j=0; j!=cycle; ++j ) {
-		fout << j+1 << '\t' << AllR2stat[j].A << '\t' << AllR2stat[j].C << '\t'<< AllR2stat[j].G
-				<< '\t' << AllR2stat[j].T << '\t'<< AllR2stat[j].N << '\n';
-	}
-	fout.close();
-
-	fout.open( "R1.trimmed.fqstat" );
-	if( fout.fail() ) {
-		cerr << "Error: cannot write R1.trimmed.fqstat file!\n";
-		return 5;
-	}
-	fout << "Cycle\tA\tC\tG\tT\tN\n";
-	for( unsigned int j=0; j!=cycle; ++j ) {
-		fout << j+1 << '\t' << AllR1stat_trimmed[j].A << '\t' << AllR1stat_trimmed[j].C << '\t'<< AllR1stat_trimmed[j].G
-				<< '\t' << AllR1stat_trimmed[j].T << '\t'<< AllR1stat_trimmed[j].N << '\n';
-	}
-	fout.close();
-
-	fout.open( "R2.trimmed.fqstat" );
-	if( fout.fail() ) {
-		cerr << "Error: cannot write R2.trimmed.fqstat file!\n";
-		return 5;
-	}
-	fout << "Cycle\tA\tC\tG\tT\tN\n";
-	for( unsigned int j=0; j!=cycle; ++j ) {
-		fout << j+1 << '\t' << AllR2stat_trimmed[j].A << '\t' << AllR2stat_trimmed[j].C << '\t'<< AllR2stat_trimmed[j].G
-				<< '\t' << AllR2stat_trimmed[j].T << '\t'<< AllR2stat_trimmed[j].N << '\n';
+	const char *statfile[4] = { "R1.fqstat", "R2.fqstat", "R1.trimmed.fqstat", "R2.trimmed.fqstat" };
+	fastqstat *AllR1stat = writer.stat[0];
+	fastqstat *AllR2stat = writer.stat[1];
+	fastqstat *AllR1stat_trimmed = writer.stat_trimmed[0];
+	fastqstat *AllR2stat_trimmed = writer.stat_trimmed[1];
+	fastqstat *allstat[4] = { AllR1stat, AllR2stat, AllR1stat_trimmed, AllR2stat_trimmed };
+	for( unsigned int k=0; k!=4; ++k ) {
+		if( ! fqstat_write(statfile[k], allstat[k], cycle) ) {
+			cerr << "Error: cannot write " << statfile[k] << " file!\n";
+			return 5;
+		}
 	}
-	fout.close();
 
 	//free memory
-	delete [] gz_buffer_1;
-	delete [] gz_buffer_2;
-	for(unsigned int i=0; i!=real_wk_thread; ++i) {
-		delete buffer1[i];
-		delete buffer2[i];
-		delete R1stat[i];
-		delete R2stat[i];
-	}
-	delete [] buffer1;
-	delete [] buffer2;
-	delete [] R1stat;
-	delete [] R2stat;
+	if( collapse_dup )
+		dupset_free( dups );
 	delete [] AllR1stat;
 	delete [] AllR2stat;
 	delete [] AllR1stat_trimmed;
 	delete [] AllR2stat_trimmed;
 	
-	delete [] rba_id1;
-	delete [] rba_id2;
-	delete [] rba_seq1;
-	delete [] rba_seq2;
-	delete [] rba_qual1;
-	delete [] rba_qual2;
-
-	delete [] rbb_id1;
-	delete [] rbb_id2;
-	delete [] rbb_seq1;
-	delete [] rbb_seq2;
-	delete [] rbb_qual1;
-	delete [] rbb_qual2;
 
 	return 0;
 }
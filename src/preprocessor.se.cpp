@@ -2,24 +2,27 @@
 #include <fstream>
 #include <string>
 #include <algorithm>
+#include <iomanip>
 #include <vector>
 #include <stdio.h>
 #include <stdlib.h>
 #include <memory.h>
 #include <omp.h>
 #include <zlib.h>
-#include <chrono>
-#include <thread>
 #include "common.h"
 #include "util.h"
+#include "fqreader.h"
+#include "pipeline.h"
+#include "adapter.h"
+#include "trimmer.h"
+#include "qualside.h"
+#include "namedict.h"
+#include "dupset.h"
 
 using namespace std;
 
 // hisat2 supports 256 character long of read id, and does not has --sam-no-qname-trunc option
 const unsigned int MAX_CONVERTED_READ_ID = 256;
-const static chrono::microseconds waiting_time_for_writing(100);
-char * gz_buffer = NULL;
-string unk;
 
 /**
  * Author: Kun Sun (sunkun@szbl.ac.cn)
@@ -33,75 +36,10 @@ string unk;
  *
 **/
 
-/*
- * use dynamic max_mismatch as the covered size can range from 3 to a large number such as 50,
- * so use static values (e.g., 4) is not good
-*/
-bool check_mismatch_dynamic_SE( const string & s, unsigned int pos, const adapter_info* ai ) {
-	register unsigned int mis=0;
-	register unsigned int i, len;
-	len = s.length() - pos;
-	if( len > ai->adapter_len )
-	  len = ai->adapter_len;
-	register unsigned int max_mismatch_dynamic = len >> 3;
-	if( (max_mismatch_dynamic<<3) != len )
-	  ++ max_mismatch_dynamic;
-	const char * p = s.c_str();
-	for( i=0; i!=len; ++i ) {
-		if( p[pos+i] != ai->adapter_r1[i] ) {
-			++ mis;
-			if( mis > max_mismatch_dynamic )
-			  return false;
-		}
-	}
-
-	return true;
-}
-
-unsigned int load_text_file(ifstream & fq, string *ld_id, string *ld_seq, string *ld_qual) {
-	unsigned int loaded = 0;
-	while( true ) {
-		getline( fq, ld_id  [ loaded ] );
-		if( fq.eof() )break;
-		getline( fq, ld_seq [ loaded ] );
-		getline( fq, unk );
-		getline( fq, ld_qual[ loaded ] );
-
-		++ loaded;
-		if( loaded == READS_PER_BATCH )
-			break;
-	}
-	return loaded;
-}
-
-unsigned int load_gz_file(gzFile & gfp, string *ld_id, string *ld_seq, string *ld_qual) {
-	unsigned int loaded = 0;
-	while( true ) {
-		if( gzgets( gfp, gz_buffer, MAX_SEQNAME_SIZE ) == NULL ) break;
-		ld_id  [ loaded ] = gz_buffer;
-		gzgets( gfp, gz_buffer, MAX_SEQNAME_SIZE );
-		ld_seq [ loaded ] = gz_buffer;
-		gzgets( gfp, gz_buffer, MAX_SEQNAME_SIZE );	// this line is useless
-		gzgets( gfp, gz_buffer, MAX_SEQNAME_SIZE );
-		ld_qual[ loaded ] = gz_buffer;
-
-		ld_id [ loaded ].pop_back();	// trim the tail '\n'
-		ld_seq[ loaded ].pop_back();
-		if( ld_qual[loaded].size() != ld_seq[loaded].size() )	//the last read may not contain '\n'
-			ld_qual[loaded].pop_back();
-
-		++ loaded;
-		if( loaded == READS_PER_BATCH )
-			break;
-	}
-
-	return loaded;
-}
-
 int main( int argc, char *argv[] ) {
 	if( argc < 5 ) {
 		cerr << "\nUsage: " << argv[0] << " <r1.fq> <r2.fq=placeholder> <cycle> <out.prefix> "
-			 << "[mode=0|3|4] [thread=4] [min.length=36] [min.quality=53] [libraryKit=illumina] [cut.head=0] [cut.tail=0]\n\n"
+			 << "[mode=0|3|4] [thread=4] [min.length=36] [min.quality=53] [libraryKit=illumina] [cut.head=0] [cut.tail=0] [max.mem=0] [qual.side=0] [compact.names=0]\n\n"
 
 			 << "This program is part of Msuite and is designed to do fastq statistics, quality-trimming,\n"
 			 << "adapter-trimming and C->T conversions for Single-End reads.\n\n"
@@ -113,10 +51,19 @@ int main( int argc, char *argv[] ) {
 
 			 << "Default parameters:\n"
 			 << "  mode: 0\n"
-			 << "  thread: 4 (must be >=2)\n"
+			 << "  thread: 4 (must be >=1)\n"
+			 << "    gzipped files are decompressed by extra thread/2 threads (BGZF in parallel)\n"
+			 << "    multiple files are loaded " << MAX_LANES << " at a time and share these threads\n"
 			 << "  min.length: 36\n"
 			 << "  min.quality: 53 (33+20 for phred33('!') scoring system)\n"
-			 << "    Phred64 to Phred33 conversion is automatically ON if min.quality >= 74\n\n";
+			 << "    Phred64 to Phred33 conversion is automatically ON if min.quality >= 74\n"
+			 << "  max.mem: 0 (memory budget in MB for buffering reads, 0 for no limit)\n"
+			 << "  qual.side: 0 (set to 1 to write FASTA reads to out.prefix.R1.fa and the qualities to\n"
+			 << "    out.prefix.qual for T2C; mode 3 and 4 only)\n"
+			 << "  compact.names: 0 (set to 1 to replace the read names by short keys and write the names\n"
+			 << "    to out.prefix.names for rmdup/tag)\n"
+			 << "  collapse.dup: 0 (set to 1 to write only the first copy of identical reads and the numbers of\n"
+			 << "    copies to out.prefix.dup for T2C/rmdup; mode 3 and 4 only)\n\n";
 
 		return 2;
 	}
@@ -131,6 +78,10 @@ int main( int argc, char *argv[] ) {
 	const adapter_info* ai;
 	unsigned int cut_head = 0;
 	unsigned int cut_tail = 0;
+	unsigned int max_mem = 0;	// memory budget in MB for buffering reads, 0 for no limit
+	bool qual_side = false;		// qualities are sent to a side file instead of the aligner
+	bool compact_names = false;	// read names are replaced by their keys in the name dictionary
+	bool collapse_dup = false;	// only the first copy of identical reads is sent to the aligner
 
 	unsigned int cycle = atoi( argv[3] );
 	if( cycle == 0 ) {
@@ -149,8 +100,20 @@ int main( int argc, char *argv[] ) {
 						libraryKit = argv[9];
 						if( argc > 10 ) {
 							cut_head = (unsigned char) atoi( argv[10] );
-							if( argc > 11 )
+							if( argc > 11 ) {
 								cut_tail = (unsigned char) atoi( argv[11] );
+								if( argc > 12 ) {
+									max_mem = atoi( argv[12] );
+									if( argc > 13 ) {
+										qual_side = ( atoi(argv[13]) != 0 );
+										if( argc > 14 ) {
+											compact_names = ( atoi(argv[14]) != 0 );
+											if( argc > 15 )
+												collapse_dup = ( atoi(argv[15]) != 0 );
+										}
+									}
+								}
+							}
 						}
 					}
 				}
@@ -162,15 +125,20 @@ int main( int argc, char *argv[] ) {
 		cerr << "Error: invalid run mode! Must be 0, 3, or 4!\n";
 		return 100;
 	}
+	if( qual_side && mode == 0 ) {
+		cerr << "Error: quality side channel is only available in mode 3 and 4!\n";
+		return 100;
+	}
+	if( collapse_dup && mode == 0 ) {
+		cerr << "Error: duplicate collapsing is only available in mode 3 and 4!\n";
+		return 100;
+	}
 	if( thread == 0 ) {
 		cerr << "Warning: thread is set to 0! I will use all threads instead.\n";
 		thread = omp_get_max_threads();
 	}
-	if( thread < 2 ) {
-		cerr << "Error: thread must be >=2!\n";
-		return 103;
-	}
-	unsigned int real_wk_thread = thread - 1;
+	unsigned int real_wk_thread = thread - 1;	// the loader also processes the reads when idle
+	unsigned int gz_thread = thread >> 1;	// extra threads to decompress gzipped files
 	if( min_length == 0 ) {
 		cerr << "Error: invalid min_length! Must be a positive number!\n";
 		return 101;
@@ -189,54 +157,27 @@ int main( int argc, char *argv[] ) {
 		cerr << "Error: invalid library kit! Currently only supports illumina, nextera, and bgi!\n";
 		return 103;
 	}
+	adapter_init( ai );
 
 	bool changePhred = false;
 	if( quality >= 74 ) {   // consider it is Phred 64, otherwise it means Phred>=40 which is impossible
 		changePhred = true;
 	}
 
-	string base = argv[4];
-	base += ".R1.fq";
-	ofstream fout( base.c_str() );
-	if( fout.fail() ) {
-		cerr << "Error: write file failed!\n";
-		return 3;
-	}
-
-	string *id_buffer1   = new string [READS_PER_BATCH];
-	string *seq_buffer1  = new string [READS_PER_BATCH];
-	string *qual_buffer1 = new string [READS_PER_BATCH];
-
-	string *id_buffer2   = new string [READS_PER_BATCH];
-	string *seq_buffer2  = new string [READS_PER_BATCH];
-	string *qual_buffer2 = new string [READS_PER_BATCH];
-	string unk;
-	string *id, *seq, *qual;	// these are for processing
-	string *ld_id, *ld_seq, *ld_qual;	//these are for loading
-
-	register unsigned int line = 1;
-	int *dropped	  = new int [thread];
-	int *real_adapter = new int [thread];
-	int *tail_adapter = new int [thread];
-
-	fastqstat * Allstat = new fastqstat[ cycle ];
-	memset( Allstat, 0, cycle*sizeof(fastqstat) );
-	fastqstat * Allstat_trimmed = new fastqstat[ cycle ];
-	memset( Allstat_trimmed, 0, cycle*sizeof(fastqstat) );
-
-	// buffer for storing the modified reads per thread
-	char ** buffer = new char *[thread];
-	int  * bstored = new int   [thread];
-	fastqstat **Rstat = new fastqstat * [thread];
-	fastqstat **Rstat_trimmed = new fastqstat * [thread];
-	for(unsigned int i=0; i!=thread; ++i) {
-		buffer[i] = new char[ BUFFER_SIZE_PER_BATCH_READ ];
-		Rstat[i]  = new fastqstat [ cycle ];
-		Rstat_trimmed[i]  = new fastqstat [ cycle ];
-		dropped[i] = 0;
-		real_adapter[i] = 0;
-		tail_adapter[i] = 0;
-	}
+	// the per-read engine specialized for this run
+	trim_param tp;
+	tp.cycle = cycle;
+	tp.min_length = min_length;
+	tp.min_quality = quality;
+	tp.cut_head[0] = cut_head;
+	tp.cut_tail[0] = cut_tail;
+	tp.cut_head[1] = 0;
+	tp.cut_tail[1] = 0;
+	tp.max_log = MAX_CONVERTED_READ_ID;
+	tp.qual_side = qual_side;
+	tp.compact_names = compact_names;
+	tp.collapse_dup = collapse_dup;
+	chunk_kernel kernel = trim_kernel( false, mode, changePhred, ai );
 
 	cerr << "Loading files ...\n";
 	vector<string> Rs;
@@ -253,404 +194,151 @@ int main( int argc, char *argv[] ) {
 	unsigned int totalFiles = Rs.size();
 	cout << "INFO: " << totalFiles << " singled fastq files will be loaded.\n";
 
-	ifstream fq;
-	gzFile gfp;
-	gz_buffer = new char [ MAX_SEQNAME_SIZE ];
-	register unsigned int totalReads = 0;
-	for( unsigned int fileCnt=0; fileCnt!=totalFiles; ++ fileCnt ) {
-		bool file_is_gz = false;
-		register unsigned int i_file = Rs[fileCnt].size() - 3;
-		register const char * p_file = Rs[fileCnt].c_str();
-		if( p_file[i_file]=='.' && p_file[i_file+1]=='g' && p_file[i_file+2]=='z' ) {	// .gz file
-			file_is_gz = true;
-			gfp = gzopen( p_file, "r" );
-			if( gfp==NULL ) {
-				cerr << "Error: open gzipped fastq file failed!\n";
-				fout.close();
-				return 11;
-			}
-		} else {	// plain text
-			file_is_gz = false;
-			fq.open( Rs[fileCnt].c_str() );
-			if( fq.fail() ) {
-				cerr << "Error: open fastq file failed!\n";
-				fout.close();
-				return 11;
+	string base = argv[4];
+	string outfile[ MAX_OUTPUT_FILE ] = { base+".R1.fq" };
+	unsigned int side_bytes[ MAX_OUTPUT_FILE ];	// for the side files after R1
+	unsigned int nout = 1;
+	if( qual_side ) {
+		outfile[0] = base + ".R1.fa";
+		outfile[nout] = base + ".qual";
+		side_bytes[nout-1] = cycle;
+		++ nout;
+	}
+	unsigned int name_out = nout;
+	if( compact_names ) {
+		outfile[nout] = base + ".names";
+		side_bytes[nout-1] = NAME_BYTES_PER_READ;
+		++ nout;
+	}
+	// the pool holds enough chunks to keep all the workers busy, unless limited by the memory budget
+	unsigned int nchunk = chunks_in_budget( 1, nout, side_bytes, READS_PER_CHUNK, cycle, max_mem, (real_wk_thread<<1)+2 );
+	dupset dups;	// the reads written so far, if duplicates are collapsed; it takes the rest of the budget
+	if( collapse_dup )
+		dupset_init( dups, budget_left(1, nout, side_bytes, READS_PER_CHUNK, cycle, max_mem, nchunk) );
+	ordered_writer writer;
+	writer_open( writer, 1, nout, outfile, side_bytes, nchunk, READS_PER_CHUNK, cycle, collapse_dup ? &dups : NULL );
+	workpool work;		// chunks waiting for the workers
+	work_init( work, writer, kernel, tp );
+	uint64_t chunk_seq = 0;	// updated by the loader only
+	uint64_t totalReads = 0;
+
+	// several lanes are read at the same time, and the decompression threads are shared among them
+	lanesched lanes;
+	unsigned int nlane = lanes_init( lanes, totalFiles, MAX_LANES );
+	unsigned int lane_gz_thread = gz_thread / nlane;
+	if( lane_gz_thread == 0 )
+		lane_gz_thread = 1;
+	if( nlane > 1 )
+		cout << "INFO: " << nlane << " lanes will be loaded at the same time.\n";
+
+	// the pipeline: the last thread loads the reads, the others process the chunks as they come
+	// the loader is taken from the team that is really started, which may be smaller than requested
+	omp_set_dynamic( 0 );
+	omp_set_num_threads( thread );
+	#pragma omp parallel
+	{
+		unsigned int tn = omp_get_thread_num();
+		unsigned int team = omp_get_num_threads();
+		if( tn == team - 1 )	{	// the last thread is for loading data from the lanes in turn
+			fqstream *fs = new fqstream [ totalFiles ];
+			vector<bool> loaded( totalFiles, false );
+			for( unsigned int k=0; k!=nlane; ++k ) {
+				if( ! fq_open(fs[k], Rs[k].c_str(), lane_gz_thread) ) {
+					cerr << "Error: open fastq file failed!\n";
+					exit(11);
+				}
 			}
-		}
-
-		// load first batch of data
-		unsigned int loaded;
-		id = id_buffer1;  seq = seq_buffer1; qual = qual_buffer1;
-		ld_id = id_buffer2; ld_seq = seq_buffer2; ld_qual = qual_buffer2;
-		if( file_is_gz ) {
-			loaded = load_gz_file( gfp, id, seq, qual );
-		} else {
-			loaded = load_text_file( fq, id, seq, qual );
-		}
-		if( loaded == 0 ) {
-			cerr << "Error: No data loaded!\n";
-			exit(1);
-//		} else {
-//			cerr << "Info: start, " << loaded << " lines loaded.\n";
-		}
-
-		// load and process reads, batch by batch
-		while( loaded ) {
-			unsigned int loaded_batch = 0;
-			unsigned int write_thread = 0;
-
-			// start parallalization
-			omp_set_num_threads( thread );
-			#pragma omp parallel
-			{
-				unsigned int tn = omp_get_thread_num();
-				if( tn == real_wk_thread )	{	// the last thread is for loading data
-					if( file_is_gz ) {
-						loaded_batch = load_gz_file( gfp, ld_id, ld_seq, ld_qual );
-					} else {
-						loaded_batch = load_text_file( fq, ld_id, ld_seq, ld_qual );
-					}
-//					cerr << "Info: " << loaded_batch << " lines loaded.\n";
-				} else {
-					unsigned int tn = omp_get_thread_num();
-					unsigned int start = loaded * tn / real_wk_thread;
-					unsigned int end   = loaded * (tn+1) / real_wk_thread;
-
-					// normalization
-					bstored[tn] = 0;
-					memset( Rstat[tn], 0, cycle*sizeof(fastqstat) );
-					memset( Rstat_trimmed[tn], 0, cycle*sizeof(fastqstat) );
-
-					string conversionLog;
-					register int i, j;
-					register unsigned int last_seed;
-					vector<unsigned int> seed;
-					vector<unsigned int> :: iterator it;
-					const char *p;
-					char *conversion = new char [MAX_CONVERSION];
-					char numstr[10]; // enough to hold all numbers up to 99,999,999 plus ':'
-
-					for( unsigned int ii=start; ii!=end; ++ii ) {
-						//if the reads are longer than "cycle" paramater, only keep the head "cycle" ones
-						if( seq[ii].size() > cycle ) {
-							seq[ii].resize(  cycle );
-							qual[ii].resize( cycle );
-						}
-
-						// fqstatistics
-						p = seq[ii].c_str();
-						j = seq[ii].size();
-						for( i=0; i!=j; ++i ) {
-							switch ( p[i] ) {
-								case 'a':
-								case 'A': Rstat[tn][i].A ++; break;
-								case 'c':
-								case 'C': Rstat[tn][i].C ++; break;
-								case 'g':
-								case 'G': Rstat[tn][i].G ++; break;
-								case 't':
-								case 'T': Rstat[tn][i].T ++; break;
-								default : Rstat[tn][i].N ++; break;
-							}
-						}
-
-						// quality control
-						p = qual[ii].c_str();
-						i = get_quality_trim_cycle_se( p, qual[ii].length(), min_length, quality );
-						if( i < min_length ) { // not long enough
-							++ dropped[ tn ];
-							continue;
-						}
-
-						seq[ii].resize(  i );
-						qual[ii].resize( i );
-
-						// looking for seed target, 1 mismatch is allowed for these 2 seeds
-						// which means seq1 and seq2 at least should take 1 perfect seed match
-						seed.clear();
-						for( i=0; (i=seq[ii].find(ai->adapter_index, i)) != string::npos; ++i )
-							seed.push_back( i );
-
-						last_seed = impossible_seed;	// a position which cannot be in seed
-						for( it=seed.begin(); it!=seed.end(); ++it ) {
-							if( *it != last_seed ) {
-								if( check_mismatch_dynamic_SE(seq[ii], *it, ai) )
-									break;
-								last_seed = *it;
-							}
-						}
-						if( it != seed.end() ) {	// adapter found
-							++ real_adapter[tn];
-							if( *it >= min_length )	{
-								seq[ii].resize(  *it );
-								qual[ii].resize( *it );
-							} else {	// drop this read as its length is not enough
-								++ dropped[tn];
-								continue;
-							}
-						} else {	// seed not found, now check the tail 2 or 1, if perfect match, drop these 2
-							i = seq[ii].length() - 2;
-							p = seq[ii].c_str();
-							if( p[i]==ai->adapter_r1[0] && p[i+1]==ai->adapter_r1[1] ) {
-								if( i < min_length ) {
-									++ dropped[tn];
-									continue;
-								}
-								seq[ii].resize(  i );
-								qual[ii].resize( i );
-
-								++ tail_adapter[tn];
-	/* it is not good to check tail-1 due to high false-positive
-							} else {	// tail 2 is not good, check tail 1
-								++ i;
-								if( p[i] == ai->adapter_r1[0] ) {
-									if( i < min_length ) {
-										++ dropped[tn];
-										continue;
-									}
-									seq1[ii].resize(  i );
-									qual1[ii].resize( i );
-
-									++ tail_adapter[tn];
-								}
-	*/
-							}
-						}
-
-						// cut head and tail
-						if( cut_tail ) { 
-							if( seq[ii].length() > cut_tail ) {
-								seq[ii].resize(  seq[ii].length()  - cut_tail );
-								qual[ii].resize( qual[ii].length() - cut_tail );
-							} else {
-								++ dropped[tn];
-								continue;
-							}
-						}
-						// cut head
-						if( cut_head ) {
-							if( seq[ii].length() > cut_head ) {
-								seq[ii].erase(  0, cut_head );
-								qual[ii].erase( 0, cut_head );
-							} else {
-								++ dropped[tn];
-								continue;
-							}
-						}
-
-						if( seq[ii].length() < min_length ) {
-							++ dropped[tn];
-							continue;
-						}
-
-						j = seq[ii].size();
-						// convert Phred64 to Phred33 if necessary
-						if( changePhred ) {
-							for( i=0; i!=j; ++i ) {
-								qual[ii][i] -= 31;
-							}
-						}
-
-						p = seq[ii].c_str();
-						for( i=0; i!=j; ++i ) {
-							switch ( p[i] ) {
-								case 'a':
-								case 'A': Rstat_trimmed[tn][i].A ++; break;
-								case 'c':
-								case 'C': Rstat_trimmed[tn][i].C ++; break;
-								case 'g':
-								case 'G': Rstat_trimmed[tn][i].G ++; break;
-								case 't':
-								case 'T': Rstat_trimmed[tn][i].T ++; break;
-								default : Rstat_trimmed[tn][i].N ++; break;
-							}
-						}
-
-						//check if there is any white space in the IDs
-						//if so, remove all the data after the whitespace
-						j = id[ii].size();
-						p = id[ii].c_str();
-						for( i=1; i!=j; ++i ) {
-							if( p[i]==' ' || p[i]=='\t' ) {	// white space
-								id[ii].resize( i );
-								break;
-							}
-						}
-
-						// do C->T conversion
-						if( mode == 3 ) {	// in this implementation, id1 and id2 are different!!!
-							// in mode 3, there is NO endC and frontG issues
-							id[ii][0] = CONVERSION_LOG_END;
-							j = seq[ii].size();	// seq1 and seq2 are of the same size
-							conversionLog = NORMAL_SEQNAME_START;
-							for( i=0; i!=j; ++i ) {
-								if( seq[ii][i] == 'C' ) {
-									seq[ii][i] = 'T';
-									sprintf( numstr, "%x%c", i, CONVERSION_LOG_SEPARATOR );
-									conversionLog += numstr;
-								}
-							}
-							if( conversionLog.back() == CONVERSION_LOG_SEPARATOR )
-								conversionLog.pop_back();
-
-							if( conversionLog.length() > MAX_CONVERTED_READ_ID ) {
-								++ dropped[tn];
-								continue;
-							}
-
-							bstored[tn] += sprintf( buffer[tn]+bstored[tn], "%s%s\n%s\n+\n%s\n",
-												conversionLog.c_str(), id[ii].c_str(), seq[ii].c_str(), qual[ii].c_str() );
-						} else if ( mode == 4 ) {
-							// check seq1 for C>T conversion
-							id[ii][0] = CONVERSION_LOG_END;
-							conversionLog = NORMAL_SEQNAME_START;
-							j = seq[ii].size()-1;
-							if( seq[ii].back() == 'C' ) { //ther is a 'C' and the end, discard it (but record its Quality score);
-								//otherwise it may introduce a mismatch in alignment
-								if( qual[ii].back() == '@' ) {
-									conversionLog += REPLACEMENT_CHAR_AT;
-								} else {
-									conversionLog += qual[ii].back();
-								}
-								conversionLog += KEEP_QUAL_MARKER;
-								seq[ii].pop_back();
-								qual[ii].pop_back();
-							}
-							for( i=0; i!=j; ++i ) {
-								if( seq[ii][i]=='C' && seq[ii][i+1]=='G' ) {
-									seq[ii][i] = 'T';
-									sprintf( numstr, "%x%c", i, CONVERSION_LOG_SEPARATOR );
-									conversionLog += numstr;
-								}
-							}
-							if( conversionLog.back() == CONVERSION_LOG_SEPARATOR )
-								conversionLog.pop_back();
-
-							if( conversionLog.length() > MAX_CONVERTED_READ_ID ) {
-								++ dropped[tn];
-								continue;
-							}
-
-							bstored[tn] += sprintf( buffer[tn]+bstored[tn], "%s%s\n%s\n+\n%s\n",
-										conversionLog.c_str(), id[ii].c_str(), seq[ii].c_str(), qual[ii].c_str() );
-						} else {	// no need to do conversion
-							bstored[tn] += sprintf( buffer[tn]+bstored[tn], "%s\n%s\n+\n%s\n",
-										id[ii].c_str(), seq[ii].c_str(), qual[ii].c_str() );
-						}
+			while( lanes_left(lanes) ) {
+				unsigned int fileCnt = lanes_current( lanes );
+				outchunk *c = loader_get_chunk( work );
+				c->file = fileCnt;
+				if( fq_load_block(fs[fileCnt], c->in[0]) == 0 ) {	// end of this lane
+					if( ! loaded[fileCnt] ) {
+						cerr << "Error: No data loaded!\n";
+						exit(1);
 					}
-
-					// wait for my turn to output and update statistics
-					while( true ) {
-						if( tn == write_thread ) {// output to stdout for pipe with aligners?
-							fout << buffer[tn];
-							++ write_thread;
-
-							for( unsigned int j=0; j!=cycle; ++j ) {
-								Allstat[j].A += Rstat[tn][j].A;
-								Allstat[j].C += Rstat[tn][j].C;
-								Allstat[j].G += Rstat[tn][j].G;
-								Allstat[j].T += Rstat[tn][j].T;
-								Allstat[j].N += Rstat[tn][j].N;
-
-								Allstat_trimmed[j].A += Rstat_trimmed[tn][j].A;
-								Allstat_trimmed[j].C += Rstat_trimmed[tn][j].C;
-								Allstat_trimmed[j].G += Rstat_trimmed[tn][j].G;
-								Allstat_trimmed[j].T += Rstat_trimmed[tn][j].T;
-								Allstat_trimmed[j].N += Rstat_trimmed[tn][j].N;
-							}
-							break;
-						} else {
-							this_thread::sleep_for( waiting_time_for_writing );
-						}
+					writer_recycle( writer, c );
+					fq_close( fs[fileCnt] );
+					int next = lanes_end( lanes );
+					if( next >= 0 && ! fq_open(fs[next], Rs[next].c_str(), lane_gz_thread) ) {
+						cerr << "Error: open fastq file failed!\n";
+						exit(11);
 					}
-				}	// parallel body for each batch
-
-
+					continue;
+				}
+				loaded[fileCnt] = true;
+				c->seq.store( chunk_seq ++ );
+				totalReads += c->in[0].num;
+				if( totalReads % READS_PER_BATCH < c->in[0].num )
+					cerr << '\r' << totalReads << " reads finished";
+				cq_push( work.jobs, c );
+				lanes_next( lanes );
 			}
-			totalReads += loaded;
-			cerr << '\r' << totalReads << " reads finished";
-
-			loaded = loaded_batch;
-			//swap id and ld_id
-			string *tmp;
-			tmp=id;   id=ld_id;     ld_id=tmp;
-			tmp=seq;  seq=ld_seq;   ld_seq=tmp;
-			tmp=qual; qual=ld_qual; ld_qual=tmp;
-		} // loop for current file
-		// close file
-		if( file_is_gz ) {
-			gzclose( gfp );
-		} else {
-			fq.close();
+			delete [] fs;
+			cq_close( work.jobs );
+			work_loop( work );	// then help the workers to finish
+		} else {	// workers
+			work_loop( work );
 		}
-	}//loop for all files
+	}
+
+	writer_close( writer, chunk_seq );
+	if( qual_side && ! qualside_write_index(outfile[1]+".idx", cycle, 1, writer.chunk_reads) ) {
+		cerr << "Error: write file failed!\n";
+		exit(3);
+	}
+	if( compact_names && ! namedict_write_index(outfile[name_out]+".idx", writer.chunk_bytes[name_out]) ) {
+		cerr << "Error: write file failed!\n";
+		exit(3);
+	}
+	if( collapse_dup && ! dupset_write(dups, base+".dup") ) {
+		cerr << "Error: write file failed!\n";
+		exit(3);
+	}
 	cerr << "\rDone: " << totalReads << " lines processed.\n";
-	fout.close();
+	cout << "INFO: peak memory usage " << peak_rss() << " MB.\n";
 
 	// write trim.log
-	fout.open( "Msuite2.trim.log" );
+	ofstream fout( "Msuite2.trim.log" );
 	if( fout.fail() ) { 
 		cerr << "Error: cannot write log file!\n";
 		return 4;
 	}
-	int dropped_all=0, real_all=0, tail_all=0;
-	for( unsigned int i=0; i!=real_wk_thread; ++i ) {
-		dropped_all += dropped[i];
-		real_all += real_adapter[i];
-		tail_all += tail_adapter[i];
-	}
+	uint64_t dropped_all = writer.dropped;
+	uint64_t real_all    = writer.real_adapter;
+	uint64_t tail_all    = writer.tail_adapter;
 	fout << "Total\t"	 << totalReads	<< '\n'
 		 << "Dropped : " << dropped_all << '\n'
 		 << "Aadaptor: " << real_all	<< '\n'
 		 << "Tail Hit: " << tail_all	<< '\n';
+	if( collapse_dup )	// not sent to the aligner, counted as duplicates by rmdup
+		fout << "Collapsed: " << dups.collapsed	<< '\n';
+	// time (in seconds, summed over the threads) each stage waits with nothing to do
+	fout << fixed << setprecision(3)
+		 << "Loader stall   : " << work.loader_stall / 1e6	<< '\n'
+		 << "Worker stall   : " << work.worker_stall / 1e6	<< '\n'
+		 << "Writer stall   : " << writer.stall / 1e6		<< '\n'
+		 << "Loader jobs    : " << work.loader_jobs			<< '\n'
+		 << "Worker inflates: " << work.worker_inflates		<< '\n';
 	fout.close();
 
 	// write fqstatistics
-	fout.open( "R1.fqstat" );
-	if( fout.fail() ) {
+	fastqstat *Allstat = writer.stat[0];
+	fastqstat *Allstat_trimmed = writer.stat_trimmed[0];
+	if( ! fqstat_write("R1.fqstat", Allstat, cycle) ) {
 		cerr << "Error: cannot write R1.fqstat file!\n";
 		return 5;
 	}
-	fout << "Cycle\tA\tC\tG\tT\tN\n";
-	for( unsigned int j=0; j!=cycle; ++j ) {
-		fout << j+1 << '\t' << Allstat[j].A << '\t' << Allstat[j].C << '\t'<< Allstat[j].G
-				<< '\t' << Allstat[j].T << '\t'<< Allstat[j].N << '\n';
-	}
-	fout.close();
-
-	fout.open( "R1.trimmed.fqstat" );
-	if( fout.fail() ) {
+	if( ! fqstat_write("R1.trimmed.fqstat", Allstat_trimmed, cycle) ) {
 		cerr << "Error: cannot write R1.trimmed.fqstat file!\n";
 		return 5;
 	}
-	fout << "Cycle\tA\tC\tG\tT\tN\n";
-	for( unsigned int j=0; j!=cycle; ++j ) {
-		fout << j+1 << '\t' << Allstat_trimmed[j].A << '\t' << Allstat_trimmed[j].C
-			 << '\t' << Allstat_trimmed[j].G << '\t' << Allstat_trimmed[j].T
-			 << '\t'<< Allstat_trimmed[j].N << '\n';
-	}
-	fout.close();
 
 	//free memory
-	for(unsigned int i=0; i!=thread; ++i) {
-		delete buffer[i];
-		delete Rstat[i];
-	}
-	delete [] buffer;
-	delete [] Rstat;
+	if( collapse_dup )
+		dupset_free( dups );
 	delete [] Allstat;
 	delete [] Allstat_trimmed;
 
-	delete [] id_buffer1;
-	delete [] seq_buffer1;
-	delete [] qual_buffer1;
-	delete [] id_buffer2;
-	delete [] seq_buffer2;
-	delete [] qual_buffer2;
-
-	if( gz_buffer != NULL )
-		delete [] gz_buffer;
-
 	return 0;
 }
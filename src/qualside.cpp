@@ -0,0 +1,117 @@
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "qualside.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+bool qualside_write_index( const string & file, unsigned int stride, unsigned int nmate,
+							const vector<uint32_t> & count ) {
+	FILE *fp = fopen( file.c_str(), "wb" );
+	if( fp == NULL )
+		return false;
+
+	uint32_t hdr[3] = { stride, nmate, (uint32_t)count.size() };
+	bool ok = fwrite( hdr, sizeof(uint32_t), 3, fp ) == 3;
+	if( ok && ! count.empty() )
+		ok = fwrite( count.data(), sizeof(uint32_t), count.size(), fp ) == count.size();
+	return fclose( fp ) == 0 && ok;
+}
+
+// map prefix.qual and load prefix.qual.idx
+bool qualside_open( qualside & qs, const char *prefix ) {
+	string file = prefix;
+	file += ".qual.idx";
+	FILE *fp = fopen( file.c_str(), "rb" );
+	if( fp == NULL ) {
+		cerr << "Error: could not open quality index file '" << file << "'!\n";
+		return false;
+	}
+	uint32_t hdr[3];
+	if( fread(hdr, sizeof(uint32_t), 3, fp) != 3 || hdr[0] == 0 || hdr[1] == 0 ) {
+		cerr << "Error: broken quality index file '" << file << "'!\n";
+		fclose( fp );
+		return false;
+	}
+	qs.stride = hdr[0];
+	qs.nmate  = hdr[1];
+	qs.count.resize( hdr[2] );
+	if( hdr[2] && fread(qs.count.data(), sizeof(uint32_t), hdr[2], fp) != hdr[2] ) {
+		cerr << "Error: broken quality index file '" << file << "'!\n";
+		fclose( fp );
+		return false;
+	}
+	fclose( fp );
+
+	qs.first.resize( hdr[2] );
+	uint64_t total = 0;
+	for( uint32_t i=0; i!=hdr[2]; ++i ) {
+		qs.first[i] = total;
+		total += qs.count[i];
+	}
+
+	file = prefix;
+	file += ".qual";
+	int fd = open( file.c_str(), O_RDONLY );
+	struct stat st;
+	if( fd < 0 || fstat(fd, &st) != 0 ) {
+		cerr << "Error: could not open quality file '" << file << "'!\n";
+		if( fd >= 0 )
+			close( fd );
+		return false;
+	}
+	qs.size = st.st_size;
+	if( qs.size != total * qs.stride * qs.nmate ) {
+		cerr << "Error: quality file '" << file << "' does not match its index!\n";
+		close( fd );
+		return false;
+	}
+	qs.data = NULL;
+	if( qs.size ) {
+		void *p = mmap( NULL, qs.size, PROT_READ, MAP_SHARED, fd, 0 );
+		if( p == MAP_FAILED ) {
+			cerr << "Error: could not map quality file '" << file << "'!\n";
+			close( fd );
+			return false;
+		}
+		qs.data = (const char *) p;
+	}
+	close( fd );	// the mapping is kept
+	return true;
+}
+
+void qualside_close( qualside & qs ) {
+	if( qs.data )
+		munmap( (void *)qs.data, qs.size );
+	qs.data = NULL;
+}
+
+bool qualside_restore( const qualside & qs, uint64_t key, unsigned int mate, char *qual, unsigned int len, bool rev ) {
+	if( len == 1 && qual[0] == '*' )	// SEQ is not stored in this record
+		return true;
+
+	uint64_t chunk = key >> QUAL_KEY_SHIFT;
+	uint32_t index = key & ( (1 << QUAL_KEY_SHIFT) - 1 );
+	if( chunk >= qs.count.size() || index >= qs.count[chunk] || mate >= qs.nmate || len > qs.stride )
+		return false;
+
+	const char *q = qs.data + ( (qs.first[chunk] + index) * qs.nmate + mate ) * qs.stride;
+	if( rev ) {
+		for( register unsigned int i=0; i!=len; ++i )
+			qual[i] = q[ len-1-i ];
+	} else {
+		memcpy( qual, q, len );
+	}
+	return true;
+}
+
@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "common.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Quality side channel between the preprocessors and T2C.
+ * The aligners run with --ignore-quals, so the preprocessors could send FASTA reads to them and keep
+ * the qualities in a side file; T2C then puts the real qualities back into the SAM records. The
+ * reads are named as
+ *   [S|]log#KEY#id
+ * where KEY is (chunk << QUAL_KEY_SHIFT | index of the read in the chunk) in HEX, and the files are
+ *   prefix.qual    : the qualities of the reads in output order, 'stride' bytes per mate (R1 then R2),
+ *                    padded with '\0'
+ *   prefix.qual.idx: uint32 stride, number of mates and number of chunks, then the number of reads
+ *                    written from each chunk
+ * so the position of a read in the side file is found from its KEY without any per-read index.
+*/
+
+#ifndef _MSUITE_QUALSIDE_
+#define _MSUITE_QUALSIDE_
+
+const unsigned int QUAL_KEY_SHIFT = 16;	// at most 1 << 16 reads per chunk, see READS_PER_CHUNK
+const char FASTA_SEQNAME_START = '>';
+
+typedef struct {
+	const char *data;			// the side file, mapped into memory
+	size_t size;
+	unsigned int stride;		// bytes per mate
+	unsigned int nmate;
+	vector<uint64_t> first;		// the first read of each chunk
+	vector<uint32_t> count;		// reads in each chunk
+} qualside;
+
+inline uint64_t qual_key( uint64_t chunk, unsigned int index ) {
+	return ( chunk << QUAL_KEY_SHIFT ) | index;
+}
+
+bool qualside_write_index( const string & file, unsigned int stride, unsigned int nmate,
+							const vector<uint32_t> & count );
+
+bool qualside_open( qualside & qs, const char *prefix );
+void qualside_close( qualside & qs );
+
+// read the KEY in HEX at p; returns the CONVERSION_LOG_END after it
+inline const char * qualside_key( const char *p, uint64_t & key ) {
+	key = 0;
+	for( ; *p != CONVERSION_LOG_END; ++p )
+		key = ( key << 4 ) | ( (*p <= '9') ? (*p - '0') : (*p - 87) );	// 0-9a-f
+	return p;
+}
+
+/*
+ * write the qualities of the given mate of the read to qual (len bytes, reversed if rev is set, i.e.,
+ * the read is reverse-complemented in SAM); returns false if the read is not in the side file
+ * records without SEQ (QUAL is '*') are left unchanged
+*/
+bool qualside_restore( const qualside & qs, uint64_t key, unsigned int mate, char *qual, unsigned int len, bool rev );
+
+#endif
+
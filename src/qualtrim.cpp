@@ -0,0 +1,92 @@
+#include <stdint.h>
+#include "qualtrim.h"
+#include "util.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+const char PHRED64_OFFSET = 31;	// Phred64 - Phred33
+
+#ifdef __SSE2__
+// bit i is set if q[i] < min_quality, for the first n (1-64) cycles; they are converted to Phred33 if required
+static inline uint64_t low_quality_mask( char *q, int n, char min_quality, bool phred64 ) {
+	static const char tail_mask[32] = { -1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+										 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+	const __m128i minq  = _mm_set1_epi8( min_quality );
+	const __m128i shift = _mm_set1_epi8( PHRED64_OFFSET );
+	register uint64_t bad = 0;
+	for( register int i=0; i<n; i+=16 ) {
+		__m128i v = _mm_loadu_si128( (const __m128i *)(q+i) );
+		bad |= (uint64_t)(unsigned int)_mm_movemask_epi8( _mm_cmpgt_epi8(minq, v) ) << i;
+		if( phred64 ) {	// the bytes after the read are stored unchanged
+			__m128i m = ( n-i >= 16 ) ? shift :
+						_mm_and_si128( shift, _mm_loadu_si128((const __m128i *)(tail_mask + 16 - (n-i))) );
+			_mm_storeu_si128( (__m128i *)(q+i), _mm_sub_epi8(v, m) );
+		}
+	}
+	return bad;
+}
+#else
+static inline uint64_t low_quality_mask( char *q, int n, char min_quality, bool phred64 ) {
+	register uint64_t bad = 0;
+	for( register int i=0; i<n; ++i ) {
+		bad |= (uint64_t)( q[i] < min_quality ) << i;
+		if( phred64 )
+			q[i] -= PHRED64_OFFSET;
+	}
+	return bad;
+}
+#endif
+
+// the last cycle of a good window in this word, or -1; prev holds the good cycles of the previous word
+static inline int last_good_window( uint64_t good, uint64_t prev ) {
+	register uint64_t w = good;
+	for( register unsigned int s=1; s!=WINDOW_SIZE_QUALITY_TRIM; ++s )
+		w &= ( good << s ) | ( prev >> (64-s) );
+	return w ? 63 - __builtin_clzll( w ) : -1;
+}
+
+static inline uint64_t valid_cycles( int n ) {
+	return ( n >= 64 ) ? ~0ULL : ( (1ULL << n) - 1 );
+}
+
+int quality_trim_se( char *q, int len, int min_length, char min_quality, bool phred64 ) {
+	register int last = -1;		// the last cycle that ends a good window
+	register uint64_t prev = 0;	// cycles before the read are taken as bad
+	for( register int base=0; base<len; base+=64 ) {
+		register int n = len - base;
+		register uint64_t good = ~low_quality_mask( q+base, (n<64)?n:64, min_quality, phred64 ) & valid_cycles( n );
+		register int k = last_good_window( good, prev );
+		if( k >= 0 )
+			last = base + k;
+		prev = good;
+	}
+	return ( last >= min_length-1 ) ? last + 1 : 0;
+}
+
+int quality_trim_pe( char *q1, char *q2, int len, int min_length, char min_quality, bool phred64 ) {
+	register int last = -1;
+	register uint64_t prev = 0;
+	for( register int base=0; base<len; base+=64 ) {
+		register int n = len - base;
+		register int m = ( n < 64 ) ? n : 64;
+		register uint64_t bad = low_quality_mask( q1+base, m, min_quality, phred64 ) |
+								low_quality_mask( q2+base, m, min_quality, phred64 );
+		register uint64_t good = ~bad & valid_cycles( n );
+		register int k = last_good_window( good, prev );
+		if( k >= 0 )
+			last = base + k;
+		prev = good;
+	}
+	return ( last >= min_length-1 ) ? last + 1 : 0;
+}
+
@@ -0,0 +1,30 @@
+#include "common.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Sliding-window quality trimming for the preprocessors.
+ * The reads are trimmed at the last cycle that ends a window of WINDOW_SIZE_QUALITY_TRIM cycles with
+ * good quality (in both mates for PE). The low-quality cycles are marked in 64-bit masks, 16 cycles
+ * per SIMD compare, and the windows are found by AND-ing the shifted masks; the trimming cycle is then
+ * the highest set bit. The Phred64 to Phred33 conversion is done in the same pass, so each quality
+ * byte is loaded and stored only once.
+ *
+ * The kernels may read up to 63 bytes after the end of the quality (see FQ_BLOCK_PADDING), but they
+ * only modify the first len bytes.
+*/
+
+#ifndef _MSUITE_QUALTRIM_
+#define _MSUITE_QUALTRIM_
+
+// the length after quality trimming, or 0 if it is shorter than min_length
+// the qualities in [0, len) are converted to Phred33 if phred64 is set (after the check)
+int quality_trim_se( char *q, int len, int min_length, char min_quality, bool phred64 );
+int quality_trim_pe( char *q1, char *q2, int len, int min_length, char min_quality, bool phred64 );
+
+#endif
+
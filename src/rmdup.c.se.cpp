@@ -7,6 +7,9 @@
 //#include <stdlib.h>
 //#include <memory.h>
 #include "common.h"
+#include "namedict.h"
+#include "fragment.h"
+#include "dupset.h"
 #include "util.h"
 
 using namespace std;
@@ -19,34 +22,47 @@ using namespace std;
 */
 
 int main( int argc, char *argv[] ) {
-	if( argc != 5 ) {
-		cerr << "\nUsage: " << argv[0] << " <chr.size> <max.insertion=placeholder> <in.c.sam> <out.prefix>\n\n"
+	if( argc < 5 || argc > 7 ) {
+		cerr << "\nUsage: " << argv[0] << " <chr.size|0 for a shard> <max.insertion=placeholder> <in.c.sam|in.c.frag> <out.prefix> [name.prefix|-] [collapsed=0]\n\n"
 			 << "This program is designed to remove the duplicate reads and revert crick to watson chain.\n"
 			 << "Minimum score to keep the alignment: " << MIN_ALIGN_SCORE_KEEP << '\n'
 			 << "Note that for duplicated reads, 1 random one will be kept.\n\n";
 		return 1;
 	}
 
+	// the original read names are put back from prefix.names if they were compacted by the preprocessor
+	namedict nd;
+	bool restore_names = false;
+	if( argc > 5 && strcmp(argv[5], "-") != 0 ) {
+		if( ! namedict_open(nd, argv[5]) )
+			exit( 1 );
+		restore_names = true;
+	}
+
+	// the read names carry the numbers of copies if the duplicates were collapsed by the preprocessor
+	bool collapsed = ( argc > 6 && atoi(argv[6]) != 0 );
+
+	// a shard holds several contigs, see shard.h
+	// the input is SAM or binary fragment records (see fragment.h), and so is the output for meth-calling
+	fragsource fs;
+	if( ! frag_source_open(fs, argv[3]) ) {
+		cerr << "Error: could not read file '" << argv[3] << "'!\n";
+		exit( 10 );
+	}
+
 	int chrsize = atoi( argv[1] );
-	if( chrsize == 0 ) {
+	if( chrsize == 0 && ! fs.indexed ) {	// the sizes of the contigs of a shard are in its index
 		cerr << "ERROR: incorrect chr size!\n";
 		exit(1);
 	}
 	++ chrsize;	// to ease the reversion step
 
-	// prepare file
-	ifstream fin(argv[3]);
-	if( fin.fail() ) {
-		cerr << "Error: could not read file '" << argv[2] << "'!\n";
-		exit( 10 );
-	}
-
 	string outfile = argv[4];
-	outfile += ".rmdup.sam";
+	outfile += fs.binary ? ".rmdup.frag" : ".rmdup.sam";
 	ofstream fout( outfile.c_str() );
 	if( fout.fail() ) {
 		cerr << "Error: could not write sam file!\n";
-		fin.close();
+		frag_source_close( fs );
 		exit( 11 );
 	}
 
@@ -55,27 +71,26 @@ int main( int argc, char *argv[] ) {
 	ofstream fc2w( outfile.c_str() );
 	if( fc2w.fail() ) {
 		cerr << "Error: could not write sam file!\n";
-		fin.close();
+		frag_source_close( fs );
 		fout.close();
 		exit( 12 );
 	}
 
+	fragindex fi;	// of the binary output
+
 	// load sam file
 	unordered_set<int> samHit;
 	register int key;
 	register unsigned int total = 0;
 	register unsigned int discard = 0;
 	register unsigned int dup = 0;
+	register unsigned int copies = 1;	// of the current read
 
-	string read;
 	// r1 and r2 have the same chr and score
-	// flag will be overwritten so do not need to remember it
-	stringstream ss;
-	string name, flag, chr, cigar;
-	string mateflag, matepos, matedist;
+	fragrec r;
+	string name, chr, cigar;
 	string seq, qual;
 	int pos, score;
-	string tmp;
 
 	unsigned int rev_pos;
 	vector<int> revhelper;
@@ -86,8 +101,14 @@ int main( int argc, char *argv[] ) {
 
 //	cerr << "Loading sam file ...\n";
 	while( true ) {
-		getline( fin, read );
-		if( fin.eof() )break;
+		if( ! frag_source_next(fs, r) )break;
+		if( frag_source_changed(fs) ) {	// the first read of a contig
+			if( fs.binary )
+				frag_index_add( fi, frag_source_contig(fs), fout.tellp() );
+			samHit.clear();
+			if( frag_source_contig(fs).size )
+				chrsize = frag_source_contig(fs).size + 1;
+		}
 		++ total;
 
 //		if( ! (lineNum & 0x3fffff) ) {
@@ -97,22 +118,34 @@ int main( int argc, char *argv[] ) {
 //131171	99	c1	145801355	42	100M	=	145801513	258	TATCTCCTAGGAAACTC	HHHHHHHAAA	AS:i:0	XN:i:0	XM:i:0	XO:i:0	XG:i:0	NM:i:0	MD:Z:100	YS:i:0	YT:Z:CP
 //131171	147	c1	145801513	42	100M	=	145801355	-258	AACCTAATTCATTCTGGGT	HHHHHHHHHHHHH	AS:i:0	XN:i:0	XM:i:0	XO:i:0	XG:i:0	NM:i:0	MD:Z:100	YS:i:0	YT:Z:CP
 
-		ss.str( read );
-		ss.clear();
-		ss >> name >> flag >> chr >> pos >> score;
+		frag_field( r, SAM_QNAME, name );
+		frag_field( r, SAM_RNAME, chr );
+		pos   = frag_pos( r );
+		score = frag_mapq( r );
+		if( collapsed ) {	// "COPIES#" in the name, set by T2C
+			copies = dup_strip( name );
+			if( copies == 0 ) {
+				cerr << "Error: read '" << name << "' does not carry the number of copies!\n";
+				exit( 1 );
+			}
+			total += copies - 1;
+		}
 		//note that the reads are always on FORWARD strand in Msuite2
 		if( score < MIN_ALIGN_SCORE_KEEP ) {
-			++ discard;
+			discard += copies;
 			continue;
 		}
 
 		key = pos;
 		if( samHit.find( key ) == samHit.end() ){	// key is not found, this is NOT a duplicate
 			samHit.emplace( key );
-			fout << read << '\n';
+			dup += copies - 1;	// the other copies were collapsed by the preprocessor
+			frag_put( fout, r );
 
 			//// revert to real-watson chain
-			ss >> cigar >> mateflag >> matepos >> matedist >> seq >> qual;
+			frag_field( r, SAM_CIGAR, cigar );
+			frag_field( r, SAM_SEQ, seq );
+			frag_field( r, SAM_QUAL, qual );
 			// reclaculate pos
 			pos += get_readLen_from_cigar( cigar ) - 1;
 			rev_pos = chrsize - pos;
@@ -133,22 +166,7 @@ int main( int argc, char *argv[] ) {
 
 			// remaining tags by bowtie2: I will keep AS and NM tags
 			addTag.clear();	// to be compatible to Msuite1
-			bool AStag = false;
-			bool NMtag = false;
-			while( ss.rdbuf()->in_avail() ) {
-				ss >> tmp;
-				if( tmp[0]=='A' && tmp[1]=='S' ) {
-					addTag += '\t';
-					addTag += tmp;
-					AStag = true;
-					if( NMtag )break;
-				} else if( tmp[0]=='N' && tmp[1]=='M' ) {
-					addTag += '\t';
-					addTag += tmp;
-					NMtag = true;
-					if( AStag )break;
-				}
-			}
+			frag_tags( r, addTag );
 			// if there is NO AS an NM tags, now remaining is NULL
 			addTag += "\tXG:Z:GA\n";
 
@@ -156,17 +174,28 @@ int main( int argc, char *argv[] ) {
 			chr[0] = 'c';	// I use rhr for reversed chromosomes, now change back to chr
 			// read1 flag is ALWAYS 83; read2 flag is always 163; mateflag is always '='
 			// I will output R2 first to speed-up sorting
+			if( restore_names && ! namedict_restore(nd, name) ) {
+				cerr << "Error: read '" << name << "' is not in the name dictionary!\n";
+				exit( 1 );
+			}
 			fc2w << name << "\t16\t" << chr << '\t' << rev_pos << '\t' << score << '\t' << rev_cigar
 				 << "\t*\t0\t0\t" << rev_s << '\t' << rev_q << addTag;
 		} else {	// this is a duplicate, discard it
-			++ dup;
+			dup += copies;
 		}
 	}
-	fin.close();;
+	frag_source_close( fs );
+	if( fs.binary ) {
+		outfile = argv[4];
+		outfile += ".rmdup.frag";
+		frag_index_write( fi, outfile, fout.tellp() );
+	}
 	fout.close();
 	fc2w.close();
 
 	cout << argv[3] << '\t' << total << '\t' << discard << '\t' << dup << '\n';
+	if( restore_names )
+		namedict_close( nd );
 	return 0;
 }
 
@@ -0,0 +1,266 @@
+#include <iostream>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <omp.h>
+#include <vector>
+#include "samreader.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+bool sam_open( samstream & ss, const char *file ) {
+	ss.eof = false;
+	ss.carried = 0;
+	ss.carry = NULL;
+	ss.fd = open( file, O_RDONLY );
+	return ss.fd >= 0;
+}
+
+void sam_close( samstream & ss ) {
+	close( ss.fd );
+	if( ss.carry != NULL )
+		free( ss.carry );
+	ss.carry = NULL;
+	ss.carried = 0;
+}
+
+void sam_block_init( samblock & blk ) {
+	blk.capacity = SAM_BLOCK_SIZE + SAM_READ_CHUNK + SAM_BLOCK_PADDING;
+	blk.arena = (char *) malloc( blk.capacity );
+	blk.used = 0;
+	blk.max_num = SAM_LINE_INIT;
+	blk.line = (size_t *) malloc( sizeof(size_t) * blk.max_num );
+	blk.num = 0;
+	if( blk.arena == NULL || blk.line == NULL ) {
+		cerr << "Error: could not allocate memory for loading alignments!\n";
+		exit(12);
+	}
+}
+
+void sam_block_free( samblock & blk ) {
+	free( blk.arena );
+	free( blk.line );
+	blk.arena = NULL;
+	blk.line = NULL;
+}
+
+// make sure that the arena could hold at least 'need' bytes; offsets are kept, pointers are NOT
+static void sam_reserve( samblock & blk, size_t need ) {
+	if( need <= blk.capacity )
+		return;
+
+	size_t cap = blk.capacity << 1;
+	while( cap < need )
+		cap <<= 1;
+	char *p = (char *) realloc( blk.arena, cap );
+	if( p == NULL ) {
+		cerr << "Error: could not allocate memory for loading alignments!\n";
+		exit(12);
+	}
+	blk.arena = p;
+	blk.capacity = cap;
+}
+
+// make sure that the line index could hold at least 'need' lines
+static void sam_reserve_lines( samblock & blk, size_t need ) {
+	if( need <= blk.max_num )
+		return;
+
+	size_t cap = blk.max_num;
+	while( cap < need )
+		cap <<= 1;
+	size_t *p = (size_t *) realloc( blk.line, sizeof(size_t) * cap );
+	if( p == NULL || cap > (unsigned int) -1 ) {
+		cerr << "Error: could not allocate memory for loading alignments!\n";
+		exit(12);
+	}
+	blk.line = p;
+	blk.max_num = cap;
+}
+
+// fetch the next chunk of the file to the end of the arena
+static void sam_fetch( samstream & ss, samblock & blk ) {
+	sam_reserve( blk, blk.used + SAM_READ_CHUNK + SAM_BLOCK_PADDING );
+
+	long n = read( ss.fd, blk.arena + blk.used, SAM_READ_CHUNK );
+	if( n < 0 ) {
+		cerr << "Error: read sam file failed!\n";
+		exit(11);
+	}
+	if( n == 0 ) {
+		ss.eof = true;
+	} else {
+		blk.used += n;
+	}
+}
+
+// read the data left by the previous block and about SAM_BLOCK_SIZE new bytes; no parsing here
+static void sam_fill( samstream & ss, samblock & blk ) {
+	blk.num  = 0;
+	blk.used = 0;
+
+	if( ss.carried ) {
+		sam_reserve( blk, ss.carried + SAM_READ_CHUNK + SAM_BLOCK_PADDING );
+		memcpy( blk.arena, ss.carry, ss.carried );
+		blk.used = ss.carried;
+		ss.carried = 0;
+	}
+	while( blk.used < SAM_BLOCK_SIZE && ! ss.eof )
+		sam_fetch( ss, blk );
+}
+
+// position of the first '\n' in p[from, to), or 'to' if there is none; number of '\n's in p[from, to)
+#ifdef __SSE2__
+static inline size_t find_newline( const char *p, size_t from, size_t to ) {
+	const __m128i nl = _mm_set1_epi8( '\n' );
+	for( register size_t i=from; i<to; i+=16 ) {	// the padding makes the last load safe
+		register unsigned int m = _mm_movemask_epi8( _mm_cmpeq_epi8(nl, _mm_loadu_si128((const __m128i *)(p+i))) );
+		if( m ) {
+			i += __builtin_ctz( m );
+			return ( i < to ) ? i : to;
+		}
+	}
+	return to;
+}
+
+static inline size_t count_newline( const char *p, size_t from, size_t to ) {
+	const __m128i nl = _mm_set1_epi8( '\n' );
+	register size_t n = 0;
+	register size_t i = from;
+	for( ; i+16 <= to; i+=16 )
+		n += __builtin_popcount( _mm_movemask_epi8( _mm_cmpeq_epi8(nl, _mm_loadu_si128((const __m128i *)(p+i)))) );
+	for( ; i < to; ++i )
+		n += ( p[i] == '\n' );
+	return n;
+}
+#else
+static inline size_t find_newline( const char *p, size_t from, size_t to ) {
+	const char *e = (const char *) memchr( p+from, '\n', to-from );
+	return ( e == NULL ) ? to : e-p;
+}
+
+static inline size_t count_newline( const char *p, size_t from, size_t to ) {
+	register size_t n = 0;
+	for( register size_t i=from; i<to; ++i )
+		n += ( p[i] == '\n' );
+	return n;
+}
+#endif
+
+/*
+ * split the block into lines with 'thread' threads and keep the bytes after the last record for the
+ * next block; more data is fetched if the block does not hold a whole record
+*/
+static unsigned int sam_split( samstream & ss, samblock & blk, unsigned int unit, unsigned int thread ) {
+	vector<size_t> from( thread+1 );	// slice of each thread
+	vector<size_t> before( thread+1 );	// number of '\n's before each slice
+	size_t keep, num, rest;
+	while( true ) {
+		for( unsigned int t=0; t<=thread; ++t )
+			from[t] = blk.used / thread * t + blk.used % thread * t / thread;
+
+		// pass 1: count the '\n's in each slice
+		before[0] = 0;
+		#pragma omp parallel for num_threads(thread) schedule(static, 1)
+		for( unsigned int t=0; t<thread; ++t )
+			before[t+1] = count_newline( blk.arena, from[t], from[t+1] );
+		for( unsigned int t=0; t<thread; ++t )
+			before[t+1] += before[t];
+
+		// complete records; at the end of the file, all the lines are kept
+		keep = before[thread];
+		bool tail = ss.eof && blk.used && blk.arena[ blk.used-1 ] != '\n';	// the last line has no '\n'
+		num  = ss.eof ? keep + tail : keep - keep % unit;
+		if( num >= unit || ss.eof )
+			break;
+		sam_fetch( ss, blk );	// a very long record
+	}
+	if( ! ss.eof )
+		keep = num;
+	sam_reserve_lines( blk, num + 1 );
+
+	// pass 2: record the lines; the '\n's of the kept lines are replaced by '\0's
+	rest = ( keep == 0 ) ? 0 : blk.used;
+	blk.line[0] = 0;
+	#pragma omp parallel for num_threads(thread) schedule(static, 1)
+	for( unsigned int t=0; t<thread; ++t ) {
+		register size_t g  = before[t];	// index of the next '\n'
+		register size_t nl = from[t];
+		while( g < keep ) {
+			nl = find_newline( blk.arena, nl, from[t+1] );
+			if( nl == from[t+1] )
+				break;
+			blk.arena[ nl ] = '\0';
+			++ g;
+			if( g < num ) {
+				blk.line[ g ] = nl + 1;
+			} else {	// the last kept line
+				rest = nl + 1;
+			}
+			++ nl;
+		}
+	}
+	if( num > keep ) {	// the last line of the file without '\n', the padding holds the '\0'
+		blk.arena[ blk.used ] = '\0';
+		rest = blk.used + 1;
+	}
+	blk.line[ num ] = rest;	// the end of the last line, for the line lengths
+	blk.num = num;
+
+	// keep the unused data for the next block
+	if( ! ss.eof && rest != blk.used ) {
+		ss.carried = blk.used - rest;
+		ss.carry = (char *) realloc( ss.carry, ss.carried );
+		if( ss.carry == NULL ) {
+			cerr << "Error: could not allocate memory for loading alignments!\n";
+			exit(12);
+		}
+		memcpy( ss.carry, blk.arena + rest, ss.carried );
+	}
+
+	return blk.num;
+}
+
+unsigned int sam_load_block( samstream & ss, samblock & blk, unsigned int unit, unsigned int thread ) {
+	sam_fill( ss, blk );
+	return sam_split( ss, blk, unit, thread );
+}
+
+void sam_buffer_init( sambuffer & sb, samstream & ss, unsigned int unit, unsigned int thread ) {
+	sb.ss = &ss;
+	sb.unit = unit;
+	sb.thread = thread;
+	sam_block_init( sb.blk[0] );
+	sam_block_init( sb.blk[1] );
+	sb.cur = 1;
+	sb.loader = std::thread( sam_fill, ref(ss), ref(sb.blk[0]) );
+}
+
+void sam_buffer_free( sambuffer & sb ) {
+	if( sb.loader.joinable() )
+		sb.loader.join();
+	sam_block_free( sb.blk[0] );
+	sam_block_free( sb.blk[1] );
+}
+
+samblock & sam_buffer_next( sambuffer & sb ) {
+	if( sb.loader.joinable() )
+		sb.loader.join();
+	sb.cur ^= 1;
+	samblock & blk = sb.blk[ sb.cur ];
+	sam_split( *sb.ss, blk, sb.unit, sb.thread );	// the carried data is known after the splitting
+	if( blk.num != 0 )	// no more loading after the end of the file
+		sb.loader = std::thread( sam_fill, ref(*sb.ss), ref(sb.blk[ sb.cur^1 ]) );
+	return blk;
+}
+
@@ -0,0 +1,89 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Block-based SAM loader for T2C.
+ * A block of about SAM_BLOCK_SIZE bytes is loaded into ONE contiguous arena by large read() calls,
+ * so the memory follows the real size of the records and there is no limit on the line length.
+ * The block is then split into lines by all the threads: each thread counts the '\n's in its own slice
+ * of the arena, and after a prefix sum over the slices it records the offsets of its lines. The block
+ * ends at a record boundary (2 lines for PE), the bytes after it are carried to the next block.
+ * Each '\n' is replaced by '\0' in place, i.e., the lines do NOT keep the tail '\n' as fgets does.
+ *
+ * With a sambuffer, 2 blocks are used in turn: the next block is read by a separate thread while
+ * the current one is processed, so T2C keeps reading the aligner output while it converts the reads.
+*/
+
+#ifndef _MSUITE_SAMREADER_
+#define _MSUITE_SAMREADER_
+
+const size_t SAM_READ_CHUNK    = 8 << 20;	// bytes fetched from the file per read() call
+const size_t SAM_BLOCK_PADDING = 64;		// readable bytes after the loaded data, for the SIMD scan
+const size_t SAM_BLOCK_SIZE    = 256 << 20;	// bytes loaded per block; the arena grows for longer lines
+const unsigned int SAM_LINE_INIT = 1 << 20;	// initial size of the line index, it grows when necessary
+
+// a batch of lines sharing one arena; line[i] is the offset of the i-th line, line[num] is the offset
+// after the '\0' of the last line
+typedef struct {
+	char *arena;
+	size_t used;
+	size_t capacity;
+	size_t *line;
+	unsigned int num;
+	unsigned int max_num;	// size of line
+} samblock;
+
+// an opened sam file; the bytes after the last loaded record of a block are carried to the next block
+typedef struct {
+	int fd;
+	bool eof;
+	char *carry;
+	size_t carried;
+} samstream;
+
+bool sam_open( samstream & ss, const char *file );
+void sam_close( samstream & ss );
+
+void sam_block_init( samblock & blk );
+void sam_block_free( samblock & blk );
+
+/*
+ * load the next block of ss into blk, with 'unit' lines per record (2 for PE) and 'thread' threads
+ * for the splitting; returns the number of loaded lines, which is a multiple of unit except at the
+ * end of the file
+*/
+unsigned int sam_load_block( samstream & ss, samblock & blk, unsigned int unit, unsigned int thread );
+
+// double-buffered loading
+typedef struct {
+	samstream *ss;
+	samblock blk[2];
+	unsigned int cur;	// the block returned by the last sam_buffer_next call
+	unsigned int unit;
+	unsigned int thread;
+	std::thread loader;
+} sambuffer;
+
+void sam_buffer_init( sambuffer & sb, samstream & ss, unsigned int unit, unsigned int thread );
+void sam_buffer_free( sambuffer & sb );
+
+// split the next block and start reading the one after; the previous block is re-used then
+samblock & sam_buffer_next( sambuffer & sb );
+
+inline char * sam_line( const samblock & blk, unsigned int i ) {
+	return blk.arena + blk.line[i];
+}
+
+inline unsigned int sam_line_length( const samblock & blk, unsigned int i ) {
+	return blk.line[i+1] - blk.line[i] - 1;
+}
+
+#endif
+
@@ -0,0 +1,79 @@
+#include <stdint.h>
+#include "samtoken.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+// locate the tabs one byte at a time from line+scan
+static void sam_scan_bytes( samtoken & t, unsigned int want ) {
+	register const char *p = t.line;
+	register unsigned int i = t.scan;
+	for( ; i != t.len; ++i ) {
+		if( p[i] == '\t' && t.num < SAM_MAX_FIELD ) {
+			t.field[ t.num ++ ] = i + 1;
+			if( t.num > want ) {
+				t.scan = i + 1;
+				return;
+			}
+		}
+	}
+	t.field[ t.num ] = i + 1;
+	t.done = true;
+	t.scan = i;
+}
+
+#ifdef __SSE2__
+void sam_scan( samtoken & t, unsigned int want ) {
+	const __m128i vtab = _mm_set1_epi8( '\t' );
+	// whole 32 bytes inside the line only, the rest is left to sam_scan_bytes
+	while( t.scan + 32 <= t.len ) {
+		register const char *p = t.line + t.scan;
+		__m128i lo = _mm_loadu_si128( (const __m128i *) p );
+		__m128i hi = _mm_loadu_si128( (const __m128i *) (p+16) );
+		register uint32_t tab = (uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(lo, vtab)) | ((uint32_t) _mm_movemask_epi8(_mm_cmpeq_epi8(hi, vtab)) << 16);
+		while( tab && t.num < SAM_MAX_FIELD ) {
+			t.field[ t.num ++ ] = t.scan + __builtin_ctz( tab ) + 1;
+			if( t.num > want ) {	// resume after this tab next time
+				t.scan = t.field[ t.num-1 ];
+				return;
+			}
+			tab &= tab - 1;
+		}
+		t.scan += 32;
+	}
+	sam_scan_bytes( t, want );
+}
+#else
+void sam_scan( samtoken & t, unsigned int want ) {
+	sam_scan_bytes( t, want );
+}
+#endif
+
+// the tags of bowtie2 are kept in the order of the record, as in Msuite1
+void sam_keep_tags( samtoken & t, string & tag ) {
+	register unsigned int n = sam_fields( t );
+	bool AStag = false;
+	bool NMtag = false;
+	for( register unsigned int i=SAM_TAGS; i<n; ++i ) {
+		register const char *p = t.line + t.field[i];
+		if( p[0]=='A' && p[1]=='S' ) {	// AS:i:-3
+			AStag = true;
+		} else if( p[0]=='N' && p[1]=='M' ) {	// NM:i:0
+			NMtag = true;
+		} else {
+			continue;
+		}
+		tag += '\t';
+		tag.append( p, t.field[i+1] - t.field[i] - 1 );
+		if( AStag && NMtag )break;
+	}
+}
@@ -0,0 +1,109 @@
+#include <string.h>
+#include <string>
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Tokenizer for SAM records.
+ * The tabs are located 32 bytes at a time (SSE2 compares + movemask), and only as far as the
+ * fields asked for: a caller that needs FLAG and RNAME does not scan the SEQ, QUAL and the tags.
+ * The loads are unaligned and never go past the length of the line, the last bytes (less than 32)
+ * are checked one by one, so no byte outside the line is read.
+ * The integer fields (FLAG, POS, TLEN, etc.) are parsed on the first access and cached.
+ * The line is NOT modified; a field ends at the next '\t' (or the '\0' at the end of the line).
+*/
+
+#ifndef _MSUITE_SAMTOKEN_
+#define _MSUITE_SAMTOKEN_
+
+// the fields of a SAM record
+enum { SAM_QNAME=0, SAM_FLAG, SAM_RNAME, SAM_POS, SAM_MAPQ, SAM_CIGAR,
+	   SAM_RNEXT, SAM_PNEXT, SAM_TLEN, SAM_SEQ, SAM_QUAL, SAM_TAGS };
+
+const unsigned int SAM_MAX_FIELD = 64;	// the tabs after it are kept in the last field
+
+typedef struct {
+	const char *line;
+	unsigned int len;		// length of the line, line[len] is the '\0'
+	unsigned int num;		// number of fields located so far
+	unsigned int scan;		// the bytes before line+scan have been checked
+	bool done;				// the end of the line has been reached
+	unsigned int field[ SAM_MAX_FIELD+1 ];	// offset of each field; field[num] is the end of line + 1 when done
+	unsigned int cached;	// bit i is set if value[i] is parsed
+	int value[ SAM_TAGS ];
+} samtoken;
+
+// start tokenizing a line of len bytes; nothing is scanned until a field is asked for
+inline void sam_tokenize( samtoken & t, const char *line, unsigned int len ) {
+	t.line  = line;
+	t.len   = len;
+	t.num   = 1;
+	t.scan  = 0;
+	t.done  = false;
+	t.field[0] = 0;
+	t.cached = 0;
+}
+
+inline void sam_tokenize( samtoken & t, const char *line ) {
+	sam_tokenize( t, line, strlen(line) );
+}
+
+// locate the fields until field 'want' is found or the line ends
+void sam_scan( samtoken & t, unsigned int want );
+
+// offset of field i in the line; a missing field is an empty string at the end of the line
+inline unsigned int sam_offset( samtoken & t, unsigned int i ) {
+	if( i >= t.num && ! t.done )
+		sam_scan( t, i );
+	return ( i < t.num ) ? t.field[i] : t.field[t.num] - 1;
+}
+
+inline const char * sam_field( samtoken & t, unsigned int i ) {
+	return t.line + sam_offset( t, i );
+}
+
+inline unsigned int sam_length( samtoken & t, unsigned int i ) {
+	if( i+1 >= t.num && ! t.done )
+		sam_scan( t, i+1 );
+	return ( i < t.num ) ? t.field[i+1] - t.field[i] - 1 : 0;
+}
+
+inline void sam_string( samtoken & t, unsigned int i, string & s ) {
+	s.assign( sam_field(t, i), sam_length(t, i) );
+}
+
+// number of fields in the line, the whole line is scanned
+inline unsigned int sam_fields( samtoken & t ) {
+	if( ! t.done )
+		sam_scan( t, SAM_MAX_FIELD );
+	return t.num;
+}
+
+// integer value of field i (i < SAM_TAGS), parsed once
+inline int sam_int( samtoken & t, unsigned int i ) {
+	if( ! (t.cached & (1U << i)) ) {
+		register const char *p = sam_field( t, i );
+		register bool neg = ( *p == '-' );
+		register int v = 0;
+		for( p+=neg; *p>='0' && *p<='9'; ++p )
+			v = v*10 + *p - '0';
+		t.value[i] = neg ? -v : v;
+		t.cached |= 1U << i;
+	}
+	return t.value[i];
+}
+
+inline int sam_flag( samtoken & t ) { return sam_int( t, SAM_FLAG ); }
+inline int sam_pos ( samtoken & t ) { return sam_int( t, SAM_POS  ); }
+inline int sam_mapq( samtoken & t ) { return sam_int( t, SAM_MAPQ ); }
+inline int sam_tlen( samtoken & t ) { return sam_int( t, SAM_TLEN ); }
+
+// append the AS and NM tags of the record to 'tag', each with a leading '\t'
+void sam_keep_tags( samtoken & t, string & tag );
+
+#endif
+
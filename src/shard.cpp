@@ -0,0 +1,148 @@
+#include <iostream>
+#include <sstream>
+#include <string.h>
+#include <unordered_map>
+#include <algorithm>
+#include "shard.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+*/
+
+static bool shard_name_less( const shardcontig & a, const shardcontig & b ) {
+	return a.name < b.name;
+}
+
+bool shard_load( const char *samfile, vector<shardcontig> & contig ) {
+	contig.clear();
+	string file = samfile;
+	file += ".idx";
+	ifstream fin( file.c_str() );
+	if( fin.fail() ) {	// 1 contig
+		shardcontig c;
+		c.size = 0;
+		c.offset.push_back( 0 );
+		c.length.push_back( UINT64_MAX );
+		contig.push_back( c );
+		return false;
+	}
+
+	unordered_map<string, unsigned int> index;
+	stringstream ss;
+	string line, name;
+	unsigned int size;
+	uint64_t offset, length;
+	while( true ) {
+		getline( fin, line );
+		if( fin.eof() )break;
+
+		ss.str( line );
+		ss.clear();
+		if( ! (ss >> name >> size >> offset >> length) ) {
+			cerr << "Error: broken index file '" << file << "'!\n";
+			exit( 1 );
+		}
+		unordered_map<string, unsigned int> :: iterator it = index.find( name );
+		if( it == index.end() ) {
+			it = index.emplace( name, contig.size() ).first;
+			shardcontig c;
+			c.name = name;
+			c.size = size;
+			contig.push_back( c );
+		}
+		contig[ it->second ].offset.push_back( offset );
+		contig[ it->second ].length.push_back( length );
+	}
+	fin.close();
+
+	// the watson and crick files of a shard then give the contigs in the same order
+	sort( contig.begin(), contig.end(), shard_name_less );
+	return true;
+}
+
+// move to the current segment, or the first one of the next contig; returns false after the last one
+static bool shard_seek( shardcursor & sc ) {
+	for( ; sc.c != sc.contig->size(); ++sc.c, sc.seg=0 ) {
+		const shardcontig & c = (*sc.contig)[ sc.c ];
+		if( sc.seg != c.offset.size() ) {
+			sc.fin->clear();
+			sc.fin->seekg( c.offset[ sc.seg ] );
+			sc.left = c.length[ sc.seg ];
+			return true;
+		}
+	}
+	sc.left = 0;
+	return false;
+}
+
+void shard_start( shardcursor & sc, ifstream & fin, const vector<shardcontig> & contig ) {
+	sc.fin = &fin;
+	sc.contig = &contig;
+	sc.c = 0;
+	sc.seg = 0;
+	sc.last = (unsigned int) -1;
+	sc.changed = false;
+	shard_seek( sc );
+}
+
+bool shard_getline( shardcursor & sc, string & line ) {
+	while( sc.left == 0 ) {
+		if( sc.c == sc.contig->size() )
+			return false;
+		++ sc.seg;
+		if( ! shard_seek(sc) )
+			return false;
+	}
+	getline( *sc.fin, line );
+	if( sc.fin->eof() )
+		return false;
+	sc.left -= ( line.size() < sc.left ) ? line.size() + 1 : sc.left;
+	sc.changed = ( sc.c != sc.last );
+	sc.last = sc.c;
+	return true;
+}
+
+static void call_advance( callreader & cr ) {
+	getline( *cr.fin, cr.line );
+	cr.more = ! cr.fin->eof();
+}
+
+void call_start( callreader & cr, ifstream & fin ) {
+	cr.fin = &fin;
+	do {	// skip the header
+		call_advance( cr );
+	} while( cr.more && cr.line[0] == '#' );
+}
+
+bool call_next_contig( callreader & cr, string & contig ) {
+	if( ! cr.more )
+		return false;
+	if( cr.line[0] == SHARD_CONTIG_MARKER ) {
+		contig = cr.line.substr( 4 );	// >chrC or >rhrC
+		call_advance( cr );
+	} else {
+		contig.clear();
+	}
+	return true;
+}
+
+bool call_getline( callreader & cr, string & line ) {
+	if( ! cr.more || cr.line[0] == SHARD_CONTIG_MARKER )
+		return false;
+	line.swap( cr.line );
+	call_advance( cr );
+	return true;
+}
+
+string shard_fasta( const char *dir, const string & rname ) {
+	string file = dir;
+	file += ( rname[0] == 'r' ) ? 'c' : 'w';
+	file += rname.substr( 3 );	// chrC or rhrC
+	file += ".fa";
+	return file;
+}
+
@@ -0,0 +1,88 @@
+#include <stdint.h>
+#include <string.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Contig bucketing for the per-chr stages on genomes with many small contigs (scaffolds).
+ * The small contigs are packed into shards by msuite2 (3rd column of the chr.info given to T2C), and
+ * T2C writes the records of all the contigs of a shard into one file (chrSHARD.sam/rhrSHARD.sam)
+ * with an offset index, file.idx, one line per flush:
+ *   RNAME \t contig.size \t offset \t length
+ * rmdup/tag go through the segments of each contig in turn (in the order of the RNAMEs), so the
+ * duplicates are removed per contig and their outputs are grouped by contig. meth.caller and pair then follow the RNAMEs of a shard and
+ * write a ">RNAME" line before the data of each contig into the call files; for a shard, their genome
+ * argument is the directory of the per-chr fasta files (ending with '/') instead of one fasta file.
+ *
+ * A file without index is read as 1 contig, as before.
+*/
+
+#ifndef _MSUITE_SHARD_
+#define _MSUITE_SHARD_
+
+const char SHARD_CONTIG_MARKER = '>';
+
+typedef struct {
+	string name;			// RNAME, empty for a file without index
+	unsigned int size;		// contig size, 0 for a file without index
+	vector<uint64_t> offset;
+	vector<uint64_t> length;
+} shardcontig;
+
+// line reader over the segments of the contigs of a sam file
+typedef struct {
+	ifstream *fin;
+	const vector<shardcontig> *contig;
+	unsigned int c;			// current contig
+	unsigned int seg;		// current segment of the contig
+	uint64_t left;			// bytes left in the segment
+	unsigned int last;		// contig of the last line read
+	bool changed;			// the last line read is the first one of its contig
+} shardcursor;
+
+// load samfile.idx; returns false (and 1 contig for the whole file) if there is no index
+bool shard_load( const char *samfile, vector<shardcontig> & contig );
+
+void shard_start( shardcursor & sc, ifstream & fin, const vector<shardcontig> & contig );
+
+// read the next line; returns false after the last line of the last contig
+bool shard_getline( shardcursor & sc, string & line );
+
+inline const shardcontig & shard_contig( const shardcursor & sc ) {
+	return (*sc.contig)[ sc.c ];
+}
+
+// the genome argument of meth.caller/pair is a directory for a shard
+inline bool shard_is_dir( const char *gfile ) {
+	size_t len = strlen( gfile );
+	return len && gfile[len-1] == '/';
+}
+
+// reader of the call files of meth.caller
+typedef struct {
+	ifstream *fin;
+	string line;	// the next line
+	bool more;		// line is valid
+} callreader;
+
+void call_start( callreader & cr, ifstream & fin );
+
+// move to the next contig and put its name without chr/rhr into contig ("" for a file without markers);
+// returns false at the end of the file
+bool call_next_contig( callreader & cr, string & contig );
+
+// next call of the current contig
+bool call_getline( callreader & cr, string & line );
+
+// per-chr fasta file of a contig: DIR/wC.fa for chrC and DIR/cC.fa for rhrC
+string shard_fasta( const char *dir, const string & rname );
+
+#endif
+
@@ -7,6 +7,8 @@
 #include <stdlib.h>
 //#include <memory.h>
 #include "common.h"
+#include "namedict.h"
+#include "fragment.h"
 #include "util.h"
 
 using namespace std;
@@ -31,15 +33,32 @@ MD:Z:<S> A string representation of the mismatched reference bases in the alignm
 */
 
 int main( int argc, char *argv[] ) {
-	if( argc != 5 ) {
-		cerr << "\nUsage: " << argv[0] << " <chr.size> <max.insertion> <in.c.sam> <out.prefix>\n\n"
+	if( argc != 5 && argc != 6 ) {
+		cerr << "\nUsage: " << argv[0] << " <chr.size|0 for a shard> <max.insertion> <in.c.sam|in.c.frag> <out.prefix> [name.prefix]\n\n"
 			 << "This program is designed to revert crick to watson chain and fix tags (without rmdup).\n"
 			 << "Minimum score to keep the alignment: " << MIN_ALIGN_SCORE_KEEP << ".\n\n";
 		return 1;
 	}
 
+	// the original read names are put back from prefix.names if they were compacted by the preprocessor
+	namedict nd;
+	bool restore_names = false;
+	if( argc > 5 ) {
+		if( ! namedict_open(nd, argv[5]) )
+			exit( 1 );
+		restore_names = true;
+	}
+
+	// a shard holds several contigs, see shard.h
+	// the input is SAM or binary fragment records (see fragment.h), and so is the output for meth-calling
+	fragsource fs;
+	if( ! frag_source_open(fs, argv[3]) ) {
+		cerr << "Error: could not read file '" << argv[3] << "'!\n";
+		exit( 10 );
+	}
+
 	int chrsize = atoi( argv[1] );
-	if( chrsize == 0 ) {
+	if( chrsize == 0 && ! fs.indexed ) {	// the sizes of the contigs of a shard are in its index
 		cerr << "ERROR: incorrect chr size!\n";
 		exit(1);
 	}
@@ -52,19 +71,12 @@ int main( int argc, char *argv[] ) {
 	}
 	++ maxinsertion;
 
-	// prepare file
-	ifstream fin(argv[3]);
-	if( fin.fail() ) {
-		cerr << "Error: could not read file '" << argv[2] << "'!\n";
-		exit( 10 );
-	}
-
 	string outfile = argv[4];
-	outfile += ".rmdup.sam";	// this file is for meth-calling
+	outfile += fs.binary ? ".rmdup.frag" : ".rmdup.sam";	// this file is for meth-calling
 	ofstream fout( outfile.c_str() );
 	if( fout.fail() ) {
 		cerr << "Error: could not write sam file!\n";
-		fin.close();
+		frag_source_close( fs );
 		exit( 11 );
 	}
 
@@ -73,27 +85,25 @@ int main( int argc, char *argv[] ) {
 	ofstream fc2w( outfile.c_str() );
 	if( fc2w.fail() ) {
 		cerr << "Error: could not write sam file!\n";
-		fin.close();
+		frag_source_close( fs );
 		fout.close();
 		exit( 12 );
 	}
 
+	fragindex fi;	// of the binary output
+
 	// load sam file
 	register unsigned int total = 0;
 	register unsigned int discard = 0;
 	register unsigned int dup = 0;
 	int * size = new int [ maxinsertion ];
 
-	string read1, read2;
 	// r1 and r2 have the same chr and score
-	// flag will be overwritten so do not need to remember it
-	stringstream ss1, ss2;
-	string name1, name2, flag, chr, score_str, cigar1, cigar2;
-	string mateflag, matepos;
+	fragrec r1, r2;
+	string name1, name2, chr, score_str, cigar1, cigar2;
 	string seq1, qual1, seq2, qual2;
 	int pos1, pos2, fragSize;
 	int score;
-	string tmp;
 
 	unsigned int rev_pos1, rev_pos2;
 	vector<int> revhelper;
@@ -104,9 +114,14 @@ int main( int argc, char *argv[] ) {
 
 //	cerr << "Loading sam file ...\n";
 	while( true ) {
-		getline( fin, read1 );
-		if( fin.eof() )break;
-		getline( fin, read2 );
+		if( ! frag_source_next(fs, r1) )break;
+		if( frag_source_changed(fs) ) {	// the first read of a contig
+			if( fs.binary )
+				frag_index_add( fi, frag_source_contig(fs), fout.tellp() );
+			if( frag_source_contig(fs).size )
+				chrsize = frag_source_contig(fs).size + 1;
+		}
+		frag_source_next( fs, r2 );
 		++ total;
 
 //		if( ! (lineNum & 0x3fffff) ) {
@@ -116,14 +131,16 @@ int main( int argc, char *argv[] ) {
 //131171  99 c1 145801355 42 100M = 113  258 TATCTCCTA HHHHHHHAAA AS:i:0 XN:i:0 XM:i:0 XO:i:0 XG:i:0 NM:i:0 MD:Z:100 YS:i:0 YT:Z:CP
 //131171 147 c1 145801513 42 100M = 155 -258 AACCTAATT HHHHHHHHHH AS:i:0 XN:i:0 XM:i:0 XO:i:0 XG:i:0 NM:i:0 MD:Z:100 YS:i:0 YT:Z:CP
 
-		ss1.str( read1 );
-		ss1.clear();
-		ss1 >> name1 >> flag >> chr >> pos1 >> score >> cigar1 >> mateflag >> matepos >> fragSize;
+		frag_field( r1, SAM_QNAME, name1 );
+		pos1  = frag_pos( r1 );
+		score = frag_mapq( r1 );
+		frag_field( r1, SAM_CIGAR, cigar1 );
+		fragSize = frag_tlen( r1 );
 		//note that the reads are always on FORWARD strand in Msuite2
 
-		ss2.str( read2 );
-		ss2.clear();
-		ss2 >> name2 >> flag >> chr >> pos2;
+		frag_field( r2, SAM_QNAME, name2 );
+		frag_field( r2, SAM_RNAME, chr );
+		pos2 = frag_pos( r2 );
 
 		if( pos1 > pos2 ) {	// problematic reads, discard
 			++ discard;
@@ -137,7 +154,8 @@ int main( int argc, char *argv[] ) {
 			continue;
 		}
 
-		fout << read1 << '\n' << read2 << '\n';
+		frag_put( fout, r1 );
+		frag_put( fout, r2 );
 		++ size[ fragSize ];
 
 		//// revert to real-watson chain
@@ -148,7 +166,8 @@ int main( int argc, char *argv[] ) {
 		// cigar
 		revert_cigar( cigar1, rev_cigar1, revhelper );
 		// sequence and quality: make reverse compliment
-		ss1 >> seq1 >> qual1;
+		frag_field( r1, SAM_SEQ, seq1 );
+		frag_field( r1, SAM_QUAL, qual1 );
 		rev_s1.clear();
 		for(it=seq1.crbegin(); it!=seq1.crend(); ++it) {
 			switch( *it ) {
@@ -163,27 +182,15 @@ int main( int argc, char *argv[] ) {
 
 		// remaining tags by bowtie2: I will keep AS and NM tags
 		addTag1.clear();
-		bool AStag = false;
-		bool NMtag = false;
-		while( ss1.rdbuf()->in_avail() ) {
-			ss1 >> tmp;
-			if( tmp[0]=='A' && tmp[1]=='S' ) {
-				addTag1 += '\t';
-				addTag1 += tmp;
-				AStag = true;
-				if( NMtag )break;
-			} else if( tmp[0]=='N' && tmp[1]=='M' ) {
-				addTag1 += '\t';
-				addTag1 += tmp;
-				NMtag = true;
-				if( AStag )break;
-			}
-		}
+		frag_tags( r1, addTag1 );
 		// if there is NO AS an NM tags, now remaining is NULL
 		addTag1 += "\tXG:Z:GA\n";
 
 		// Read 2
-		ss2 >> score_str >> cigar2 >> mateflag >> matepos >> tmp >> seq2 >> qual2;
+		frag_field( r2, SAM_MAPQ, score_str );
+		frag_field( r2, SAM_CIGAR, cigar2 );
+		frag_field( r2, SAM_SEQ, seq2 );
+		frag_field( r2, SAM_QUAL, qual2 );
 
 		pos2 += get_readLen_from_cigar( cigar2 ) - 1;
 		rev_pos2 = chrsize - pos2;
@@ -202,22 +209,7 @@ int main( int argc, char *argv[] ) {
 		rev_q2.assign( qual2.crbegin(), qual2.crend() );
 		// remaining tags by bowtie2: I will keep AS and NM tags
 		addTag2.clear();	// to be compatible to Msuite1
-		AStag = false;
-		NMtag = false;
-		while( ss2.rdbuf()->in_avail() ) {
-			ss2 >> tmp;
-			if( tmp[0]=='A' && tmp[1]=='S' ) {
-				addTag2 += '\t';
-				addTag2 += tmp;
-				AStag = true;
-				if( NMtag )break;
-			} else if( tmp[0]=='N' && tmp[1]=='M' ) {
-				addTag2 += '\t';
-				addTag2 += tmp;
-				NMtag = true;
-				if( AStag )break;
-			}
-		}
+		frag_tags( r2, addTag2 );
 		// if there is NO AS an NM tags, now remaining is NULL
 		addTag2 += "\tXG:Z:GA\n";
 
@@ -225,12 +217,21 @@ int main( int argc, char *argv[] ) {
 		chr[0] = 'c';	// I use rhr for reversed chromosomes, now change back to chr
 		// read1 flag is ALWAYS 83; read2 flag is always 163; mateflag is always '='
 		// I will output R2 first to speed-up sorting
+		if( restore_names && ! (namedict_restore(nd, name1) && namedict_restore(nd, name2)) ) {
+			cerr << "Error: read '" << name1 << "' is not in the name dictionary!\n";
+			exit( 1 );
+		}
 		fc2w << name2 << "\t163\t" << chr << '\t' << rev_pos2 << '\t' << score_str << '\t' << rev_cigar2
 			 << "\t=\t" << rev_pos1 << '\t'  << fragSize << '\t' << rev_s2 << '\t' << rev_q2 << addTag2
 			 << name1 << "\t83\t" << chr << '\t' << rev_pos1 << '\t' << score_str << '\t' << rev_cigar1
 			 << "\t=\t" << rev_pos2 << "\t-" << fragSize << '\t' << rev_s1 << '\t' << rev_q1 << addTag1;
 	}
-	fin.close();;
+	frag_source_close( fs );
+	if( fs.binary ) {
+		outfile = argv[4];
+		outfile += ".rmdup.frag";
+		frag_index_write( fi, outfile, fout.tellp() );
+	}
 	fout.close();
 	fc2w.close();
 
@@ -248,6 +249,8 @@ int main( int argc, char *argv[] ) {
 	}
 	delete [] size;
 
+	if( restore_names )
+		namedict_close( nd );
 	return 0;
 }
 
@@ -10,6 +10,8 @@
 #include <stdlib.h>
 //#include <memory.h>
 #include "common.h"
+#include "namedict.h"
+#include "fragment.h"
 
 using namespace std;
 //using namespace std::tr1;
@@ -22,14 +24,23 @@ using namespace std;
 */
 
 int main( int argc, char *argv[] ) {
-	if( argc != 4 ) {
-		cerr << "\nUsage: " << argv[0] << " <max.insertion> <in.w.sam> <out.prefix>\n\n"
+	if( argc != 4 && argc != 5 ) {
+		cerr << "\nUsage: " << argv[0] << " <max.insertion> <in.w.sam|in.w.frag> <out.prefix> [name.prefix]\n\n"
 			 << "This program is designed to fix the tags (without rmdup).\n"
 			 << "Minimum score to keep the alignment: " << MIN_ALIGN_SCORE_KEEP << ".\n\n";
 
 		return 2;
 	}
 
+	// the original read names are put back from prefix.names if they were compacted by the preprocessor
+	namedict nd;
+	bool restore_names = false;
+	if( argc > 4 ) {
+		if( ! namedict_open(nd, argv[4]) )
+			exit( 1 );
+		restore_names = true;
+	}
+
 	int maxinsertion = atoi( argv[1] );
 	if( maxinsertion == 0 ) {
 		cerr << "Error: incorrect insertion size!\n";
@@ -37,43 +48,44 @@ int main( int argc, char *argv[] ) {
 	}
 	++ maxinsertion;
 
-	// prepare file
-	ifstream fin(argv[2]);
-	if( fin.fail() ) {
+	// prepare file; a shard holds several contigs, see shard.h
+	// the output is in the format of the input: SAM, or binary fragment records (see fragment.h)
+	fragsource fs;
+	if( ! frag_source_open(fs, argv[2]) ) {
 		cerr << "Error: could not read file '" << argv[2] << "'!\n";
 		exit( 1 );
 	}
 
 	string outfile = argv[3];
-	outfile += ".rmdup.sam";
+	outfile += fs.binary ? ".rmdup.frag" : ".rmdup.sam";
 	ofstream fout( outfile.c_str() );
 	if( fout.fail() ) {
 		cerr << "Error: could not write SAM file!\n";
-		fin.close();
+		frag_source_close( fs );
 		exit( 1 );
 	}
+	fragindex fi;	// of the binary output
+	string frag;
 
 	// load sam file
 	register unsigned int total = 0;
 	register unsigned int discard = 0;
 	register unsigned int dup = 0;
 
-	stringstream ss1, ss2;
-	string read1, read2;
-	string name1, name2, flag, chr, score_str, cigar1, cigar2;
-	string mateflag, matepos;
+	fragrec r1, r2;
+	string name1, name2, chr, score_str, cigar1, cigar2;
 	string seq1, qual1, seq2, qual2, addTag1, addTag2;
 	int pos1, pos2, fragSize;
 	int score;
-	string tmp;
 
 	int * size = new int [ maxinsertion ];
 
 //	cerr << "Loading sam file ...\n";
 	while( true ) {
-		getline( fin, read1 );
-		if( fin.eof() )break;
-		getline( fin, read2 );
+		if( ! frag_source_next(fs, r1) )break;
+		if( fs.binary && frag_source_changed(fs) )	// the first read of a contig
+			frag_index_add( fi, frag_source_contig(fs), fout.tellp() );
+		frag_source_next( fs, r2 );
 		++ total;
 
 //		if( ! (lineNum & 0x3fffff) ) {
@@ -83,14 +95,14 @@ int main( int argc, char *argv[] ) {
 //131171	99	c1	145801355	42	100M	=	145801513	258	TATCTCCTAGGAAACTC	HHHHHHHAAA	AS:i:0	XN:i:0	XM:i:0	XO:i:0	XG:i:0	NM:i:0	MD:Z:100	YS:i:0	YT:Z:CP
 //131171	147	c1	145801513	42	100M	=	145801355	-258	AACCTAATTCATTCTGGGT	HHHHHHHHHHHHH	AS:i:0	XN:i:0	XM:i:0	XO:i:0	XG:i:0	NM:i:0	MD:Z:100	YS:i:0	YT:Z:CP
 
-		ss1.str( read1 );
-		ss1.clear();
-		ss1 >> name1 >> flag >> chr >> pos1 >> score >> cigar1 >> mateflag >> matepos >> fragSize;
+		frag_field( r1, SAM_QNAME, name1 );
+		pos1  = frag_pos( r1 );
+		score = frag_mapq( r1 );
+		fragSize = frag_tlen( r1 );
 		//note that the reads are always on FORWARD strand in Msuite2
 
-		ss2.str( read2 );
-		ss2.clear();
-		ss2 >> name2 >> flag >> chr >> pos2;
+		frag_field( r2, SAM_QNAME, name2 );
+		pos2 = frag_pos( r2 );
 
 		if( pos1 > pos2 ) {	// problematic alignment, discard
 			++ discard;
@@ -107,55 +119,44 @@ int main( int argc, char *argv[] ) {
 		++ size[ fragSize ];
 		// process bowtie2 tags
 		// remaining tags by bowtie2: I will keep AS and NM tags
-		ss1 >> seq1 >> qual1;
 		addTag1.clear();
-		bool AStag = false;
-		bool NMtag = false;
-		while( ss1.rdbuf()->in_avail() ) {
-			ss1 >> tmp;
-			if( tmp[0]=='A' && tmp[1]=='S' ) {
-				addTag1 += '\t';
-				addTag1 += tmp;
-				AStag = true;
-				if( NMtag )break;
-			} else if( tmp[0]=='N' && tmp[1]=='M' ) {
-				addTag1 += '\t';
-				addTag1 += tmp;
-				NMtag = true;
-				if( AStag )break;
-			}
-		}
-		addTag1 += "\tXG:Z:CT\n";	// to be compatible with Msuite1
+		frag_tags( r1, addTag1 );
+		addTag1 += "\tXG:Z:CT";	// to be compatible with Msuite1
 
 		// Read 2
-		ss2 >> score_str >> cigar2 >> mateflag >> matepos >> tmp >> seq2 >> qual2;
 		addTag2.clear();
-		AStag = false;
-		NMtag = false;
 		// TODO: should I keep the MD:Z:10G17G56G14A49 tag?
-		while( ss2.rdbuf()->in_avail() ) {
-			ss2 >> tmp;
-			if( tmp[0]=='A' && tmp[1]=='S' ) {	// AS:i:-3
-				addTag2 += '\t';
-				addTag2 += tmp;
-				AStag = true;
-				if( NMtag )break;
-			} else if( tmp[0]=='N' && tmp[1]=='M' ) {	// NM:i:0
-				addTag2 += '\t';
-				addTag2 += tmp;
-				NMtag = true;
-				if( AStag )break;
-			}
-		}
-		addTag2 += "\tXG:Z:CT\n";
+		frag_tags( r2, addTag2 );
+		addTag2 += "\tXG:Z:CT";
 
+		if( restore_names && ! (namedict_restore(nd, name1) && namedict_restore(nd, name2)) ) {
+			cerr << "Error: read '" << name1 << "' is not in the name dictionary!\n";
+			exit( 1 );
+		}
 		// write output
-		fout << name1 << "\t99\t" << chr << '\t' << pos1 << '\t' << score_str << '\t' << cigar1
-			 << "\t=\t" << pos2 << '\t'  << fragSize << '\t' << seq1 << '\t' << qual1 << addTag1
-			 << name2 << "\t147\t" << chr << '\t' << pos2 << '\t' << score_str << '\t' << cigar2
-			 << "\t=\t" << pos1 << "\t-" << fragSize << '\t' << seq2 << '\t' << qual2 << addTag2;
+		if( fs.binary ) {	// CIGAR, SEQ and QUAL are copied as they are
+			frag.clear();
+			frag_rewrite( frag, r1.h, name1,  99, r2.h->mapq,  fragSize, addTag1.data(), addTag1.size() );
+			frag_rewrite( frag, r2.h, name2, 147, r2.h->mapq, -fragSize, addTag2.data(), addTag2.size() );
+			fout << frag;
+		} else {
+			frag_field( r1, SAM_CIGAR, cigar1 );
+			frag_field( r1, SAM_SEQ, seq1 );
+			frag_field( r1, SAM_QUAL, qual1 );
+			frag_field( r2, SAM_RNAME, chr );
+			frag_field( r2, SAM_MAPQ, score_str );
+			frag_field( r2, SAM_CIGAR, cigar2 );
+			frag_field( r2, SAM_SEQ, seq2 );
+			frag_field( r2, SAM_QUAL, qual2 );
+			fout << name1 << "\t99\t" << chr << '\t' << pos1 << '\t' << score_str << '\t' << cigar1
+				 << "\t=\t" << pos2 << '\t'  << fragSize << '\t' << seq1 << '\t' << qual1 << addTag1 << '\n'
+				 << name2 << "\t147\t" << chr << '\t' << pos2 << '\t' << score_str << '\t' << cigar2
+				 << "\t=\t" << pos1 << "\t-" << fragSize << '\t' << seq2 << '\t' << qual2 << addTag2 << '\n';
+		}
 	}
-	fin.close();;
+	frag_source_close( fs );
+	if( fs.binary )
+		frag_index_write( fi, outfile, fout.tellp() );
 	fout.close();
 
 	cout << argv[2] << '\t' << total << '\t' << discard << '\t' << dup << '\n';
@@ -172,6 +173,8 @@ int main( int argc, char *argv[] ) {
 	}
 	delete [] size;
 	
+	if( restore_names )
+		namedict_close( nd );
 	return 0;
 }
 
@@ -10,6 +10,8 @@
 #include <stdlib.h>
 //#include <memory.h>
 #include "common.h"
+#include "namedict.h"
+#include "fragment.h"
 
 using namespace std;
 //using namespace std::tr1;
@@ -22,47 +24,57 @@ using namespace std;
 */
 
 int main( int argc, char *argv[] ) {
-	if( argc != 4 ) {
-		cerr << "\nUsage: " << argv[0] << " <max.insertion=placeholder> <in.w.sam> <out.prefix>\n\n"
+	if( argc != 4 && argc != 5 ) {
+		cerr << "\nUsage: " << argv[0] << " <max.insertion=placeholder> <in.w.sam|in.w.frag> <out.prefix> [name.prefix]\n\n"
 			 << "This program is designed to fix the tags in SAM (without rmdup).\n"
 			 << "Minimum score to keep the alignment: " << MIN_ALIGN_SCORE_KEEP << ".\n\n";
 
 		return 2;
 	}
 
-	// prepare file
-	ifstream fin(argv[2]);
-	if( fin.fail() ) {
+	// the original read names are put back from prefix.names if they were compacted by the preprocessor
+	namedict nd;
+	bool restore_names = false;
+	if( argc > 4 ) {
+		if( ! namedict_open(nd, argv[4]) )
+			exit( 1 );
+		restore_names = true;
+	}
+
+	// prepare file; a shard holds several contigs, see shard.h
+	// the output is in the format of the input: SAM, or binary fragment records (see fragment.h)
+	fragsource fs;
+	if( ! frag_source_open(fs, argv[2]) ) {
 		cerr << "Error: could not read file '" << argv[2] << "'!\n";
 		exit( 1 );
 	}
 
 	string outfile = argv[3];
-	outfile += ".rmdup.sam";
+	outfile += fs.binary ? ".rmdup.frag" : ".rmdup.sam";
 	ofstream fout( outfile.c_str() );
 	if( fout.fail() ) {
 		cerr << "Error: could not write SAM file!\n";
-		fin.close();
+		frag_source_close( fs );
 		exit( 1 );
 	}
+	fragindex fi;	// of the binary output
+	string frag;
 
 	// load sam file
 	register unsigned int total = 0;
 	register unsigned int discard = 0;
 	register unsigned int dup = 0;
 
-	stringstream ss;
-	string read;
-	string name, flag, chr, cigar;
-	string mateflag, matepos, matedist;
+	fragrec r;
+	string name, chr, cigar;
 	string seq, qual, addTag;
 	int pos, score;
-	string tmp;
 
 //	cerr << "Loading sam file ...\n";
 	while( true ) {
-		getline( fin, read );
-		if( fin.eof() )break;
+		if( ! frag_source_next(fs, r) )break;
+		if( fs.binary && frag_source_changed(fs) )	// the first read of a contig
+			frag_index_add( fi, frag_source_contig(fs), fout.tellp() );
 		++ total;
 
 //		if( ! (lineNum & 0x3fffff) ) {
@@ -72,9 +84,9 @@ int main( int argc, char *argv[] ) {
 //131171	99	c1	145801355	42	100M	=	145801513	258	TATCTCCTAGGAAACTC	HHHHHHHAAA	AS:i:0	XN:i:0	XM:i:0	XO:i:0	XG:i:0	NM:i:0	MD:Z:100	YS:i:0	YT:Z:CP
 //131171	147	c1	145801513	42	100M	=	145801355	-258	AACCTAATTCATTCTGGGT	HHHHHHHHHHHHH	AS:i:0	XN:i:0	XM:i:0	XO:i:0	XG:i:0	NM:i:0	MD:Z:100	YS:i:0	YT:Z:CP
 
-		ss.str( read );
-		ss.clear();
-		ss >> name >> flag >> chr >> pos >> score;
+		frag_field( r, SAM_QNAME, name );
+		pos   = frag_pos( r );
+		score = frag_mapq( r );
 		//note that the reads are always on FORWARD strand in Msuite2
 		if( score < MIN_ALIGN_SCORE_KEEP ) {
 			++ discard;
@@ -83,34 +95,36 @@ int main( int argc, char *argv[] ) {
 
 		// process bowtie2 tags
 		// remaining tags by bowtie2: I will keep AS and NM tags
-		ss >> cigar >> mateflag >> matepos >> matedist >> seq >> qual;
 		addTag.clear();
-		bool AStag = false;
-		bool NMtag = false;
-		while( ss.rdbuf()->in_avail() ) {
-			ss >> tmp;
-			if( tmp[0]=='A' && tmp[1]=='S' ) {
-				addTag += '\t';
-				addTag += tmp;
-				AStag = true;
-				if( NMtag )break;
-			} else if( tmp[0]=='N' && tmp[1]=='M' ) {
-				addTag += '\t';
-				addTag += tmp;
-				NMtag = true;
-				if( AStag )break;
-			}
-		}
-		addTag += "\tXG:Z:CT\n";
+		frag_tags( r, addTag );
+		addTag += "\tXG:Z:CT";
 
+		if( restore_names && ! namedict_restore(nd, name) ) {
+			cerr << "Error: read '" << name << "' is not in the name dictionary!\n";
+			exit( 1 );
+		}
 		// write output
-		fout << name << "\t0\t" << chr << '\t' << pos << '\t' << score << '\t' << cigar
-			 << "\t*\t0\t0\t" << seq << '\t' << qual << addTag;
+		if( fs.binary ) {	// CIGAR, SEQ and QUAL are copied as they are
+			frag.clear();
+			frag_rewrite( frag, r.h, name, 0, score, 0, addTag.data(), addTag.size() );
+			fout << frag;
+		} else {
+			frag_field( r, SAM_RNAME, chr );
+			frag_field( r, SAM_CIGAR, cigar );
+			frag_field( r, SAM_SEQ, seq );
+			frag_field( r, SAM_QUAL, qual );
+			fout << name << "\t0\t" << chr << '\t' << pos << '\t' << score << '\t' << cigar
+				 << "\t*\t0\t0\t" << seq << '\t' << qual << addTag << '\n';
+		}
 	}
-	fin.close();;
+	frag_source_close( fs );
+	if( fs.binary )
+		frag_index_write( fi, outfile, fout.tellp() );
 	fout.close();
 
 	cout << argv[2] << '\t' << total << '\t' << discard << '\t' << dup << '\n';
+	if( restore_names )
+		namedict_close( nd );
 	return 0;
 }
 
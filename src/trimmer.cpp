@@ -0,0 +1,491 @@
+#include <string.h>
+#include <stdint.h>
+#include <vector>
+#include "trimmer.h"
+#include "util.h"
+#include "adapter.h"
+#include "emitter.h"
+#include "fqstat.h"
+#include "qualtrim.h"
+#include "qualside.h"
+#include "namedict.h"
+#include "dupset.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package, adapted from Ktrim
+ * Date: Oct 2026
+ *
+ * The conversion log's rule: NOTE that LINE_NUMBER is NO longer recorded in Msuite2
+ *   read 1 (and SE reads):
+ *	   @S|xx;xx$ => for reads with endC and C>T changes, 'S' is its quality score
+ *	   @xx;xx$	 => for reads without endC
+ *	   @$		 => for reads without endC and conversions
+ *   read 2:
+ *	   @S|xx;xx$ => for reads with frontG and G>A changes, 'S' is its quality score
+ *	   @xx;xx$	 => for reads without frontG
+ *	   @$		 => for reads without frontG and conversions
+ *
+ * The positions in the logs are HEX, or a bitmask if it is shorter (see convlog.h).
+ * With the quality side channel, the reads are written in FASTA and the logs are followed by the keys
+ * of the reads in the side file (see qualside.h).
+ * With read-name compaction, the names are the keys of the reads in the name dictionary (see namedict.h).
+ * With duplicate collapsing, the logs are followed by the keys too, and the hash and the bases of each
+ * read are recorded for the writer (see dupset.h).
+*/
+
+static inline bool is_revcomp( const char a, const char b ) {
+	switch( a ) {
+		case 'A': return b=='T';
+		case 'C': return b=='G';
+		case 'G': return b=='C';
+		case 'T': return b=='A';
+		default : return false;
+	}
+}
+
+//check if there is any white space in the ID; if so, remove all the data after the whitespace
+static inline int trim_id( const char *id, int idlen ) {
+	for( register int i=1; i<idlen; ++i ) {
+		if( id[i]==' ' || id[i]=='\t' )
+			return i;
+	}
+	return idlen;
+}
+
+/*
+ * write the name of the read (without '@' and "/1" for PE) to the name dictionary buffer k, and its key
+ * to cid after the first char of id; returns the length of the compacted id
+*/
+static inline int compact_id( outchunk *oc, unsigned int k, const char *id, int idlen, bool pe, char *cid ) {
+	register int len = idlen - 1;
+	if( pe && len>=2 && id[idlen-2]=='/' && id[idlen-1]=='1' )
+		len -= 2;
+	outchunk_reserve( oc, k, len+1 );
+	char *p = oc->buf[k] + oc->size[k];
+	memcpy( p, id+1, len );
+	p[len] = '\n';
+
+	cid[0] = id[0];
+	register int n = emit_base62( cid+1, name_key(oc->seq, oc->size[k]) ) - cid;
+	oc->size[k] += len + 1;
+	return n;
+}
+
+#ifdef __SSE2__
+// bit i is set if s[i] == b, for i in [0, 64)
+static inline uint64_t base_mask( const char *s, char b ) {
+	const __m128i v = _mm_set1_epi8( b );
+	register uint64_t m = 0;
+	for( register int i=0; i!=64; i+=16 )
+		m |= (uint64_t)(unsigned int)_mm_movemask_epi8( _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(s+i)), v) ) << i;
+	return m;
+}
+#else
+static inline uint64_t base_mask( const char *s, char b ) {
+	register uint64_t m = 0;
+	for( register int i=0; i!=64; ++i )
+		m |= (uint64_t)( s[i] == b ) << i;
+	return m;
+}
+#endif
+
+// bits [0, n) of a word
+static inline uint64_t first_bits( int n ) {
+	return ( n >= 64 ) ? ~0ULL : ( (1ULL << n) - 1 );
+}
+
+/*
+ * the conversions are marked in mask, 64 cycles per word, and then applied to the read
+ * the reads are followed by their qualities and FQ_BLOCK_PADDING, so the 64-byte loads after the end
+ * of the read (and 1 byte before it, which is the '\n' of the id line) are safe
+*/
+static inline void apply_conversion( char *seq, uint64_t *mask, unsigned int nword, char to ) {
+	for( register unsigned int k=0; k!=nword; ++k )
+		for( register uint64_t m=mask[k]; m; m &= m-1 )
+			seq[ (k<<6) + __builtin_ctzll(m) ] = to;
+	mask[ nword ] = 0;
+}
+
+// C>T conversion for read1 (and SE reads), the log is written to w; returns the end of the log
+// in mode 4, a 'C' at the end is discarded (but its quality score is recorded), otherwise it may
+// introduce a mismatch in alignment
+template <int MODE>
+static inline char * convert_ct( char *seq, const char *qual, int & len, char *w, uint64_t *mask ) {
+	*w ++ = NORMAL_SEQNAME_START;
+	register unsigned int nword;
+	if( MODE == 3 ) {	// in mode 3, there is NO endC and frontG issues
+		nword = ( len + 63 ) >> 6;
+		for( register unsigned int k=0; k!=nword; ++k )
+			mask[k] = base_mask( seq+(k<<6), 'C' ) & first_bits( len-(k<<6) );
+	} else {
+		register int j = len - 1;
+		if( seq[j] == 'C' ) {
+			w = emit_kept_qual( w, qual[j] );
+			-- len;
+		}
+		// CpG in [0, j); seq[j] is never 'G' here, so the 'G' at j could be checked even if it is discarded
+		nword = ( j + 63 ) >> 6;
+		for( register unsigned int k=0; k!=nword; ++k ) {
+			const char *s = seq + (k<<6);
+			mask[k] = base_mask( s, 'C' ) & base_mask( s+1, 'G' ) & first_bits( j-(k<<6) );
+		}
+	}
+	apply_conversion( seq, mask, nword, 'T' );
+	return emit_convlog( w, mask, nword );
+}
+
+// G>A conversion for read2; in mode 4, a 'G' at the front is discarded (but its quality score is recorded)
+template <int MODE>
+static inline char * convert_ga( char * & seq, char * & qual, int & len, char *w, uint64_t *mask ) {
+	*w ++ = NORMAL_SEQNAME_START;
+	register unsigned int nword = ( len + 63 ) >> 6;
+	register bool frontG = false;
+	if( MODE == 3 ) {
+		for( register unsigned int k=0; k!=nword; ++k )
+			mask[k] = base_mask( seq+(k<<6), 'G' ) & first_bits( len-(k<<6) );
+	} else {
+		frontG = ( seq[0] == 'G' );
+		if( frontG )
+			w = emit_kept_qual( w, qual[0] );
+		// CpG in [1, len)
+		for( register unsigned int k=0; k!=nword; ++k ) {
+			const char *s = seq + (k<<6);
+			mask[k] = base_mask( s, 'G' ) & base_mask( s-1, 'C' ) & first_bits( len-(k<<6) );
+		}
+		mask[0] &= ~1ULL;
+	}
+	apply_conversion( seq, mask, nword, 'A' );
+	if( frontG && len ) {
+		++ seq;
+		++ qual;
+		-- len;
+	}
+	return emit_convlog( w, mask, nword );
+}
+
+template <bool PE, int MODE, bool PHRED64, const adapter_info *AI>
+static void trim_chunk( outchunk *oc, const trim_param & tp ) {
+	const fqblock *wk1 = oc->in;
+	const fqblock *wk2 = oc->in + 1;
+	basecounter & R1stat = oc->stat[0];
+	basecounter & R2stat = oc->stat[1];
+	basecounter & R1stat_trimmed = oc->stat_trimmed[0];
+	basecounter & R2stat_trimmed = oc->stat_trimmed[1];
+	const int min_length = tp.min_length;
+	const int cycle = tp.cycle;
+	const unsigned int side = PE ? 2 : 1;	// the quality side buffer
+	const unsigned int dict = tp.qual_side ? side+1 : side;	// the name dictionary buffer
+	// the keys of the read in the side file and the name dictionary
+	const bool keyed = tp.qual_side || tp.collapse_dup;
+	const unsigned int extra = ( keyed ? 18 : 0 ) + ( tp.compact_names ? MAX_NAME_KEY_SIZE+1 : 0 );
+	char cid[ MAX_NAME_KEY_SIZE+2 ];	// the compacted id
+
+	// the reads are modified in-place in the arena, and "trimmed" by changing the lengths
+	char *id1, *id2=NULL, *seq1, *seq2=NULL, *qual1, *qual2=NULL;
+	register int idlen1, idlen2=0;
+	int len1, len2=0;
+	register int i, j;
+	register int adapter_pos;
+	uint64_t hash = 0, check = 0;
+	char *out1, *out2=NULL, *w1, *w2=NULL;	// start and end of the records in the output buffers
+	vector<uint64_t> mask( (cycle>>6) + 2 );	// converted cycles of a read
+
+	for( register unsigned int ii=0; ii!=wk1->num; ++ii ) {
+		const fqrecord & r1 = wk1->rec[ii];
+		id1   = wk1->arena + r1.id;
+		seq1  = wk1->arena + r1.seq;
+		qual1 = wk1->arena + r1.qual;
+		idlen1 = r1.idlen;
+		len1   = r1.seqlen;
+		j = r1.quallen;
+		if( PE ) {	// check R1/R2 cycles
+			const fqrecord & r2 = wk2->rec[ii];
+			id2   = wk2->arena + r2.id;
+			seq2  = wk2->arena + r2.seq;
+			qual2 = wk2->arena + r2.qual;
+			idlen2 = r2.idlen;
+			if( (int)r2.seqlen < len1 )
+				len1 = r2.seqlen;
+			if( (int)r2.quallen < j )
+				j = r2.quallen;
+		}
+
+		//if the reads are longer than "cycle" paramater, only keep the head "cycle" ones
+		if( len1 > cycle )
+			len1 = cycle;
+		len2 = len1;
+
+		// raw fqstatistics
+		basecounter_add( R1stat, seq1, len1 );
+		if( PE )
+			basecounter_add( R2stat, seq2, len2 );
+
+		// quality control; the quality line could be shorter than the sequence in broken files
+		// the kept qualities are converted to Phred33 in the same pass if necessary
+		if( len1 < j )
+			j = len1;
+		if( PE )
+			i = quality_trim_pe( qual1, qual2, j, min_length, tp.min_quality, PHRED64 );
+		else
+			i = quality_trim_se( qual1, j, min_length, tp.min_quality, PHRED64 );
+		if( i < min_length ) { // not long enough
+			++ oc->dropped;
+			continue;
+		}
+		len1 = i;
+		len2 = i;
+
+		// looking for seed target, 1 mismatch is allowed for these 2 seeds
+		// which means seq1 and seq2 at least should take 1 perfect seed match
+		adapter_pos = PE ? find_adapter_pe( seq1, seq2, len1 ) : find_adapter_se( seq1, len1 );
+		if( adapter_pos >= 0 ) {	// adapter found
+			++ oc->real_adapter;
+			if( adapter_pos >= min_length )	{
+				len1 = adapter_pos;
+				len2 = adapter_pos;
+			} else {	// drop this read as its length is not enough
+				++ oc->dropped;
+				continue;
+			}
+		} else if( PE ) {	// seed not found, now check the tail, if perfect match, trim the tail
+			const char *p = seq1;
+			const char *q = seq2;
+			i = len1 - 2;
+			if( p[i]==AI->adapter_r1[0] && p[i+1]==AI->adapter_r1[1] &&
+						q[i]==AI->adapter_r2[0] && q[i+1]==AI->adapter_r2[1] ) {
+				// if it is a real adapter, then Read1 and Read2 should be complimentary
+				// in real data, the heading 5 bp are usually of poor quality, therefore we test the 6th, 7th
+				if( is_revcomp(p[5], q[i-6]) && is_revcomp(q[5], p[i-6]) ) {
+					if( i < min_length ) {
+						++ oc->dropped;
+						continue;
+					}
+					len1 = i;
+					len2 = i;
+					++ oc->tail_adapter;
+				}
+			} else {	// tail 2 is not good, check tail 1
+				++ i;
+				if( p[i] == AI->adapter_r1[0] && q[i] == AI->adapter_r2[0] ) {
+					if( is_revcomp(p[5], q[i-6]) && is_revcomp(q[5], p[i-6]) &&
+							is_revcomp(p[6], q[i-7]) && is_revcomp(q[6], p[i-7]) ) {
+						if( i < min_length ) {
+							++ oc->dropped;
+							continue;
+						}
+						len1 = i;
+						len2 = i;
+						++ oc->tail_adapter;
+					}
+				}
+			}
+		} else {	// SE: check tail 2 only, as checking tail 1 gives high false-positive
+			i = len1 - 2;
+			if( seq1[i]==AI->adapter_r1[0] && seq1[i+1]==AI->adapter_r1[1] ) {
+				if( i < min_length ) {
+					++ oc->dropped;
+					continue;
+				}
+				len1 = i;
+				++ oc->tail_adapter;
+			}
+		}
+
+		// cut head and tail
+		if( PE ) {
+			if( tp.cut_head[0] ) {
+				i = ( tp.cut_head[0] < len1 ) ? tp.cut_head[0] : len1;
+				seq1  += i;
+				qual1 += i;
+				len1  -= i;
+			}
+			if( tp.cut_tail[0] )
+				len1 = ( tp.cut_tail[0] < len1 ) ? len1 - tp.cut_tail[0] : 0;
+
+			if( len1 < min_length ) {
+				++ oc->dropped;
+				continue;
+			}
+
+			if( tp.cut_head[1] ) {
+				i = ( tp.cut_head[1] < len2 ) ? tp.cut_head[1] : len2;
+				seq2  += i;
+				qual2 += i;
+				len2  -= i;
+			}
+			if( tp.cut_tail[1] )
+				len2 = ( tp.cut_tail[1] < len2 ) ? len2 - tp.cut_tail[1] : 0;
+		} else {	// SE reads are dropped if they are cut entirely
+			if( tp.cut_tail[0] ) {
+				if( len1 > tp.cut_tail[0] ) {
+					len1 -= tp.cut_tail[0];
+				} else {
+					++ oc->dropped;
+					continue;
+				}
+			}
+			if( tp.cut_head[0] ) {
+				if( len1 > tp.cut_head[0] ) {
+					seq1  += tp.cut_head[0];
+					qual1 += tp.cut_head[0];
+					len1  -= tp.cut_head[0];
+				} else {
+					++ oc->dropped;
+					continue;
+				}
+			}
+			if( len1 < min_length ) {
+				++ oc->dropped;
+				continue;
+			}
+		}
+
+		//fqstatistics after trimming
+		basecounter_add( R1stat_trimmed, seq1, len1 );
+		if( PE )
+			basecounter_add( R2stat_trimmed, seq2, len2 );
+
+		idlen1 = trim_id( id1, idlen1 );
+		if( PE )
+			idlen2 = trim_id( id2, idlen2 );
+
+		// the conversion logs and the records are written directly into the output buffers, and
+		// committed only if all the logs are at most max_log
+		outchunk_reserve( oc, 0, emit_bound(idlen1, len1) + extra );
+		out1 = oc->buf[0] + oc->size[0];
+		if( PE ) {
+			outchunk_reserve( oc, 1, emit_bound(idlen2, len2) + extra );
+			out2 = oc->buf[1] + oc->size[1];
+		}
+
+		if( tp.collapse_dup ) {	// the reads before the conversion, so that the logs are compared too
+			hash  = seq_hash( seq1, len1, 0 );
+			check = seq_check( seq1, len1, 0 );
+			if( PE ) {
+				hash  = seq_hash( seq2, len2, hash );
+				check = seq_check( seq2, len2, check );
+			}
+		}
+
+		if( MODE == 0 ) {	// no need to do conversion
+			if( tp.compact_names ) {
+				idlen1 = compact_id( oc, dict, id1, idlen1, PE, cid );
+				id1 = cid;
+				if( PE ) {
+					id2 = cid;
+					idlen2 = idlen1;
+				}
+			}
+			w1 = emit_fastq( out1, id1, idlen1, seq1, qual1, len1 );
+			if( PE )
+				w2 = emit_fastq( out2, id2, idlen2, seq2, qual2, len2 );
+		} else {	// C>T in read1, G>A in read2
+			w1 = convert_ct<MODE>( seq1, qual1, len1, out1, mask.data() );
+			if( w1 - out1 > tp.max_log ) {
+				++ oc->dropped;
+				continue;
+			}
+			if( PE ) {
+				w2 = convert_ga<MODE>( seq2, qual2, len2, out2, mask.data() );
+				if( w2 - out2 > tp.max_log ) {
+					++ oc->dropped;
+					continue;
+				}
+			}
+
+			if( tp.compact_names ) {
+				idlen1 = compact_id( oc, dict, id1, idlen1, PE, cid );
+				id1 = cid;
+				if( PE ) {
+					id2 = cid;
+					idlen2 = idlen1;
+				}
+			}
+			id1[0] = CONVERSION_LOG_END;
+			if( PE )
+				id2[0] = CONVERSION_LOG_END;
+			if( keyed ) {	// the keys of the reads in the side file or the duplicate table
+				uint64_t key = qual_key( oc->seq, ii - oc->dropped );
+				*w1 ++ = CONVERSION_LOG_END;
+				w1 = tp.collapse_dup ? emit_dup_key( w1, key ) : emit_hex( w1, key );
+				if( PE ) {
+					*w2 ++ = CONVERSION_LOG_END;
+					w2 = tp.collapse_dup ? emit_dup_key( w2, key ) : emit_hex( w2, key );
+				}
+			}
+			if( tp.qual_side ) {	// FASTA reads, the qualities go to the side file
+				out1[0] = FASTA_SEQNAME_START;
+				w1 = emit_fasta( w1, id1, idlen1, seq1, len1 );
+				if( PE ) {
+					out2[0] = FASTA_SEQNAME_START;
+					w2 = emit_fasta( w2, id2, idlen2, seq2, len2 );
+				}
+
+				outchunk_reserve( oc, side, cycle*side );
+				char *q = oc->buf[side] + oc->size[side];
+				q = emit_side_qual( q, qual1, len1, cycle );
+				if( PE )
+					q = emit_side_qual( q, qual2, len2, cycle );
+				oc->size[side] = q - oc->buf[side];
+			} else {
+				w1 = emit_fastq( w1, id1, idlen1, seq1, qual1, len1 );
+				if( PE )
+					w2 = emit_fastq( w2, id2, idlen2, seq2, qual2, len2 );
+			}
+		}
+		oc->size[0] = w1 - oc->buf[0];
+		if( PE )
+			oc->size[1] = w2 - oc->buf[1];
+		if( tp.collapse_dup ) {
+			oc->hash.push_back( hash );
+			oc->check.push_back( check );
+			oc->rec_end[0].push_back( oc->size[0] );
+			if( PE )
+				oc->rec_end[1].push_back( oc->size[1] );
+		}
+	}
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////
+// dispatcher
+static inline bool same_kit( const adapter_info *a, const adapter_info & b ) {
+	return strcmp(a->adapter_r1, b.adapter_r1)==0 && strcmp(a->adapter_r2, b.adapter_r2)==0;
+}
+
+template <bool PE, int MODE, bool PHRED64>
+static chunk_kernel select_kit( const adapter_info *ai ) {
+	if( same_kit(ai, illumina_adapter) )
+		return trim_chunk<PE, MODE, PHRED64, &illumina_adapter>;
+	if( same_kit(ai, nextera_adapter) )
+		return trim_chunk<PE, MODE, PHRED64, &nextera_adapter>;
+	if( same_kit(ai, bgi_adapter) )
+		return trim_chunk<PE, MODE, PHRED64, &bgi_adapter>;
+	return NULL;
+}
+
+template <bool PE, int MODE>
+static chunk_kernel select_phred( bool phred64, const adapter_info *ai ) {
+	return phred64 ? select_kit<PE, MODE, true>( ai ) : select_kit<PE, MODE, false>( ai );
+}
+
+template <bool PE>
+static chunk_kernel select_mode( int mode, bool phred64, const adapter_info *ai ) {
+	switch( mode ) {
+		case 0: return select_phred<PE, 0>( phred64, ai );
+		case 3: return select_phred<PE, 3>( phred64, ai );
+		case 4: return select_phred<PE, 4>( phred64, ai );
+		default: return NULL;
+	}
+}
+
+chunk_kernel trim_kernel( bool pe, int mode, bool phred64, const adapter_info *ai ) {
+	return pe ? select_mode<true>( mode, phred64, ai ) : select_mode<false>( mode, phred64, ai );
+}
+
@@ -0,0 +1,37 @@
+#include "common.h"
+#include "pipeline.h"
+
+using namespace std;
+
+/*
+ * Author: Kun Sun (sunkun@szbl.ac.cn)
+ * This program is part of the Msuite2 package
+ * Date: Oct 2026
+ *
+ * Per-read engine of the preprocessors: statistics, quality-trimming, adapter-trimming, cutting,
+ * C>T/G>A conversion and output of the reads in a chunk.
+ * The engine is a template specialized at compile time on PE/SE, conversion mode, Phred64 to Phred33
+ * conversion and library kit; trim_kernel() picks the instance for the run, so the per-read loop of
+ * each instance does not carry the branches of the other options.
+*/
+
+#ifndef _MSUITE_TRIMMER_
+#define _MSUITE_TRIMMER_
+
+typedef struct trim_param {
+	unsigned int cycle;		// reads longer than cycle are truncated
+	int min_length;
+	char min_quality;
+	int cut_head[ MAX_FASTQ_FILE ];
+	int cut_tail[ MAX_FASTQ_FILE ];
+	int max_log;			// reads with longer conversion logs are dropped
+	bool qual_side;			// write FASTA reads and send the qualities to the side file (see qualside.h)
+	bool compact_names;		// replace the read names by their keys in the name dictionary (see namedict.h)
+	bool collapse_dup;		// record the hash of each read for duplicate collapsing (see dupset.h)
+} trim_param;
+
+// the kernel for the run, or NULL if the mode or kit is not supported
+chunk_kernel trim_kernel( bool pe, int mode, bool phred64, const adapter_info *ai );
+
+#endif
+
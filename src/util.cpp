@@ -224,159 +224,3 @@ void revert_MDtag(string &raw, string &rev, vector<int> &seg ) {
 		}
 	}
 }
-
-// segment SAM record
-void parseSAM( char * psam, samRecord & read ) {
-	register unsigned int i = 1;
-	read.seqName = 0;
-	while( true ) {	//flag
-		if( psam[i]=='\t' ) {++ i;read.flag = i;break;}
-		++ i;
-	}
-	while( true ) {	//chr
-		if( psam[i]=='\t' ) {++ i;read.chr = i;break;}
-		++ i;
-	}
-	while( true ) {	//pos
-		if( psam[i]=='\t' ) {++ i;read.pos = i;break;}
-		++ i;
-	}
-	while( true ) {	//score
-		if( psam[i]=='\t' ) {++ i;read.score = i;break;}
-		++ i;
-	}
-	while( true ) {	//cigar
-		if( psam[i]=='\t' ) {++ i;read.cigar = i;break;}
-		++ i;
-	}
-	while( true ) {	//mateflag
-		if( psam[i]=='\t' ) {++ i;read.mateflag = i;break;}
-		++ i;
-	}
-	while( true ) {	//matepos
-		if( psam[i]=='\t' ) {++ i;read.matepos = i;break;}
-		++ i;
-	}
-	while( true ) {	//matedist
-		if( psam[i]=='\t' ) {++ i;read.matedist = i;break;}
-		++ i;
-	}
-	while( true ) {	//seq
-		if( psam[i]=='\t' ) {++ i;read.seq = i;break;}
-		++ i;
-	}
-	while( true ) {	//qual
-		if( psam[i]=='\t' ) {++ i;read.qual = i;break;}
-		++ i;
-	}
-	while( true ) {	//remaining
-		if( psam[i]=='\t' ) {++ i;read.remaining = i;break;}
-		++ i;
-	}
-}
-
-// this is seems not very useful
-void parseSAM_mode4( char * psam, samRecord & read ) {
-	register unsigned int i = 1;
-	read.seqName = 0;
-	while( true ) {	//flag
-		if( psam[i]=='\t' ) {psam[i]='\0';++ i;read.flag = i;break;}
-		++ i;
-	}
-	while( true ) {	//chr
-		if( psam[i]=='\t' ) {psam[i]='\0';++ i;read.chr = i;break;}
-		++ i;
-	}
-	while( true ) {	//pos
-		if( psam[i]=='\t' ) {psam[i]='\0';++ i;read.pos = i;break;}
-		++ i;
-	}
-	while( true ) {	//score
-		if( psam[i]=='\t' ) {psam[i]='\0';++ i;read.score = i;break;}
-		++ i;
-	}
-	while( true ) {	//cigar
-		if( psam[i]=='\t' ) {psam[i]='\0';++ i;read.cigar = i;break;}
-		++ i;
-	}
-	while( true ) {	//mateflag
-		if( psam[i]=='\t' ) {psam[i]='\0';++ i;read.mateflag = i;break;}
-		++ i;
-	}
-	while( true ) {	//matepos
-		if( psam[i]=='\t' ) {psam[i]='\0';++ i;read.matepos = i;break;}
-		++ i;
-	}
-	while( true ) {	//matedist
-		if( psam[i]=='\t' ) {psam[i]='\0';++ i;read.matedist = i;break;}
-		++ i;
-	}
-	while( true ) {	//seq
-		if( psam[i]=='\t' ) {psam[i]='\0';++ i;read.seq = i;break;}
-		++ i;
-	}
-	while( true ) {	//qual
-		if( psam[i]=='\t' ) {psam[i]='\0';++ i;read.qual = i;break;}
-		++ i;
-	}
-	while( true ) {	//remaining
-		if( psam[i]=='\t' ) {psam[i]='\0';++ i;read.remaining = i;break;}
-		++ i;
-	}
-}
-
-// sliding window for quality-trimming
-int get_quality_trim_cycle_se( const char *p, const int read_length, const int min_length, const char min_quality ) {
-	register int i, j, k;
-	register int stop = min_length-1;
-	for( i=read_length-1; i>=stop; ) {
-		if( p[i] >= min_quality ) {
-			k = i - WINDOW_SIZE_QUALITY_TRIM;
-			for( j=i-1; j!=k; --j ) {
-				if( j<0 || p[j]<min_quality ) {
-					break;
-				}
-			}
-			if( j == k ) { // find the quality trimming position
-				break;
-			} else {	// there is a low-quality base in the middle
-				i = j - 1;
-			}
-		} else {
-			-- i;
-		}
-	}
-
-	if( i >= stop )
-		return i + 1;
-	else
-		return 0;
-}
-
-int get_quality_trim_cycle_pe( const char *p, const char *q, const int read_length, const int min_length, const char min_quality ) {
-	register int i, j, k;
-	register int stop = min_length - 1;
-	for( i=read_length-1; i>=stop; ) {
-		if( p[i]>=min_quality && q[i]>=min_quality ) {
-			k = i - WINDOW_SIZE_QUALITY_TRIM;
-			for( j=i-1; j!=k; --j ) {
-				if( j<0 || p[j]<min_quality || q[j]<min_quality ) {
-					break;
-				}
-			}
-			if( j == k ) { // find the quality trimming position
-				break;
-			} else {
-				i = j - 1;
-			}
-		} else {
-			-- i;
-		}
-	}
-	
-	if( i >= stop )
-		return i + 1;
-	else
-		return 0;
-}
-
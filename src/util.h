@@ -52,29 +52,10 @@ typedef struct {
 	unsigned int cZ;	// neither 'C' nor 'T'; SNPs or sequencing errors
 } pairedmeth;
 
-typedef struct {
-	unsigned int seqName;
-	unsigned int flag;
-	unsigned int chr;
-	unsigned int pos;
-	unsigned int score;
-	unsigned int cigar;
-	unsigned int mateflag;
-	unsigned int matepos;
-	unsigned int matedist;
-	unsigned int seq;
-	unsigned int qual;
-	unsigned int remaining;
-} samRecord;	//each element records the position in the char array of the corresponding element
-
 // load genome from multi-fasta
 void loadgenome( const char * file, unordered_map<string, string> & genome );
 void loadchr( const char * file, string & genome );
 
-// quality-trimming
-int get_quality_trim_cycle_se( const char *p, const int read_size, const int min_length, const char min_quality );
-int get_quality_trim_cycle_pe( const char *p, const char *q, const int read_size, const int min_length, const char min_quality );
-
 // fix cigar
 void add_1M_to_cigar_end(char *cigar, int len, char *tail_added);
 int get_readLen_from_cigar( const string &cigar );
@@ -83,10 +64,6 @@ bool fix_cigar(string &cigar, string &realSEQ, string &realQUAL, string &seq, st
 void revert_cigar(string &raw, string &rev, vector<int> &seg );
 void revert_MDtag(string &raw, string &rev, vector<int> &seg );
 
-// segment SAM
-void parseSAM( char * psam, samRecord & read );
-void parseSAM_mode4( char * psam, samRecord & read );
-
 // usage information for meth.call
 void call_meth_usage( const char * prg );
 